@@ -0,0 +1,270 @@
+#pragma once
+
+#include <webgpu/webgpu_cpp.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+// Memory accounting: heap use of the stb encoders and the GPU resources the renderer creates.
+// stb_image_write allocates through countedMalloc/countedRealloc/countedFree when the
+// translation unit with STB_IMAGE_WRITE_IMPLEMENTATION defines STBIW_MALLOC,
+// STBIW_REALLOC_SIZED and STBIW_FREE as them (see main.cpp); every block carries a small header
+// with its size and tag, so frees are attributed exactly. Allocations are tagged with the
+// encoder and pixel format of the innermost AllocScope on the thread, which also measures the
+// peak heap use of one encode: a frame's cost. Without the hooks the scopes count nothing.
+// GPU textures and buffers are counted when created through createTrackedTexture and
+// createTrackedBuffer; the renderer keeps them for its lifetime, so the totals are what it
+// holds unless something starts allocating per frame.
+
+enum class AllocTag : uint32_t {
+    Other,             // outside any AllocScope
+    PngRgba,           // the frame as RGBA PNG
+    PngGray,           // R8 readback as grayscale PNG
+    PngFiltered,       // PNG with scanlines filtered on the GPU
+    PngThumbnail,      // the 1/2, 1/4 and 1/8 size thumbnails
+    JpegRgb,           // RGB24 readback as JPEG
+    JpegCoefficients,  // JPEG from coefficients quantized on the GPU
+    HdrFloat,          // float targets as Radiance HDR
+    DeepZoomPng,       // PNG deep zoom tiles
+    DeepZoomJpeg,      // JPEG deep zoom tiles
+};
+
+constexpr uint32_t kAllocTagCount = 10;
+
+inline const char* allocTagName(AllocTag tag) {
+    switch (tag) {
+        case AllocTag::Other:
+            return "other";
+        case AllocTag::PngRgba:
+            return "png_rgba";
+        case AllocTag::PngGray:
+            return "png_gray";
+        case AllocTag::PngFiltered:
+            return "png_filtered";
+        case AllocTag::PngThumbnail:
+            return "png_thumbnail";
+        case AllocTag::JpegRgb:
+            return "jpg_rgb";
+        case AllocTag::JpegCoefficients:
+            return "jpg_coefficients";
+        case AllocTag::HdrFloat:
+            return "hdr_float";
+        case AllocTag::DeepZoomPng:
+            return "deep_zoom_png";
+        case AllocTag::DeepZoomJpeg:
+            return "deep_zoom_jpg";
+    }
+    return "";
+}
+
+inline void atomicMax(std::atomic<int64_t>& target, int64_t value) {
+    int64_t current = target.load(std::memory_order_relaxed);
+    while (value > current &&
+           !target.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+struct AllocCounters {
+    std::atomic<uint64_t> calls{0};  // mallocs and reallocs
+    std::atomic<uint64_t> frees{0};
+    std::atomic<uint64_t> bytes{0};  // requested in total; reallocs count their growth
+    std::atomic<int64_t> live{0};
+    std::atomic<int64_t> peak{0};
+    // AllocScopes that ended, with their calls and peak heap use
+    std::atomic<uint64_t> frames{0};
+    std::atomic<uint64_t> frameCalls{0};
+    std::atomic<int64_t> lastFramePeak{0};
+    std::atomic<int64_t> maxFramePeak{0};
+};
+
+struct AllocationStats {
+    AllocCounters tags[kAllocTagCount];
+    std::atomic<int64_t> live{0};
+    std::atomic<int64_t> peak{0};
+    std::atomic<uint64_t> textures{0};
+    std::atomic<uint64_t> textureBytes{0};
+    std::atomic<uint64_t> buffers{0};
+    std::atomic<uint64_t> bufferBytes{0};
+
+    // One line of JSON: heap totals, every tag with allocations, and the GPU resources.
+    void dump(FILE* out) const {
+        fprintf(out, "{\"heap\": {\"live\": %lld, \"peak\": %lld}",
+                (long long)live.load(std::memory_order_relaxed),
+                (long long)peak.load(std::memory_order_relaxed));
+        for (uint32_t i = 0; i < kAllocTagCount; ++i) {
+            const AllocCounters& c = tags[i];
+            uint64_t calls = c.calls.load(std::memory_order_relaxed);
+            if (calls == 0) {
+                continue;
+            }
+            uint64_t frames = c.frames.load(std::memory_order_relaxed);
+            fprintf(out,
+                    ", \"%s\": {\"calls\": %llu, \"frees\": %llu, \"bytes\": %llu, "
+                    "\"live\": %lld, \"peak\": %lld, \"frames\": %llu, \"calls_per_frame\": "
+                    "%.1f, \"frame_peak\": %lld, \"max_frame_peak\": %lld}",
+                    allocTagName(AllocTag(i)), (unsigned long long)calls,
+                    (unsigned long long)c.frees.load(std::memory_order_relaxed),
+                    (unsigned long long)c.bytes.load(std::memory_order_relaxed),
+                    (long long)c.live.load(std::memory_order_relaxed),
+                    (long long)c.peak.load(std::memory_order_relaxed),
+                    (unsigned long long)frames,
+                    frames ? double(c.frameCalls.load(std::memory_order_relaxed)) / frames : 0.0,
+                    (long long)c.lastFramePeak.load(std::memory_order_relaxed),
+                    (long long)c.maxFramePeak.load(std::memory_order_relaxed));
+        }
+        fprintf(out,
+                ", \"gpu\": {\"textures\": %llu, \"texture_bytes\": %llu, \"buffers\": %llu, "
+                "\"buffer_bytes\": %llu}}\n",
+                (unsigned long long)textures.load(std::memory_order_relaxed),
+                (unsigned long long)textureBytes.load(std::memory_order_relaxed),
+                (unsigned long long)buffers.load(std::memory_order_relaxed),
+                (unsigned long long)bufferBytes.load(std::memory_order_relaxed));
+        fflush(out);
+    }
+};
+
+// Process-wide, like the allocator hooks feeding it.
+inline AllocationStats allocationStats;
+
+struct AllocThreadState {
+    AllocTag tag = AllocTag::Other;
+    // this thread's heap use; `peak` since the innermost AllocScope began
+    int64_t live = 0;
+    int64_t peak = 0;
+    uint64_t calls = 0;
+};
+
+inline thread_local AllocThreadState allocThread;
+
+// Block header, keeping the payload aligned like malloc's.
+struct alignas(std::max_align_t) AllocHeader {
+    size_t size;
+    AllocTag tag;
+};
+
+inline void countAlloc(AllocTag tag, int64_t delta, bool call) {
+    AllocCounters& c = allocationStats.tags[uint32_t(tag)];
+    if (call) {
+        c.calls.fetch_add(1, std::memory_order_relaxed);
+        ++allocThread.calls;
+    }
+    if (delta > 0) {
+        c.bytes.fetch_add(uint64_t(delta), std::memory_order_relaxed);
+    }
+    atomicMax(c.peak, c.live.fetch_add(delta, std::memory_order_relaxed) + delta);
+    atomicMax(allocationStats.peak,
+              allocationStats.live.fetch_add(delta, std::memory_order_relaxed) + delta);
+    allocThread.live += delta;
+    allocThread.peak = std::max(allocThread.peak, allocThread.live);
+}
+
+inline void* countedMalloc(size_t size) {
+    AllocHeader* header = static_cast<AllocHeader*>(malloc(sizeof(AllocHeader) + size));
+    if (!header) {
+        return nullptr;
+    }
+    *header = {size, allocThread.tag};
+    countAlloc(header->tag, int64_t(size), true);
+    return header + 1;
+}
+
+// The old size comes from the header; stb's is the capacity it asked for, not the block's.
+inline void* countedRealloc(void* p, size_t, size_t newSize) {
+    if (!p) {
+        return countedMalloc(newSize);
+    }
+    AllocHeader* header = static_cast<AllocHeader*>(p) - 1;
+    size_t oldSize = header->size;
+    AllocTag tag = header->tag;
+    header = static_cast<AllocHeader*>(realloc(header, sizeof(AllocHeader) + newSize));
+    if (!header) {
+        return nullptr;
+    }
+    header->size = newSize;
+    countAlloc(tag, int64_t(newSize) - int64_t(oldSize), true);
+    return header + 1;
+}
+
+inline void countedFree(void* p) {
+    if (!p) {
+        return;
+    }
+    AllocHeader* header = static_cast<AllocHeader*>(p) - 1;
+    allocationStats.tags[uint32_t(header->tag)].frees.fetch_add(1, std::memory_order_relaxed);
+    countAlloc(header->tag, -int64_t(header->size), false);
+    free(header);
+}
+
+// Tags the thread's allocations until destroyed and records them as one frame of the tag:
+// the calls made and the peak heap use above what the thread held when the scope began.
+struct AllocScope {
+    AllocTag tag;
+    AllocTag previousTag;
+    int64_t startLive;
+    int64_t previousPeak;
+    uint64_t startCalls;
+
+    explicit AllocScope(AllocTag scopeTag)
+        : tag(scopeTag),
+          previousTag(allocThread.tag),
+          startLive(allocThread.live),
+          previousPeak(allocThread.peak),
+          startCalls(allocThread.calls) {
+        allocThread.tag = tag;
+        allocThread.peak = allocThread.live;
+    }
+
+    ~AllocScope() {
+        AllocCounters& c = allocationStats.tags[uint32_t(tag)];
+        int64_t framePeak = allocThread.peak - startLive;
+        c.frames.fetch_add(1, std::memory_order_relaxed);
+        c.frameCalls.fetch_add(allocThread.calls - startCalls, std::memory_order_relaxed);
+        c.lastFramePeak.store(framePeak, std::memory_order_relaxed);
+        atomicMax(c.maxFramePeak, framePeak);
+        allocThread.tag = previousTag;
+        allocThread.peak = std::max(previousPeak, allocThread.peak);
+    }
+
+    AllocScope(const AllocScope&) = delete;
+    AllocScope& operator=(const AllocScope&) = delete;
+};
+
+// Bytes per texel of uncompressed formats; 4 for anything else.
+inline uint32_t texelBytes(wgpu::TextureFormat format) {
+    switch (format) {
+        case wgpu::TextureFormat::R8Unorm:
+            return 1;
+        case wgpu::TextureFormat::RGBA16Float:
+        case wgpu::TextureFormat::RG32Uint:
+            return 8;
+        case wgpu::TextureFormat::RGBA32Float:
+        case wgpu::TextureFormat::RGBA32Uint:
+            return 16;
+        default:
+            return 4;
+    }
+}
+
+inline wgpu::Texture createTrackedTexture(const wgpu::Device& device,
+                                          const wgpu::TextureDescriptor& desc) {
+    uint64_t bytes = 0;
+    for (uint32_t level = 0; level < desc.mipLevelCount; ++level) {
+        bytes += uint64_t(std::max(1u, desc.size.width >> level)) *
+                 std::max(1u, desc.size.height >> level) * desc.size.depthOrArrayLayers;
+    }
+    bytes *= uint64_t(texelBytes(desc.format)) * desc.sampleCount;
+    allocationStats.textures.fetch_add(1, std::memory_order_relaxed);
+    allocationStats.textureBytes.fetch_add(bytes, std::memory_order_relaxed);
+    return device.CreateTexture(&desc);
+}
+
+inline wgpu::Buffer createTrackedBuffer(const wgpu::Device& device,
+                                        const wgpu::BufferDescriptor& desc) {
+    allocationStats.buffers.fetch_add(1, std::memory_order_relaxed);
+    allocationStats.bufferBytes.fetch_add(desc.size, std::memory_order_relaxed);
+    return device.CreateBuffer(&desc);
+}
@@ -0,0 +1,284 @@
+// Microbenchmarks for the stb writers, no GPU involved. Every encoder runs over the synthetic
+// image corpus at a range of resolutions, channel counts and settings; results go to stdout as
+// a JSON array with one object per case: throughput in MB/s of input, ns per pixel and
+// output/input size ratio.
+//
+// Before benchmarking, a CPU model of the GPU PNG filter (gpu_png_filter.h) is run over small
+// corpus images; its rows deflated by stbi_write_png_filtered_to_func must give the same file as
+// stbi_write_png_to_func, or the benchmark fails.
+//
+// Usage: bench_encoders [--max-size N] [--min-time ms] [--filter name] [--content name]
+//   --max-size  largest width to run (default 7680, i.e. 8K)
+//   --min-time  repeat each case for at least this long (default 300 ms)
+//   --filter    only run encoders whose name contains this
+//   --content   only run corpus images whose name contains this (see image_corpus.h)
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "image_corpus.h"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#define __STDC_LIB_EXT1__
+#include "stb_image_write.h"
+
+namespace {
+
+struct Resolution {
+    int width;
+    int height;
+};
+
+const Resolution kResolutions[] = {
+    {256, 256}, {512, 512}, {1024, 1024}, {1920, 1080}, {3840, 2160}, {7680, 4320}};
+
+std::vector<float> makeRadiance(const std::vector<uint8_t>& image) {
+    std::vector<float> radiance(image.size());
+    for (size_t i = 0; i < image.size(); ++i) {
+        radiance[i] = image[i] / 255.0f * 4.0f;
+    }
+    return radiance;
+}
+
+void countBytes(void* context, void*, int size) {
+    *static_cast<size_t*>(context) += size_t(size);
+}
+
+void appendBytes(void* context, void* data, int size) {
+    std::vector<uint8_t>* out = static_cast<std::vector<uint8_t>*>(context);
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    out->insert(out->end(), bytes, bytes + size);
+}
+
+// The shader in gpu_png_filter.h, a row at a time: the filter with the lowest sum of absolute
+// signed bytes (first on ties), written as the filter type byte and the filtered RGBA bytes.
+std::vector<uint8_t> filterPngRows(const uint8_t* rgba, int width, int height) {
+    auto at = [&](int x, int y, int channel) {
+        return x < 0 || y < 0 ? 0 : int(rgba[(size_t(y) * width + x) * 4 + channel]);
+    };
+    auto filtered = [&](int x, int y, int channel, int filter) {
+        int cur = at(x, y, channel);
+        int a = at(x - 1, y, channel);
+        int b = at(x, y - 1, channel);
+        int c = at(x - 1, y - 1, channel);
+        int p = a + b - c;
+        int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+        int paeth = pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+        const int predictors[5] = {0, a, b, (a + b) >> 1, paeth};
+        return uint8_t(cur - predictors[filter]);
+    };
+    std::vector<uint8_t> rows;
+    rows.reserve((size_t(width) * 4 + 1) * height);
+    for (int y = 0; y < height; ++y) {
+        int best = 0;
+        uint32_t bestCost = 0;
+        for (int filter = 0; filter < 5; ++filter) {
+            uint32_t cost = 0;
+            for (int x = 0; x < width; ++x) {
+                for (int channel = 0; channel < 4; ++channel) {
+                    cost += uint32_t(abs(int8_t(filtered(x, y, channel, filter))));
+                }
+            }
+            if (filter == 0 || cost < bestCost) {
+                best = filter;
+                bestCost = cost;
+            }
+        }
+        rows.push_back(uint8_t(best));
+        for (int x = 0; x < width; ++x) {
+            for (int channel = 0; channel < 4; ++channel) {
+                rows.push_back(filtered(x, y, channel, best));
+            }
+        }
+    }
+    return rows;
+}
+
+// Whether GPU-filtered rows would produce the files stbi_write_png does, on every corpus image
+// at sizes whose rows don't end on a storage word.
+bool checkPngFilter() {
+    const Resolution sizes[] = {{1, 1}, {37, 23}, {130, 67}};
+    for (CorpusImage corpusImage : kCorpusImages) {
+        for (const Resolution& r : sizes) {
+            std::vector<uint8_t> image = generateCorpusImage(corpusImage, r.width, r.height, 4);
+            std::vector<uint8_t> expected;
+            std::vector<uint8_t> actual;
+            stbi_write_png_to_func(appendBytes, &expected, r.width, r.height, 4, image.data(),
+                                   r.width * 4);
+            std::vector<uint8_t> rows = filterPngRows(image.data(), r.width, r.height);
+            stbi_write_png_filtered_to_func(appendBytes, &actual, r.width, r.height, 4,
+                                            rows.data());
+            if (expected.empty() || actual != expected) {
+                fprintf(stderr, "GPU PNG filter model differs from stbi_write_png on %s %dx%d\n",
+                        corpusImageName(corpusImage), r.width, r.height);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+struct Options {
+    int maxSize = 7680;
+    double minTimeMs = 300;
+    const char* filter = "";
+    const char* content = "";
+};
+
+struct Case {
+    const char* encoder;
+    const char* content;
+    int width;
+    int height;
+    int channels;
+    // compression level, JPEG quality or RLE on/off; -1 where nothing is tunable
+    int setting;
+    size_t inputBytes;
+    // encodes once and returns the output size
+    std::function<size_t()> run;
+};
+
+bool first = true;
+
+void runCase(const Options& options, const Case& c) {
+    using Clock = std::chrono::steady_clock;
+    size_t outputBytes = c.run();  // warm-up
+    int iterations = 0;
+    Clock::time_point start = Clock::now();
+    double elapsedMs = 0;
+    do {
+        outputBytes = c.run();
+        ++iterations;
+        elapsedMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    } while (elapsedMs < options.minTimeMs);
+
+    double seconds = elapsedMs / 1000.0 / iterations;
+    double pixels = double(c.width) * c.height;
+    printf("%s\n  {\"encoder\": \"%s\", \"content\": \"%s\", \"width\": %d, \"height\": %d, "
+           "\"channels\": %d, \"setting\": %d, \"iterations\": %d, \"mb_per_s\": %.2f, "
+           "\"ns_per_pixel\": %.3f, \"ratio\": %.4f}",
+           first ? "[" : ",", c.encoder, c.content, c.width, c.height, c.channels, c.setting,
+           iterations,
+           c.inputBytes / seconds / 1e6, seconds * 1e9 / pixels,
+           double(outputBytes) / double(c.inputBytes));
+    fflush(stdout);
+    first = false;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; i += 2) {
+        if (i + 1 == argc) {
+            fprintf(stderr, "Missing value for %s\n", argv[i]);
+            return 1;
+        }
+        if (strcmp(argv[i], "--max-size") == 0) {
+            options.maxSize = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--min-time") == 0) {
+            options.minTimeMs = atof(argv[i + 1]);
+        } else if (strcmp(argv[i], "--filter") == 0) {
+            options.filter = argv[i + 1];
+        } else if (strcmp(argv[i], "--content") == 0) {
+            options.content = argv[i + 1];
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (!checkPngFilter()) {
+        return 1;
+    }
+
+    auto add = [&](Case c) {
+        if (strstr(c.encoder, options.filter)) {
+            runCase(options, c);
+        }
+    };
+
+    for (CorpusImage corpusImage : kCorpusImages) {
+        const char* content = corpusImageName(corpusImage);
+        if (!strstr(content, options.content)) {
+            continue;
+        }
+        for (const Resolution& r : kResolutions) {
+            if (r.width > options.maxSize) {
+                continue;
+            }
+            for (int channels : {1, 3, 4}) {
+                std::vector<uint8_t> image = generateCorpusImage(corpusImage, r.width, r.height,
+                                                                 channels);
+                size_t bytes = image.size();
+                const uint8_t* data = image.data();
+                int w = r.width;
+                int h = r.height;
+
+                for (int level : {1, 5, 8, 9}) {
+                    add({"png_to_mem", content, w, h, channels, level, bytes, [=] {
+                             stbi_write_png_compression_level = level;
+                             int length = 0;
+                             unsigned char* png = stbi_write_png_to_mem(data, w * channels, w, h,
+                                                                        channels, &length);
+                             STBIW_FREE(png);
+                             return size_t(length);
+                         }});
+                    add({"zlib_compress", content, w, h, channels, level, bytes, [=] {
+                             int length = 0;
+                             unsigned char* z = stbi_zlib_compress(const_cast<uint8_t*>(data),
+                                                                   int(bytes), &length, level);
+                             STBIW_FREE(z);
+                             return size_t(length);
+                         }});
+                }
+                stbi_write_png_compression_level = 8;
+
+                if (channels != 1) {
+                    for (int quality : {50, 90, 100}) {
+                        add({"jpg_to_func", content, w, h, channels, quality, bytes, [=] {
+                                 size_t length = 0;
+                                 stbi_write_jpg_to_func(countBytes, &length, w, h, channels, data,
+                                                        quality);
+                                 return length;
+                             }});
+                    }
+
+                    std::vector<float> radiance = makeRadiance(image);
+                    add({"hdr_to_func", content, w, h, channels, -1,
+                         radiance.size() * sizeof(float), [&radiance, w, h, channels] {
+                             size_t length = 0;
+                             stbi_write_hdr_to_func(countBytes, &length, w, h, channels,
+                                                    radiance.data());
+                             return length;
+                         }});
+                }
+
+                for (int rle : {0, 1}) {
+                    add({"tga_to_func", content, w, h, channels, rle, bytes, [=] {
+                             stbi_write_tga_with_rle = rle;
+                             size_t length = 0;
+                             stbi_write_tga_to_func(countBytes, &length, w, h, channels, data);
+                             return length;
+                         }});
+                }
+                stbi_write_tga_with_rle = 1;
+
+                add({"bmp_to_func", content, w, h, channels, -1, bytes, [=] {
+                         size_t length = 0;
+                         stbi_write_bmp_to_func(countBytes, &length, w, h, channels, data);
+                         return length;
+                     }});
+            }
+        }
+    }
+    printf("%s\n", first ? "[]" : "\n]");
+    return 0;
+}
@@ -0,0 +1,166 @@
+// End-to-end benchmark of the render -> readback -> encode -> write loop: WebGpuRenderer runs
+// headless on Dawn's CPU Vulkan adapter (SwiftShader) or on the Null backend, over a range of
+// resolutions, readback ring depths, output formats and encode worker counts. Results go to
+// stdout as a JSON array with one object per case: sustained frames per second and the p50,
+// p95 and p99 latency of every stage in microseconds.
+//
+// Usage: bench_pipeline [--backend swiftshader|null] [--max-size N] [--min-time ms]
+//                       [--filter format]
+//   --backend   adapter to render on (default swiftshader; Dawn has to be configured with
+//               -DDAWN_ENABLE_SWIFTSHADER=ON for it)
+//   --max-size  largest width to run (default 3840)
+//   --min-time  render each case for at least this long (default 2000 ms)
+//   --filter    only run formats whose name contains this
+// Frames are written to test_output_buffer.* in the working directory, like the app does.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#define __STDC_LIB_EXT1__
+#include "stb_image_write.h"
+
+#include "webgpu_renderer.h"
+
+namespace {
+
+struct Resolution {
+    uint32_t width;
+    uint32_t height;
+};
+
+const Resolution kResolutions[] = {{512, 512}, {1280, 720}, {1920, 1080}, {3840, 2160}};
+
+struct Format {
+    const char* name;
+    void (*configure)(WebGpuRenderer& renderer);
+};
+
+const Format kFormats[] = {
+    {"png", [](WebGpuRenderer&) {}},
+    {"png_gpu_filter", [](WebGpuRenderer& r) { r.gpuPngFilter = true; }},
+    {"jpg", [](WebGpuRenderer& r) { r.readbackLayout = ReadbackLayout::RGB24; }},
+    {"gpu_jpg", [](WebGpuRenderer& r) { r.gpuJpegQuality = 90; }},
+    {"bc7", [](WebGpuRenderer& r) { r.blockCompression = BlockCompression::BC7; }},
+    {"yuv", [](WebGpuRenderer& r) { r.readbackLayout = ReadbackLayout::I420; }},
+    {"hdr", [](WebGpuRenderer& r) { r.targetFormat = wgpu::TextureFormat::RGBA16Float; }},
+};
+
+const uint32_t kReadbackDepths[] = {1, 2, 4};
+const uint32_t kEncodeWorkers[] = {0, 1, 2, 4};
+
+// frames rendered and flushed before measuring, to get past pipeline creation and first maps
+constexpr int kWarmupFrames = 5;
+
+struct Options {
+    bool swiftShader = true;
+    uint32_t maxSize = 3840;
+    double minTimeMs = 2000;
+    const char* filter = "";
+};
+
+bool first = true;
+
+bool runCase(const Options& options, const Format& format, Resolution r, uint32_t depth,
+             uint32_t workers) {
+    using Clock = std::chrono::steady_clock;
+    FrameStats stats;
+    WebGpuRenderer renderer;
+    if (options.swiftShader) {
+        renderer.backendType = wgpu::BackendType::Vulkan;
+        renderer.adapterType = wgpu::AdapterType::CPU;
+    } else {
+        renderer.backendType = wgpu::BackendType::Null;
+    }
+    format.configure(renderer);
+    renderer.readbackDepth = depth;
+    renderer.encodeWorkers = workers;
+    renderer.sink = makeFileSink();
+    renderer.stats = &stats;
+    renderer.init(nullptr, r.width, r.height);
+    if (!renderer.device) {
+        return false;
+    }
+
+    for (int i = 0; i < kWarmupFrames; ++i) {
+        renderer.draw();
+    }
+    renderer.flush();
+    stats.reset();
+
+    Clock::time_point start = Clock::now();
+    double elapsedMs = 0;
+    do {
+        renderer.draw();
+        elapsedMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    } while (elapsedMs < options.minTimeMs);
+    renderer.flush();
+    elapsedMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    uint64_t frames = stats.frameCount();
+    printf("%s\n  {\"format\": \"%s\", \"width\": %u, \"height\": %u, \"readback_depth\": %u, "
+           "\"encode_workers\": %u, \"frames\": %llu, \"fps\": %.2f",
+           first ? "[" : ",", format.name, r.width, r.height, renderer.readbackDepth,
+           renderer.encodeWorkers, (unsigned long long)frames, frames / (elapsedMs / 1000.0));
+    for (uint32_t i = 0; i < kFrameStageCount; ++i) {
+        FrameStage stage = FrameStage(i);
+        printf(", \"%s\": {\"p50\": %.1f, \"p95\": %.1f, \"p99\": %.1f}", frameStageName(stage),
+               stats.percentile(stage, 50), stats.percentile(stage, 95),
+               stats.percentile(stage, 99));
+    }
+    printf("}");
+    fflush(stdout);
+    first = false;
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; i += 2) {
+        if (i + 1 == argc) {
+            fprintf(stderr, "Missing value for %s\n", argv[i]);
+            return 1;
+        }
+        if (strcmp(argv[i], "--backend") == 0) {
+            options.swiftShader = strcmp(argv[i + 1], "null") != 0;
+        } else if (strcmp(argv[i], "--max-size") == 0) {
+            options.maxSize = uint32_t(atoi(argv[i + 1]));
+        } else if (strcmp(argv[i], "--min-time") == 0) {
+            options.minTimeMs = atof(argv[i + 1]);
+        } else if (strcmp(argv[i], "--filter") == 0) {
+            options.filter = argv[i + 1];
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    for (const Format& format : kFormats) {
+        if (!strstr(format.name, options.filter)) {
+            continue;
+        }
+        for (const Resolution& r : kResolutions) {
+            if (r.width > options.maxSize) {
+                continue;
+            }
+            for (uint32_t depth : kReadbackDepths) {
+                for (uint32_t workers : kEncodeWorkers) {
+                    if (!runCase(options, format, r, depth, workers)) {
+                        fprintf(stderr, "No %s adapter\n",
+                                options.swiftShader ? "SwiftShader" : "Null");
+                        printf("%s\n", first ? "[]" : "\n]");
+                        return 1;
+                    }
+                }
+            }
+        }
+    }
+    printf("%s\n", first ? "[]" : "\n]");
+    return 0;
+}
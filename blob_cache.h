@@ -0,0 +1,162 @@
+#pragma once
+
+#include <dawn/platform/DawnPlatform.h>
+#include <webgpu/webgpu_cpp.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Dawn's blob cache on disk, so compiled shaders and pipelines survive the process. Dawn keys
+// every blob by everything that went into it (WGSL, pipeline state, toggles, adapter); each key
+// gets a file named after its hash under a directory per adapter and driver, so entries of a
+// replaced driver can simply be deleted. Files hold the key to rule out hash collisions, and
+// are written to a temporary name and renamed, so concurrent processes and Dawn's worker
+// threads only ever see whole entries. Nothing is ever evicted.
+
+struct DiskBlobCache : dawn::platform::CachingInterface {
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> stores{0};
+
+    explicit DiskBlobCache(std::filesystem::path rootPath) : root(std::move(rootPath)) {
+    }
+
+    // Must be called before the device is created; Dawn only loads and stores from then on.
+    void setAdapter(const wgpu::AdapterProperties& properties) {
+        uint64_t hash = kHashSeed;
+        uint32_t ids[] = {uint32_t(properties.backendType), properties.vendorID,
+                          properties.deviceID};
+        hash = hashBytes(hash, ids, sizeof(ids));
+        for (const char* s : {properties.name, properties.driverDescription}) {
+            hash = hashBytes(hash, s, s ? strlen(s) : 0);
+        }
+        directory = root / hex(hash);
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+        if (error) {
+            fprintf(stderr, "Failed to create blob cache directory %s\n",
+                    directory.string().c_str());
+            directory.clear();
+        }
+    }
+
+    // With `value` null, the size of the entry; otherwise copies the entry and returns its
+    // size. 0 when there is no entry or it doesn't fit in `valueSize`.
+    size_t LoadData(const void* key, size_t keySize, void* value, size_t valueSize) override {
+        if (directory.empty()) {
+            return 0;
+        }
+        FILE* file = fopen(entryPath(key, keySize).string().c_str(), "rb");
+        size_t size = file ? readEntry(file, key, keySize, value, valueSize) : 0;
+        if (file) {
+            fclose(file);
+        }
+        // Dawn asks for the size first and only reads entries that exist
+        if (size == 0) {
+            misses.fetch_add(1, std::memory_order_relaxed);
+        } else if (value) {
+            hits.fetch_add(1, std::memory_order_relaxed);
+        }
+        return size;
+    }
+
+    void StoreData(const void* key, size_t keySize, const void* value, size_t valueSize) override {
+        if (directory.empty()) {
+            return;
+        }
+        std::filesystem::path path = entryPath(key, keySize);
+        std::filesystem::path temporary = path;
+        // unique across threads and processes writing the same entry
+        uint64_t writer = std::hash<std::thread::id>()(std::this_thread::get_id()) ^
+                          uint64_t(std::chrono::steady_clock::now().time_since_epoch().count());
+        temporary += "." + hex(writer) + ".tmp";
+        FILE* file = fopen(temporary.string().c_str(), "wb");
+        if (!file) {
+            return;
+        }
+        uint64_t header[3] = {kMagic, keySize, valueSize};
+        bool ok = fwrite(header, sizeof(header), 1, file) == 1 &&
+                  fwrite(key, 1, keySize, file) == keySize &&
+                  fwrite(value, 1, valueSize, file) == valueSize;
+        ok = fclose(file) == 0 && ok;
+        std::error_code error;
+        if (ok) {
+            std::filesystem::rename(temporary, path, error);
+        }
+        if (!ok || error) {
+            std::filesystem::remove(temporary, error);
+            return;
+        }
+        stores.fetch_add(1, std::memory_order_relaxed);
+    }
+
+  private:
+    static constexpr uint64_t kMagic = 0x3165686361636264;  // "dbcache1"
+    static constexpr uint64_t kHashSeed = 0xcbf29ce484222325;
+
+    // 64-bit FNV-1a
+    static uint64_t hashBytes(uint64_t hash, const void* data, size_t size) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; ++i) {
+            hash = (hash ^ bytes[i]) * 0x100000001b3;
+        }
+        return hash;
+    }
+
+    static std::string hex(uint64_t value) {
+        char text[17];
+        snprintf(text, sizeof(text), "%016llx", (unsigned long long)value);
+        return text;
+    }
+
+    std::filesystem::path entryPath(const void* key, size_t keySize) const {
+        return directory / (hex(hashBytes(kHashSeed, key, keySize)) + ".bin");
+    }
+
+    static size_t readEntry(FILE* file, const void* key, size_t keySize, void* value,
+                            size_t valueSize) {
+        uint64_t header[3];
+        if (fread(header, sizeof(header), 1, file) != 1 || header[0] != kMagic ||
+            header[1] != keySize) {
+            return 0;
+        }
+        std::vector<uint8_t> storedKey(keySize);
+        if (fread(storedKey.data(), 1, keySize, file) != keySize ||
+            memcmp(storedKey.data(), key, keySize) != 0) {
+            return 0;
+        }
+        size_t size = size_t(header[2]);
+        if (!value) {
+            return size;
+        }
+        if (valueSize < size || fread(value, 1, size, file) != size) {
+            return 0;
+        }
+        return size;
+    }
+
+    const std::filesystem::path root;
+    // root/<adapter and driver hash>; empty until setAdapter() succeeds
+    std::filesystem::path directory;
+};
+
+// Hands Dawn the cache; everything else keeps Dawn's defaults.
+struct BlobCachePlatform : dawn::platform::Platform {
+    dawn::platform::CachingInterface* cache;
+
+    explicit BlobCachePlatform(dawn::platform::CachingInterface* cachingInterface)
+        : cache(cachingInterface) {
+    }
+
+    dawn::platform::CachingInterface* GetCachingInterface() override {
+        return cache;
+    }
+};
@@ -0,0 +1,363 @@
+#pragma once
+
+#include <webgpu/webgpu_cpp.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "alloc_stats.h"
+#include "shader_module.h"
+#include "worker_pool.h"
+
+// Tile pyramid output for renders too large to view as one image. Every level down to 1x1 is
+// produced by 2x box downsampling on the GPU; each level is then read back one band of tiles
+// at a time through a small pool of staging buffers, and the tiles of a mapped band are
+// encoded on worker threads while the next bands are copied and mapped. Files follow the Deep
+// Zoom (DZI: base.dzi plus base_files/level/col_row.ext) or XYZ (base/z/x/y.ext, z = 0 being
+// the level that fits one tile) layout, without overlap; edge tiles are cropped.
+
+enum class DeepZoomLayout { Dzi, Xyz };
+
+const char deepZoomShaderCode[] = R"(
+override srgb: bool = false;
+
+@group(0) @binding(0) var src: texture_2d<f32>;
+@group(0) @binding(1) var dst: texture_storage_2d<rgba8unorm, write>;
+
+fn decoded(c: vec4f) -> vec4f {
+    if (!srgb) {
+        return c;
+    }
+    let curve = pow((c.rgb + 0.055) / 1.055, vec3f(2.4));
+    return vec4f(select(curve, c.rgb / 12.92, c.rgb <= vec3f(0.04045)), c.a);
+}
+
+fn encoded(c: vec4f) -> vec4f {
+    if (!srgb) {
+        return c;
+    }
+    let rgb = clamp(c.rgb, vec3f(0.0), vec3f(1.0));
+    let curve = 1.055 * pow(rgb, vec3f(1.0 / 2.4)) - 0.055;
+    return vec4f(select(curve, rgb * 12.92, rgb <= vec3f(0.0031308)), c.a);
+}
+
+// one texel of the next level; odd edges repeat the last source row and column
+@compute @workgroup_size(8, 8)
+fn main(@builtin(global_invocation_id) id: vec3u) {
+    if (any(id.xy >= textureDimensions(dst))) {
+        return;
+    }
+    let last = textureDimensions(src) - 1u;
+    let s = id.xy * 2u;
+    let sum = decoded(textureLoad(src, min(s, last), 0)) +
+              decoded(textureLoad(src, min(s + vec2u(1u, 0u), last), 0)) +
+              decoded(textureLoad(src, min(s + vec2u(0u, 1u), last), 0)) +
+              decoded(textureLoad(src, min(s + vec2u(1u, 1u), last), 0));
+    textureStore(dst, id.xy, encoded(sum * 0.25));
+}
+)";
+
+struct DeepZoomExporter {
+    // Encodes one tile of tightly packed RGBA rows to `path`; called from worker threads.
+    using TileEncoder = std::function<void(const char* path, const uint8_t* rgba, uint32_t w,
+                                           uint32_t h)>;
+
+    struct Options {
+        std::string basePath;
+        DeepZoomLayout layout = DeepZoomLayout::Dzi;
+        uint32_t tileSize = 256;
+        const char* extension = "png";
+        // staging buffers, i.e. bands in flight
+        uint32_t bandBuffers = 4;
+    };
+
+    // One tile row of one level.
+    struct Band {
+        enum class State { Free, Mapping, Mapped, Encoding };
+        wgpu::Buffer buffer;
+        State state = State::Free;
+        uint32_t level = 0;
+        uint32_t row = 0;
+        std::atomic<uint32_t> pending{0};
+    };
+
+    Options options;
+    TileEncoder encodeTile;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    // DZI level numbering: maxLevel is the full frame, 0 is 1x1
+    uint32_t maxLevel = 0;
+    bool swapRedBlue = false;
+    wgpu::Device device;
+    wgpu::Texture target;
+    // levels maxLevel - 1 down to 0
+    std::vector<wgpu::Texture> levels;
+    std::vector<wgpu::BindGroup> bindGroups;
+    wgpu::ComputePipeline pipeline;
+    std::vector<std::unique_ptr<Band>> bands;
+    std::unique_ptr<WorkerPool> pool;
+    // (level, row) of every band of the current export, and how many have been issued
+    std::vector<std::pair<uint32_t, uint32_t>> jobs;
+    size_t nextJob = 0;
+    bool running = false;
+
+    // `targetView` is a non-sRGB view of the 8-bit RGBA/BGRA `targetTexture` (TextureBinding
+    // and CopySrc usage); `srgb` whether the texels are sRGB encoded.
+    void init(const wgpu::Device& dev, const wgpu::Texture& targetTexture,
+              const wgpu::TextureView& targetView, bool bgra, bool srgb, uint32_t frameWidth,
+              uint32_t frameHeight, const Options& opts, TileEncoder encoder) {
+        device = dev;
+        target = targetTexture;
+        swapRedBlue = bgra;
+        width = frameWidth;
+        height = frameHeight;
+        options = opts;
+        encodeTile = std::move(encoder);
+        maxLevel = 0;
+        while ((std::max(width, height) - 1) >> maxLevel) {
+            ++maxLevel;
+        }
+
+        wgpu::ConstantEntry srgbConstant{.key = "srgb", .value = srgb ? 1.0 : 0.0};
+        wgpu::ComputePipelineDescriptor pipelineDesc{
+            .compute = {.module = createShaderModule(device, deepZoomShaderCode),
+                        .entryPoint = "main",
+                        .constantCount = 1,
+                        .constants = &srgbConstant}};
+        pipeline = device.CreateComputePipeline(&pipelineDesc);
+
+        levels.clear();
+        bindGroups.clear();
+        wgpu::TextureView source = targetView;
+        for (uint32_t level = maxLevel; level-- > 0;) {
+            wgpu::TextureDescriptor levelDesc;
+            levelDesc.label = "Deep zoom level";
+            levelDesc.size = {levelWidth(level), levelHeight(level), 1};
+            levelDesc.format = wgpu::TextureFormat::RGBA8Unorm;
+            levelDesc.usage = wgpu::TextureUsage::StorageBinding |
+                              wgpu::TextureUsage::TextureBinding | wgpu::TextureUsage::CopySrc;
+            levels.push_back(createTrackedTexture(device, levelDesc));
+
+            wgpu::BindGroupEntry entries[2] = {};
+            entries[0].binding = 0;
+            entries[0].textureView = source;
+            entries[1].binding = 1;
+            entries[1].textureView = levels.back().CreateView();
+            wgpu::BindGroupDescriptor bindGroupDesc{
+                .layout = pipeline.GetBindGroupLayout(0), .entryCount = 2, .entries = entries};
+            bindGroups.push_back(device.CreateBindGroup(&bindGroupDesc));
+            source = entries[1].textureView;
+        }
+
+        bands.clear();
+        for (uint32_t i = 0; i < std::max(1u, options.bandBuffers); ++i) {
+            auto band = std::make_unique<Band>();
+            wgpu::BufferDescriptor bandDesc;
+            bandDesc.label = "Deep zoom band";
+            bandDesc.usage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::MapRead;
+            bandDesc.size = uint64_t(bandBytesPerRow(maxLevel)) * options.tileSize;
+            band->buffer = createTrackedBuffer(device, bandDesc);
+            bands.push_back(std::move(band));
+        }
+        pool = std::make_unique<WorkerPool>(std::thread::hardware_concurrency());
+    }
+
+    bool enabled() const {
+        return bool(pipeline);
+    }
+
+    // True from start() until every tile of the export has been written.
+    bool busy() const {
+        return running;
+    }
+
+    uint32_t levelWidth(uint32_t level) const {
+        uint32_t shift = maxLevel - level;
+        return std::max(1u, uint32_t((uint64_t(width) + (1ull << shift) - 1) >> shift));
+    }
+
+    uint32_t levelHeight(uint32_t level) const {
+        uint32_t shift = maxLevel - level;
+        return std::max(1u, uint32_t((uint64_t(height) + (1ull << shift) - 1) >> shift));
+    }
+
+    uint32_t bandBytesPerRow(uint32_t level) const {
+        return (levelWidth(level) * 4 + 255) & ~uint32_t(255);
+    }
+
+    // XYZ starts at the largest level that fits in one tile.
+    uint32_t minLevel() const {
+        if (options.layout == DeepZoomLayout::Dzi) {
+            return 0;
+        }
+        uint32_t level = maxLevel;
+        while (level > 0 && std::max(levelWidth(level), levelHeight(level)) > options.tileSize) {
+            --level;
+        }
+        return level;
+    }
+
+    std::string tilePath(uint32_t level, uint32_t column, uint32_t row) const {
+        if (options.layout == DeepZoomLayout::Dzi) {
+            return options.basePath + "_files/" + std::to_string(level) + "/" +
+                   std::to_string(column) + "_" + std::to_string(row) + "." + options.extension;
+        }
+        return options.basePath + "/" + std::to_string(level - minLevel()) + "/" +
+               std::to_string(column) + "/" + std::to_string(row) + "." + options.extension;
+    }
+
+    // Builds the lower levels from the current contents of the target and starts reading
+    // back; call pump() after processing events until busy() is false.
+    void start() {
+        wgpu::CommandEncoder encoder = device.CreateCommandEncoder();
+        wgpu::ComputePassEncoder pass = encoder.BeginComputePass();
+        pass.SetPipeline(pipeline);
+        for (uint32_t i = 0; i < levels.size(); ++i) {
+            uint32_t level = maxLevel - 1 - i;
+            pass.SetBindGroup(0, bindGroups[i]);
+            pass.DispatchWorkgroups((levelWidth(level) + 7) / 8, (levelHeight(level) + 7) / 8);
+        }
+        pass.End();
+        wgpu::CommandBuffer commands = encoder.Finish();
+        device.GetQueue().Submit(1, &commands);
+
+        jobs.clear();
+        std::error_code error;
+        for (uint32_t level = maxLevel + 1; level-- > minLevel();) {
+            uint32_t columns = (levelWidth(level) + options.tileSize - 1) / options.tileSize;
+            uint32_t rows = (levelHeight(level) + options.tileSize - 1) / options.tileSize;
+            for (uint32_t column = 0; column < columns; ++column) {
+                std::filesystem::create_directories(
+                    std::filesystem::path(tilePath(level, column, 0)).parent_path(), error);
+            }
+            for (uint32_t row = 0; row < rows; ++row) {
+                jobs.push_back({level, row});
+            }
+        }
+        nextJob = 0;
+        running = true;
+        pump();
+    }
+
+    // Hands mapped bands to the encoders, recycles encoded ones and issues the next copies.
+    void pump() {
+        if (!running) {
+            return;
+        }
+        bool idle = true;
+        for (auto& band : bands) {
+            if (band->state == Band::State::Mapped) {
+                encodeBand(*band);
+            }
+            if (band->state == Band::State::Encoding && band->pending.load() == 0) {
+                band->buffer.Unmap();
+                band->state = Band::State::Free;
+            }
+            if (band->state == Band::State::Free && nextJob < jobs.size()) {
+                readBand(*band, jobs[nextJob].first, jobs[nextJob].second);
+                ++nextJob;
+            }
+            idle = idle && band->state == Band::State::Free;
+        }
+        if (idle && nextJob == jobs.size()) {
+            writeDescriptor();
+            running = false;
+        }
+    }
+
+  private:
+    void readBand(Band& band, uint32_t level, uint32_t row) {
+        band.level = level;
+        band.row = row;
+        band.state = Band::State::Mapping;
+
+        uint32_t y = row * options.tileSize;
+        uint32_t rows = std::min(options.tileSize, levelHeight(level) - y);
+        wgpu::ImageCopyTexture source;
+        source.texture = level == maxLevel ? target : levels[maxLevel - 1 - level];
+        source.origin = {0, y, 0};
+        wgpu::ImageCopyBuffer destination;
+        destination.buffer = band.buffer;
+        destination.layout.bytesPerRow = bandBytesPerRow(level);
+        destination.layout.rowsPerImage = rows;
+        wgpu::Extent3D extent = {levelWidth(level), rows, 1};
+        wgpu::CommandEncoder encoder = device.CreateCommandEncoder();
+        encoder.CopyTextureToBuffer(&source, &destination, &extent);
+        wgpu::CommandBuffer commands = encoder.Finish();
+        device.GetQueue().Submit(1, &commands);
+
+        band.buffer.MapAsync(
+            wgpu::MapMode::Read, 0, uint64_t(bandBytesPerRow(level)) * rows,
+            [](WGPUBufferMapAsyncStatus status, void* userdata) {
+                Band* mapped = static_cast<Band*>(userdata);
+                // a failed band is skipped; its tiles are missing from the pyramid
+                mapped->state = status == WGPUBufferMapAsyncStatus_Success
+                                    ? Band::State::Mapped
+                                    : Band::State::Free;
+            },
+            &band);
+    }
+
+    void encodeBand(Band& band) {
+        uint32_t level = band.level;
+        uint32_t y = band.row * options.tileSize;
+        uint32_t rows = std::min(options.tileSize, levelHeight(level) - y);
+        uint32_t pitch = bandBytesPerRow(level);
+        const uint8_t* pixels = static_cast<const uint8_t*>(
+            band.buffer.GetConstMappedRange(0, uint64_t(pitch) * rows));
+        uint32_t columns = (levelWidth(level) + options.tileSize - 1) / options.tileSize;
+        band.state = Band::State::Encoding;
+        if (!pixels) {
+            return;
+        }
+        // BGRA only comes from the target itself; the levels are RGBA
+        bool swap = swapRedBlue && level == maxLevel;
+        band.pending = columns;
+        for (uint32_t column = 0; column < columns; ++column) {
+            pool->submit([this, &band, pixels, pitch, y, rows, level, column, swap] {
+                uint32_t x = column * options.tileSize;
+                uint32_t w = std::min(options.tileSize, levelWidth(level) - x);
+                std::vector<uint8_t> tile(size_t(w) * rows * 4);
+                for (uint32_t r = 0; r < rows; ++r) {
+                    const uint8_t* src = pixels + size_t(r) * pitch + size_t(x) * 4;
+                    uint8_t* dst = tile.data() + size_t(r) * w * 4;
+                    for (uint32_t i = 0; i < w; ++i) {
+                        dst[4 * i + 0] = src[4 * i + (swap ? 2 : 0)];
+                        dst[4 * i + 1] = src[4 * i + 1];
+                        dst[4 * i + 2] = src[4 * i + (swap ? 0 : 2)];
+                        dst[4 * i + 3] = src[4 * i + 3];
+                    }
+                }
+                encodeTile(tilePath(level, column, y / options.tileSize).c_str(), tile.data(), w,
+                           rows);
+                band.pending.fetch_sub(1);
+            });
+        }
+    }
+
+    void writeDescriptor() const {
+        if (options.layout != DeepZoomLayout::Dzi) {
+            return;
+        }
+        FILE* file = fopen((options.basePath + ".dzi").c_str(), "wb");
+        if (!file) {
+            return;
+        }
+        fprintf(file,
+                "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\" Format=\"%s\" "
+                "Overlap=\"0\" TileSize=\"%u\">\n"
+                "  <Size Width=\"%u\" Height=\"%u\"/>\n"
+                "</Image>\n",
+                options.extension, options.tileSize, width, height);
+        fclose(file);
+    }
+};
@@ -0,0 +1,233 @@
+#pragma once
+
+#include <webgpu/webgpu_cpp.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "alloc_stats.h"
+#include "shader_module.h"
+
+// Partial readback for frames that change in small regions. A compute pass compares the render
+// target against a copy of the previously compared frame per 64x64 tile and sets one bit per
+// changed tile; only that mask (a few hundred bytes) is read back first. The changed tiles are
+// then copied out in horizontal runs and patched into a CPU-side mirror of the whole frame.
+
+constexpr uint32_t kDirtyTileSize = 64;
+
+const char dirtyTileShaderCode[] = R"(
+@group(0) @binding(0) var current: texture_2d<f32>;
+@group(0) @binding(1) var previous: texture_2d<f32>;
+@group(0) @binding(2) var<storage, read_write> mask: array<atomic<u32>>;
+
+var<workgroup> changed: atomic<u32>;
+
+// one workgroup per 64x64 tile, each invocation compares an 8x8 block
+@compute @workgroup_size(8, 8)
+fn main(@builtin(workgroup_id) tile: vec3u, @builtin(num_workgroups) tiles: vec3u,
+        @builtin(local_invocation_id) local: vec3u,
+        @builtin(local_invocation_index) index: u32) {
+    let size = textureDimensions(current);
+    let origin = tile.xy * 64u + local.xy * 8u;
+    var differs = false;
+    for (var y = 0u; y < 8u; y++) {
+        for (var x = 0u; x < 8u; x++) {
+            let p = origin + vec2u(x, y);
+            if (all(p < size) && any(textureLoad(current, p, 0) != textureLoad(previous, p, 0))) {
+                differs = true;
+            }
+        }
+    }
+    if (differs) {
+        atomicOr(&changed, 1u);
+    }
+    workgroupBarrier();
+    if (index == 0u && atomicLoad(&changed) != 0u) {
+        let t = tile.y * tiles.x + tile.x;
+        atomicOr(&mask[t / 32u], 1u << (t % 32u));
+    }
+}
+)";
+
+struct DirtyTileTracker {
+    // Consecutive dirty tiles of one tile row, read back with a single copy.
+    struct Run {
+        uint32_t tileX;
+        uint32_t tileY;
+        uint32_t count;
+        uint64_t offset;  // in tileReadback
+    };
+
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t tilesX = 0;
+    uint32_t tilesY = 0;
+    uint32_t bytesPerPixel = 4;
+    uint32_t mirrorBytesPerRow = 0;
+    // the previously compared frame; dirty tiles are relative to it
+    wgpu::Texture previous;
+    wgpu::Buffer maskBuffer;
+    wgpu::Buffer maskReadback;
+    wgpu::Buffer tileReadback;
+    wgpu::ComputePipeline pipeline;
+    wgpu::BindGroup bindGroup;
+    std::vector<Run> runs;
+    uint64_t readbackSize = 0;
+    // the whole frame, rows of mirrorBytesPerRow like a full readback
+    std::vector<uint8_t> mirror;
+    bool primed = false;
+
+    // The render target needs TextureBinding and CopySrc usage; `targetView` is bound for the
+    // compare.
+    void init(const wgpu::Device& device, const wgpu::TextureView& targetView,
+              wgpu::TextureFormat format, uint32_t frameWidth, uint32_t frameHeight,
+              uint32_t texelBytes, uint32_t rowPitch) {
+        width = frameWidth;
+        height = frameHeight;
+        tilesX = (width + kDirtyTileSize - 1) / kDirtyTileSize;
+        tilesY = (height + kDirtyTileSize - 1) / kDirtyTileSize;
+        bytesPerPixel = texelBytes;
+        mirrorBytesPerRow = rowPitch;
+        mirror.assign(size_t(mirrorBytesPerRow) * height, 0);
+        runs.clear();
+        primed = false;
+
+        wgpu::TextureDescriptor previousDesc;
+        previousDesc.label = "Previous frame";
+        previousDesc.size = {width, height, 1};
+        previousDesc.format = format;
+        previousDesc.usage = wgpu::TextureUsage::TextureBinding | wgpu::TextureUsage::CopyDst |
+                             wgpu::TextureUsage::CopySrc;
+        previous = createTrackedTexture(device, previousDesc);
+
+        wgpu::BufferDescriptor maskDesc;
+        maskDesc.label = "Dirty tile mask";
+        maskDesc.usage = wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopySrc |
+                         wgpu::BufferUsage::CopyDst;
+        maskDesc.size = maskBytes();
+        maskBuffer = createTrackedBuffer(device, maskDesc);
+        maskDesc.label = "Dirty tile mask readback";
+        maskDesc.usage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::MapRead;
+        maskReadback = createTrackedBuffer(device, maskDesc);
+
+        // room for every tile; only the used prefix is mapped
+        wgpu::BufferDescriptor tileDesc;
+        tileDesc.label = "Dirty tile readback";
+        tileDesc.usage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::MapRead;
+        tileDesc.size = uint64_t(tilesX) * tilesY * tileBytes();
+        tileReadback = createTrackedBuffer(device, tileDesc);
+
+        wgpu::ComputePipelineDescriptor pipelineDesc{
+            .compute = {.module = createShaderModule(device, dirtyTileShaderCode),
+                        .entryPoint = "main"}};
+        pipeline = device.CreateComputePipeline(&pipelineDesc);
+
+        wgpu::BindGroupEntry entries[3] = {};
+        entries[0].binding = 0;
+        entries[0].textureView = targetView;
+        entries[1].binding = 1;
+        entries[1].textureView = previous.CreateView();
+        entries[2].binding = 2;
+        entries[2].buffer = maskBuffer;
+        wgpu::BindGroupDescriptor bindGroupDesc{
+            .layout = pipeline.GetBindGroupLayout(0), .entryCount = 3, .entries = entries};
+        bindGroup = device.CreateBindGroup(&bindGroupDesc);
+    }
+
+    uint64_t maskBytes() const {
+        return (uint64_t(tilesX) * tilesY + 31) / 32 * 4;
+    }
+
+    // Row pitch of a tile in tileReadback: 64 texels of at least 4 bytes, so always a
+    // multiple of the 256 bytes CopyTextureToBuffer needs.
+    uint32_t tileBytesPerRow() const {
+        return kDirtyTileSize * bytesPerPixel;
+    }
+
+    uint64_t tileBytes() const {
+        return uint64_t(tileBytesPerRow()) * kDirtyTileSize;
+    }
+
+    // Compares `target` with the previous frame, makes it the new previous frame and copies
+    // the mask to maskReadback.
+    void encodeDetect(const wgpu::CommandEncoder& encoder, const wgpu::Texture& target) const {
+        encoder.ClearBuffer(maskBuffer, 0, maskBytes());
+        wgpu::ComputePassEncoder pass = encoder.BeginComputePass();
+        pass.SetPipeline(pipeline);
+        pass.SetBindGroup(0, bindGroup);
+        pass.DispatchWorkgroups(tilesX, tilesY);
+        pass.End();
+
+        wgpu::ImageCopyTexture source;
+        source.texture = target;
+        wgpu::ImageCopyTexture destination;
+        destination.texture = previous;
+        wgpu::Extent3D extent = {width, height, 1};
+        encoder.CopyTextureToTexture(&source, &destination, &extent);
+        encoder.CopyBufferToBuffer(maskBuffer, 0, maskReadback, 0, maskBytes());
+    }
+
+    // Turns the mapped mask into runs; returns the number of bytes to read back. The first
+    // frame is all dirty since the mirror starts out empty.
+    uint64_t collect(const uint32_t* mask) {
+        runs.clear();
+        readbackSize = 0;
+        for (uint32_t ty = 0; ty < tilesY; ++ty) {
+            for (uint32_t tx = 0; tx < tilesX; ++tx) {
+                uint32_t t = ty * tilesX + tx;
+                if (primed && !(mask[t / 32] & (1u << (t % 32)))) {
+                    continue;
+                }
+                if (!runs.empty() && runs.back().tileY == ty &&
+                    runs.back().tileX + runs.back().count == tx) {
+                    ++runs.back().count;
+                } else {
+                    runs.push_back({tx, ty, 1, readbackSize});
+                }
+                readbackSize += tileBytes();
+            }
+        }
+        primed = true;
+        return readbackSize;
+    }
+
+    // Copies the dirty runs of `frame` (the target, or `previous` once it holds the compared
+    // frame) into tileReadback.
+    void encodeTileCopies(const wgpu::CommandEncoder& encoder, const wgpu::Texture& frame) const {
+        for (const Run& run : runs) {
+            wgpu::ImageCopyTexture source;
+            source.texture = frame;
+            source.origin = {run.tileX * kDirtyTileSize, run.tileY * kDirtyTileSize, 0};
+
+            wgpu::ImageCopyBuffer destination;
+            destination.buffer = tileReadback;
+            destination.layout.offset = run.offset;
+            destination.layout.bytesPerRow = tileBytesPerRow() * run.count;
+            destination.layout.rowsPerImage = kDirtyTileSize;
+            wgpu::Extent3D extent = {
+                std::min(run.count * kDirtyTileSize, width - source.origin.x),
+                std::min(kDirtyTileSize, height - source.origin.y), 1};
+            encoder.CopyTextureToBuffer(&source, &destination, &extent);
+        }
+    }
+
+    // Copies the mapped runs (readbackSize bytes of tileReadback) into the mirror.
+    void patchMirror(const uint8_t* tiles) {
+        for (const Run& run : runs) {
+            uint32_t x = run.tileX * kDirtyTileSize;
+            uint32_t y = run.tileY * kDirtyTileSize;
+            size_t rowBytes = size_t(std::min(run.count * kDirtyTileSize, width - x)) *
+                              bytesPerPixel;
+            uint32_t rows = std::min(kDirtyTileSize, height - y);
+            size_t srcPitch = size_t(tileBytesPerRow()) * run.count;
+            uint8_t* dst =
+                mirror.data() + size_t(y) * mirrorBytesPerRow + size_t(x) * bytesPerPixel;
+            for (uint32_t r = 0; r < rows; ++r) {
+                memcpy(dst + size_t(r) * mirrorBytesPerRow, tiles + run.offset + r * srcPitch,
+                       rowBytes);
+            }
+        }
+    }
+};
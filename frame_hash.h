@@ -0,0 +1,124 @@
+#pragma once
+
+#include <webgpu/webgpu_cpp.h>
+
+#include <array>
+#include <cstdint>
+
+#include "alloc_stats.h"
+#include "shader_module.h"
+
+// 256-bit frame fingerprint computed on the GPU, so deciding whether a frame repeats the last
+// one only reads back 32 bytes. Every texel is hashed together with its position; four lanes
+// are summed and four xor-ed over the whole frame, which makes the reduction order-independent
+// and lets each workgroup fold its 32x32 texels with workgroup atomics before touching the
+// eight global words.
+
+using FrameFingerprint = std::array<uint32_t, 8>;
+
+const char frameHashShaderCode[] = R"(
+@group(0) @binding(0) var frame: texture_2d<f32>;
+@group(0) @binding(1) var<storage, read_write> lanes: array<atomic<u32>, 8>;
+
+var<workgroup> partial: array<atomic<u32>, 8>;
+
+// lowbias32 integer hash
+fn hash32(v: u32) -> u32 {
+    var x = v;
+    x ^= x >> 16u;
+    x *= 0x7feb352du;
+    x ^= x >> 15u;
+    x *= 0x846ca68bu;
+    x ^= x >> 16u;
+    return x;
+}
+
+// each invocation folds a 4x4 block
+@compute @workgroup_size(8, 8)
+fn main(@builtin(global_invocation_id) id: vec3u,
+        @builtin(local_invocation_index) index: u32) {
+    let size = textureDimensions(frame);
+    var sums = vec4u(0u);
+    var xors = vec4u(0u);
+    for (var y = 0u; y < 4u; y++) {
+        for (var x = 0u; x < 4u; x++) {
+            let p = id.xy * 4u + vec2u(x, y);
+            if (all(p < size)) {
+                let c = bitcast<vec4u>(textureLoad(frame, p, 0));
+                let texel = hash32(c.r ^ hash32(c.g ^ hash32(c.b ^ hash32(c.a))));
+                let h0 = hash32((p.y * size.x + p.x) ^ texel);
+                let h = vec4u(h0, hash32(h0 ^ 0x9e3779b9u), hash32(h0 ^ 0x85ebca6bu),
+                              hash32(h0 ^ 0xc2b2ae35u));
+                sums += h;
+                xors ^= vec4u(hash32(h.x + 1u), hash32(h.y + 1u), hash32(h.z + 1u),
+                              hash32(h.w + 1u));
+            }
+        }
+    }
+    for (var k = 0u; k < 4u; k++) {
+        atomicAdd(&partial[k], sums[k]);
+        atomicXor(&partial[k + 4u], xors[k]);
+    }
+    workgroupBarrier();
+    if (index < 4u) {
+        atomicAdd(&lanes[index], atomicLoad(&partial[index]));
+    } else if (index < 8u) {
+        atomicXor(&lanes[index], atomicLoad(&partial[index]));
+    }
+}
+)";
+
+struct FrameHasher {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    wgpu::Buffer lanes;
+    wgpu::Buffer readback;  // sizeof(FrameFingerprint) bytes, MapRead
+    wgpu::ComputePipeline pipeline;
+    wgpu::BindGroup bindGroup;
+
+    // `view` is a view of a texture with TextureBinding usage.
+    void init(const wgpu::Device& device, const wgpu::TextureView& view, uint32_t frameWidth,
+              uint32_t frameHeight) {
+        width = frameWidth;
+        height = frameHeight;
+
+        wgpu::BufferDescriptor lanesDesc;
+        lanesDesc.label = "Frame hash";
+        lanesDesc.usage = wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopySrc |
+                          wgpu::BufferUsage::CopyDst;
+        lanesDesc.size = sizeof(FrameFingerprint);
+        lanes = createTrackedBuffer(device, lanesDesc);
+        lanesDesc.label = "Frame hash readback";
+        lanesDesc.usage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::MapRead;
+        readback = createTrackedBuffer(device, lanesDesc);
+
+        wgpu::ComputePipelineDescriptor pipelineDesc{
+            .compute = {.module = createShaderModule(device, frameHashShaderCode),
+                        .entryPoint = "main"}};
+        pipeline = device.CreateComputePipeline(&pipelineDesc);
+
+        wgpu::BindGroupEntry entries[2] = {};
+        entries[0].binding = 0;
+        entries[0].textureView = view;
+        entries[1].binding = 1;
+        entries[1].buffer = lanes;
+        wgpu::BindGroupDescriptor bindGroupDesc{
+            .layout = pipeline.GetBindGroupLayout(0), .entryCount = 2, .entries = entries};
+        bindGroup = device.CreateBindGroup(&bindGroupDesc);
+    }
+
+    bool enabled() const {
+        return bool(pipeline);
+    }
+
+    // Hashes the frame into `lanes` and copies the result to `readback`.
+    void encode(const wgpu::CommandEncoder& encoder) const {
+        encoder.ClearBuffer(lanes, 0, sizeof(FrameFingerprint));
+        wgpu::ComputePassEncoder pass = encoder.BeginComputePass();
+        pass.SetPipeline(pipeline);
+        pass.SetBindGroup(0, bindGroup);
+        pass.DispatchWorkgroups((width + 31) / 32, (height + 31) / 32);
+        pass.End();
+        encoder.CopyBufferToBuffer(lanes, 0, readback, 0, sizeof(FrameFingerprint));
+    }
+};
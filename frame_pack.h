@@ -0,0 +1,442 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "frame_sink.h"
+
+#ifndef _WIN32
+#define FRAME_PACK_POSIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#endif
+
+// Append-only frame archive: every encoded frame is appended to one data file (`path`) and
+// described by a fixed-size entry in a separate index file (`path` + ".idx"). The index is a
+// PackIndexHeader followed by PackIndexEntry records, so readers can mmap it and binary search
+// by frame number. Index entries are only written after the data they point to has been
+// written (and, with group commit, synced), so a crash loses at most the uncommitted tail.
+// A frame identical to its predecessor is stored as a repeat: an entry pointing at the same
+// bytes, flagged kPackEntryRepeat.
+
+enum class PackFormat : uint32_t { Raw, Png, Bmp, Tga, Jpg, Hdr, Ktx2 };
+
+struct PackIndexHeader {
+    char magic[8];  // "FRMPACK1"
+    uint32_t entrySize;
+    uint32_t reserved;
+};
+
+struct PackIndexEntry {
+    uint64_t frame;
+    uint64_t offset;
+    uint32_t size;
+    PackFormat format;
+    uint32_t checksum;  // CRC-32 of the frame bytes
+    uint32_t flags;
+};
+static_assert(sizeof(PackIndexEntry) == 32, "index entries are a fixed 32 bytes on disk");
+
+constexpr uint32_t kPackEntryRepeat = 1;  // same data as the previous entry
+
+constexpr char kPackMagic[8] = {'F', 'R', 'M', 'P', 'A', 'C', 'K', '1'};
+
+inline uint32_t packCrc32(uint32_t crc, const void* data, size_t size) {
+    static const std::vector<uint32_t> table = [] {
+        std::vector<uint32_t> t(256);
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            t[i] = c;
+        }
+        return t;
+    }();
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i) {
+        crc = table[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+// Guesses the frame format from the output name the renderer passes to FrameSink::begin().
+inline PackFormat packFormatFromName(const char* name) {
+    const char* dot = strrchr(name, '.');
+    if (!dot) {
+        return PackFormat::Raw;
+    }
+    std::string ext(dot + 1);
+    if (ext == "png") return PackFormat::Png;
+    if (ext == "bmp") return PackFormat::Bmp;
+    if (ext == "tga") return PackFormat::Tga;
+    if (ext == "jpg" || ext == "jpeg") return PackFormat::Jpg;
+    if (ext == "hdr") return PackFormat::Hdr;
+    if (ext == "ktx2") return PackFormat::Ktx2;
+    return PackFormat::Raw;
+}
+
+#ifdef FRAME_PACK_POSIX
+inline bool pwriteAll(int fd, const void* data, size_t size, uint64_t offset) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    while (size > 0) {
+        ssize_t n = pwrite(fd, bytes, size, off_t(offset));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        bytes += n;
+        size -= size_t(n);
+        offset += uint64_t(n);
+    }
+    return true;
+}
+
+// FrameSink that appends each begin()/end() output as one frame of a pack. Frame numbers are
+// assigned in order, continuing after the last frame if the pack already exists; a torn tail
+// from a previous crash is cut off when reopening.
+//
+// commitEvery controls durability: every N frames the data file is fdatasync'ed, then the
+// pending index entries are written and the index is fdatasync'ed (group commit). With 0,
+// nothing is synced explicitly and index entries are written whenever the data buffer is.
+struct FramePackSink : FrameSink {
+    explicit FramePackSink(const std::string& path, uint32_t commitEvery = 0,
+                           size_t bufferSize = 1 << 20)
+        : commitEvery(commitEvery), bufferSize(bufferSize) {
+        dataFd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        indexFd = open((path + ".idx").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (dataFd < 0 || indexFd < 0) {
+            closeFiles();
+            return;
+        }
+        struct stat st;
+        fstat(indexFd, &st);
+        uint64_t entries = 0;
+        if (uint64_t(st.st_size) < sizeof(PackIndexHeader)) {
+            PackIndexHeader header{};
+            memcpy(header.magic, kPackMagic, sizeof(kPackMagic));
+            header.entrySize = sizeof(PackIndexEntry);
+            if (ftruncate(indexFd, 0) != 0 || !pwriteAll(indexFd, &header, sizeof(header), 0)) {
+                closeFiles();
+                return;
+            }
+        } else {
+            PackIndexHeader header;
+            PackIndexEntry last;
+            entries = (uint64_t(st.st_size) - sizeof(header)) / sizeof(PackIndexEntry);
+            if (pread(indexFd, &header, sizeof(header), 0) != sizeof(header) ||
+                memcmp(header.magic, kPackMagic, sizeof(kPackMagic)) != 0) {
+                closeFiles();
+                return;
+            }
+            // Without group commit, entries may have reached the disk before their data: walk
+            // back to the last entry whose bytes are all there and match its checksum.
+            struct stat dataStat;
+            fstat(dataFd, &dataStat);
+            for (; entries > 0; --entries) {
+                off_t lastOffset = off_t(sizeof(header) + (entries - 1) * sizeof(last));
+                if (pread(indexFd, &last, sizeof(last), lastOffset) != sizeof(last)) {
+                    closeFiles();
+                    return;
+                }
+                if (last.offset + last.size <= uint64_t(dataStat.st_size) && intact(last)) {
+                    break;
+                }
+            }
+            if (entries > 0) {
+                dataOffset = last.offset + last.size;
+                nextFrame = last.frame + 1;
+                lastEntry = last;
+                haveLast = true;
+            }
+        }
+        // Drop partial index records and unindexed data left by an interrupted writer.
+        indexOffset = sizeof(PackIndexHeader) + entries * sizeof(PackIndexEntry);
+        if (ftruncate(indexFd, off_t(indexOffset)) != 0 ||
+            ftruncate(dataFd, off_t(dataOffset)) != 0) {
+            closeFiles();
+            return;
+        }
+        buffer.reserve(bufferSize);
+    }
+
+    ~FramePackSink() override {
+        if (valid()) {
+            commit(commitEvery != 0);
+        }
+        closeFiles();
+    }
+
+    bool valid() const {
+        return dataFd >= 0 && indexFd >= 0;
+    }
+
+    bool failed() const {
+        return writeFailed;
+    }
+
+    // Sets the number recorded for the next frame; numbers must keep increasing.
+    void setNextFrame(uint64_t frame) {
+        nextFrame = frame;
+    }
+
+    bool begin(const char* name) override {
+        if (!valid()) {
+            return false;
+        }
+        current = PackIndexEntry{};
+        current.frame = nextFrame;
+        current.offset = dataOffset + buffer.size();
+        current.format = packFormatFromName(name);
+        inFrame = true;
+        return true;
+    }
+
+    void write(const void* data, size_t size) override {
+        if (!inFrame) {
+            return;
+        }
+        current.checksum = packCrc32(current.checksum, data, size);
+        current.size += uint32_t(size);
+        if (buffer.size() + size > bufferSize) {
+            flushData();
+            if (commitEvery == 0) {
+                writePendingIndex();
+            }
+        }
+        if (size >= bufferSize) {
+            writeFailed |= !pwriteAll(dataFd, data, size, dataOffset);
+            dataOffset += size;
+        } else {
+            const uint8_t* bytes = static_cast<const uint8_t*>(data);
+            buffer.insert(buffer.end(), bytes, bytes + size);
+        }
+    }
+
+    bool end() override {
+        if (!inFrame) {
+            return false;
+        }
+        inFrame = false;
+        pending.push_back(current);
+        lastEntry = current;
+        haveLast = true;
+        nextFrame = current.frame + 1;
+        if (commitEvery != 0 && pending.size() >= commitEvery) {
+            commit(true);
+        }
+        return !writeFailed;
+    }
+
+    bool outputsAreFrames() const override {
+        return true;
+    }
+
+    // Index-only entry that reuses the previous frame's bytes; no data is written.
+    bool repeatLast() override {
+        if (!valid() || inFrame || !haveLast) {
+            return false;
+        }
+        PackIndexEntry repeat = lastEntry;
+        repeat.frame = nextFrame;
+        repeat.flags |= kPackEntryRepeat;
+        pending.push_back(repeat);
+        nextFrame = repeat.frame + 1;
+        if (commitEvery != 0 && pending.size() >= commitEvery) {
+            commit(true);
+        }
+        return !writeFailed;
+    }
+
+    // Makes every finished frame visible in the index; with `sync`, durable as well.
+    void commit(bool sync) {
+        flushData();
+        if (pending.empty()) {
+            return;
+        }
+        if (sync && fdatasync(dataFd) != 0) {
+            writeFailed = true;
+        }
+        writePendingIndex();
+        if (sync && fdatasync(indexFd) != 0) {
+            writeFailed = true;
+        }
+    }
+
+  private:
+    void flushData() {
+        if (!buffer.empty()) {
+            writeFailed |= !pwriteAll(dataFd, buffer.data(), buffer.size(), dataOffset);
+            dataOffset += buffer.size();
+            buffer.clear();
+        }
+    }
+
+    // Only call once the data of every pending frame has been written.
+    void writePendingIndex() {
+        size_t bytes = pending.size() * sizeof(PackIndexEntry);
+        writeFailed |= !pwriteAll(indexFd, pending.data(), bytes, indexOffset);
+        indexOffset += bytes;
+        pending.clear();
+    }
+
+    // Whether the data file holds the frame `entry` points at, by its checksum.
+    bool intact(const PackIndexEntry& entry) const {
+        std::vector<uint8_t> bytes(entry.size);
+        size_t done = 0;
+        while (done < bytes.size()) {
+            ssize_t n = pread(dataFd, bytes.data() + done, bytes.size() - done,
+                              off_t(entry.offset + done));
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            done += size_t(n);
+        }
+        return packCrc32(0, bytes.data(), bytes.size()) == entry.checksum;
+    }
+
+    void closeFiles() {
+        if (dataFd >= 0) {
+            close(dataFd);
+        }
+        if (indexFd >= 0) {
+            close(indexFd);
+        }
+        dataFd = indexFd = -1;
+    }
+
+    uint32_t commitEvery;
+    size_t bufferSize;
+    int dataFd = -1;
+    int indexFd = -1;
+    uint64_t dataOffset = 0;
+    uint64_t indexOffset = 0;
+    uint64_t nextFrame = 0;
+    bool inFrame = false;
+    bool writeFailed = false;
+    bool haveLast = false;
+    PackIndexEntry current{};
+    PackIndexEntry lastEntry{};
+    std::vector<uint8_t> buffer;
+    std::vector<PackIndexEntry> pending;
+};
+
+// Read-only view of a pack: both files are mmapped, frames are looked up by index or by frame
+// number and returned as pointers into the mapping.
+struct FramePackReader {
+    explicit FramePackReader(const std::string& path) {
+        if (!map(path + ".idx", indexMap, indexSize) || indexSize < sizeof(PackIndexHeader) ||
+            memcmp(indexMap, kPackMagic, sizeof(kPackMagic)) != 0) {
+            unmap();
+            return;
+        }
+        count = (indexSize - sizeof(PackIndexHeader)) / sizeof(PackIndexEntry);
+        if (count > 0 && !map(path, dataMap, dataSize)) {
+            unmap();
+            return;
+        }
+    }
+
+    ~FramePackReader() {
+        unmap();
+    }
+
+    FramePackReader(const FramePackReader&) = delete;
+    FramePackReader& operator=(const FramePackReader&) = delete;
+
+    bool valid() const {
+        return indexMap != nullptr;
+    }
+
+    size_t frameCount() const {
+        return count;
+    }
+
+    const PackIndexEntry& entry(size_t i) const {
+        return entries()[i];
+    }
+
+    // Frame bytes, or nullptr if the entry points past the end of the data file.
+    const uint8_t* data(size_t i) const {
+        const PackIndexEntry& e = entry(i);
+        if (e.offset + e.size > dataSize) {
+            return nullptr;
+        }
+        return static_cast<const uint8_t*>(dataMap) + e.offset;
+    }
+
+    bool isRepeat(size_t i) const {
+        return (entry(i).flags & kPackEntryRepeat) != 0;
+    }
+
+    bool verify(size_t i) const {
+        const uint8_t* bytes = data(i);
+        return bytes && packCrc32(0, bytes, entry(i).size) == entry(i).checksum;
+    }
+
+    // Index of the entry for `frame`, or frameCount() if it isn't in the pack.
+    size_t find(uint64_t frame) const {
+        const PackIndexEntry* first = entries();
+        const PackIndexEntry* last = first + count;
+        const PackIndexEntry* it = std::lower_bound(
+            first, last, frame, [](const PackIndexEntry& e, uint64_t f) { return e.frame < f; });
+        return (it != last && it->frame == frame) ? size_t(it - first) : count;
+    }
+
+  private:
+    const PackIndexEntry* entries() const {
+        return reinterpret_cast<const PackIndexEntry*>(static_cast<const uint8_t*>(indexMap) +
+                                                       sizeof(PackIndexHeader));
+    }
+
+    static bool map(const std::string& path, void*& mapping, size_t& size) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        bool ok = fstat(fd, &st) == 0 && st.st_size > 0;
+        if (ok) {
+            size = size_t(st.st_size);
+            mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            ok = mapping != MAP_FAILED;
+            if (!ok) {
+                mapping = nullptr;
+            }
+        }
+        close(fd);
+        return ok;
+    }
+
+    void unmap() {
+        if (indexMap) {
+            munmap(indexMap, indexSize);
+        }
+        if (dataMap) {
+            munmap(dataMap, dataSize);
+        }
+        indexMap = dataMap = nullptr;
+        indexSize = dataSize = 0;
+        count = 0;
+    }
+
+    void* indexMap = nullptr;
+    void* dataMap = nullptr;
+    size_t indexSize = 0;
+    size_t dataSize = 0;
+    size_t count = 0;
+};
+#endif  // FRAME_PACK_POSIX
@@ -0,0 +1,274 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <string>
+
+#ifdef __linux__
+#define FRAME_RING_SHM
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <climits>
+
+// Shared-memory ring of raw frames for consumers on the same machine. The producer (the
+// renderer) owns a POSIX shm object laid out as a FrameRingHeader followed by slotCount slots,
+// each a FrameSlotHeader plus room for one frame. Frame n lives in slot n % slotCount.
+//
+// Every slot is a seqlock: its sequence is 2n+1 while frame n is being written and 2n+2 once
+// it is published, so consumers read frames in place (no copy) and check afterwards that the
+// slot was not overwritten under them. The producer never waits; by default it overwrites the
+// oldest slot, or with dropWhenFull it skips frames while the consumer that publishes readIndex
+// is a full ring behind. Consumers sleep on a futex that the producer only wakes when someone
+// is actually waiting.
+
+constexpr uint32_t kFrameRingMagic = 0x474e5246;  // "FRNG"
+constexpr uint32_t kFrameRingVersion = 1;
+
+struct FrameRingHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slotCount;
+    uint32_t slotStride;
+    uint64_t slotCapacity;
+    alignas(64) std::atomic<uint64_t> writeIndex;  // frames published so far
+    std::atomic<uint32_t> publishFutex;            // low 32 bits of writeIndex, futex word
+    std::atomic<uint32_t> waiters;
+    alignas(64) std::atomic<uint64_t> readIndex;  // frames released by the consumer
+    std::atomic<uint64_t> dropped;
+};
+
+struct FrameSlotHeader {
+    std::atomic<uint64_t> sequence;
+    uint64_t frame;
+    uint64_t timestampNs;  // CLOCK_MONOTONIC at publish
+    uint32_t size;
+    uint32_t format;  // wgpu::TextureFormat of the pixels
+    uint32_t width;
+    uint32_t height;
+    uint32_t bytesPerRow;
+    uint32_t layout;  // ReadbackLayout of the payload; 0 is texels of `format`
+};
+
+inline uint64_t frameRingNowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000ull + uint64_t(ts.tv_nsec);
+}
+
+inline FrameSlotHeader* frameRingSlot(FrameRingHeader* header, uint64_t frame) {
+    uint8_t* base = reinterpret_cast<uint8_t*>(header) + sizeof(FrameRingHeader);
+    return reinterpret_cast<FrameSlotHeader*>(base +
+                                              (frame % header->slotCount) * header->slotStride);
+}
+
+struct FrameRingProducer {
+    // Creates (or replaces) the shm object `name`, e.g. "/webgpu-frames".
+    FrameRingProducer(const std::string& name, uint32_t slotCount, uint64_t slotCapacity,
+                      bool dropWhenFull = false)
+        : name(name), dropWhenFull(dropWhenFull) {
+        uint32_t stride = uint32_t((sizeof(FrameSlotHeader) + slotCapacity + 63) & ~uint64_t(63));
+        size = sizeof(FrameRingHeader) + uint64_t(stride) * slotCount;
+        int fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+        if (fd < 0) {
+            return;
+        }
+        void* mapping = MAP_FAILED;
+        if (ftruncate(fd, off_t(size)) == 0) {
+            mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (mapping == MAP_FAILED) {
+            shm_unlink(name.c_str());
+            return;
+        }
+        header = new (mapping) FrameRingHeader();
+        header->version = kFrameRingVersion;
+        header->slotCount = slotCount;
+        header->slotStride = stride;
+        header->slotCapacity = slotCapacity;
+        for (uint32_t i = 0; i < slotCount; ++i) {
+            new (frameRingSlot(header, i)) FrameSlotHeader();
+        }
+        std::atomic_ref<uint32_t>(header->magic).store(kFrameRingMagic, std::memory_order_release);
+    }
+
+    ~FrameRingProducer() {
+        if (header) {
+            munmap(header, size);
+            shm_unlink(name.c_str());
+        }
+    }
+
+    FrameRingProducer(const FrameRingProducer&) = delete;
+    FrameRingProducer& operator=(const FrameRingProducer&) = delete;
+
+    bool valid() const {
+        return header != nullptr;
+    }
+
+    uint64_t capacity() const {
+        return header->slotCapacity;
+    }
+
+    // Payload of the slot for the next frame, to be filled and then publish()ed. nullptr when
+    // dropWhenFull is set and the consumer is a whole ring behind; the frame is counted as
+    // dropped.
+    uint8_t* acquire() {
+        uint64_t n = header->writeIndex.load(std::memory_order_relaxed);
+        if (dropWhenFull &&
+            n - header->readIndex.load(std::memory_order_acquire) >= header->slotCount) {
+            header->dropped.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        slot = frameRingSlot(header, n);
+        slot->sequence.store(2 * n + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        return reinterpret_cast<uint8_t*>(slot + 1);
+    }
+
+    void publish(uint32_t frameSize, uint32_t format, uint32_t width, uint32_t height,
+                 uint32_t bytesPerRow, uint32_t layout = 0) {
+        uint64_t n = header->writeIndex.load(std::memory_order_relaxed);
+        slot->frame = n;
+        slot->timestampNs = frameRingNowNs();
+        slot->size = frameSize;
+        slot->format = format;
+        slot->width = width;
+        slot->height = height;
+        slot->bytesPerRow = bytesPerRow;
+        slot->layout = layout;
+        slot->sequence.store(2 * n + 2, std::memory_order_release);
+        header->writeIndex.store(n + 1, std::memory_order_release);
+        header->publishFutex.store(uint32_t(n + 1), std::memory_order_seq_cst);
+        if (header->waiters.load(std::memory_order_seq_cst) > 0) {
+            syscall(SYS_futex, &header->publishFutex, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+        }
+    }
+
+  private:
+    std::string name;
+    bool dropWhenFull;
+    uint64_t size = 0;
+    FrameRingHeader* header = nullptr;
+    FrameSlotHeader* slot = nullptr;
+};
+
+struct FrameRingConsumer {
+    struct Frame {
+        const FrameSlotHeader* slot;
+        const uint8_t* data;
+        uint64_t sequence;
+    };
+
+    explicit FrameRingConsumer(const std::string& name) {
+        int fd = shm_open(name.c_str(), O_RDWR, 0);
+        if (fd < 0) {
+            return;
+        }
+        struct stat st;
+        void* mapping = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && uint64_t(st.st_size) >= sizeof(FrameRingHeader)) {
+            size = uint64_t(st.st_size);
+            mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (mapping == MAP_FAILED) {
+            return;
+        }
+        header = static_cast<FrameRingHeader*>(mapping);
+        if (std::atomic_ref<uint32_t>(header->magic).load(std::memory_order_acquire) !=
+                kFrameRingMagic ||
+            header->version != kFrameRingVersion) {
+            munmap(mapping, size);
+            header = nullptr;
+            return;
+        }
+        next = header->writeIndex.load(std::memory_order_acquire);
+    }
+
+    ~FrameRingConsumer() {
+        if (header) {
+            munmap(header, size);
+        }
+    }
+
+    FrameRingConsumer(const FrameRingConsumer&) = delete;
+    FrameRingConsumer& operator=(const FrameRingConsumer&) = delete;
+
+    bool valid() const {
+        return header != nullptr;
+    }
+
+    // Frames that were overwritten before this consumer got to them.
+    uint64_t skipped() const {
+        return skippedFrames;
+    }
+
+    // Waits up to timeoutMs for the next frame. If the producer lapped us, skips ahead to the
+    // newest frame. The frame is read in place; check stillValid() once done with it.
+    bool acquire(Frame& frame, int timeoutMs) {
+        uint64_t deadline = frameRingNowNs() + uint64_t(timeoutMs) * 1000000ull;
+        for (;;) {
+            uint64_t written = header->writeIndex.load(std::memory_order_acquire);
+            if (written > next) {
+                if (written - next > header->slotCount) {
+                    skippedFrames += written - 1 - next;
+                    next = written - 1;
+                }
+                const FrameSlotHeader* slot = frameRingSlot(header, next);
+                uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+                if (sequence == 2 * next + 2) {
+                    frame = {slot, reinterpret_cast<const uint8_t*>(slot + 1), sequence};
+                    return true;
+                }
+                // the producer is already reusing this slot, so the frame is gone
+                ++skippedFrames;
+                ++next;
+                continue;
+            }
+            uint32_t seen = header->publishFutex.load(std::memory_order_acquire);
+            if (header->writeIndex.load(std::memory_order_acquire) > next) {
+                continue;
+            }
+            uint64_t now = frameRingNowNs();
+            if (now >= deadline) {
+                return false;
+            }
+            timespec timeout = {time_t((deadline - now) / 1000000000ull),
+                                long((deadline - now) % 1000000000ull)};
+            header->waiters.fetch_add(1, std::memory_order_seq_cst);
+            syscall(SYS_futex, &header->publishFutex, FUTEX_WAIT, seen, &timeout, nullptr, 0);
+            header->waiters.fetch_sub(1, std::memory_order_seq_cst);
+        }
+    }
+
+    // False if the producer started overwriting the frame while it was being read.
+    bool stillValid(const Frame& frame) const {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return frame.slot->sequence.load(std::memory_order_relaxed) == frame.sequence;
+    }
+
+    // Moves past the current frame. With `backpressure`, also tells a dropWhenFull producer
+    // that the slot may be reused.
+    void release(bool backpressure = false) {
+        ++next;
+        if (backpressure) {
+            header->readIndex.store(next, std::memory_order_release);
+        }
+    }
+
+  private:
+    FrameRingHeader* header = nullptr;
+    uint64_t size = 0;
+    uint64_t next = 0;
+    uint64_t skippedFrames = 0;
+};
+#endif  // __linux__
@@ -0,0 +1,528 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define FRAME_SINK_IO_URING
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cerrno>
+#endif
+
+// Destination for encoded frames. One output (e.g. one file) is bracketed by begin()/end() with
+// any number of write() calls in between. Pass FrameSink::stbiWrite and the sink to the
+// stbi_write_*_to_func encoders to have them write straight into it.
+struct FrameSink {
+    virtual ~FrameSink() = default;
+    virtual bool begin(const char* name) = 0;
+    virtual void write(const void* data, size_t size) = 0;
+    virtual bool end() = 0;
+
+    // Records that the next frame is identical to the last one, instead of a begin()/end()
+    // with the same bytes. Sinks that only keep the latest output (files rewritten in place)
+    // already hold that frame and ignore it.
+    virtual bool repeatLast() {
+        return true;
+    }
+
+    // True for sinks that record every output as the next frame (packs); frames must then be
+    // delivered as a single output.
+    virtual bool outputsAreFrames() const {
+        return false;
+    }
+
+    static void stbiWrite(void* context, void* data, int size) {
+        static_cast<FrameSink*>(context)->write(data, size_t(size));
+    }
+};
+
+// Synchronous fopen/fwrite/fclose, the behaviour of stbi_write_png and friends.
+struct StdioFileSink : FrameSink {
+    FILE* file = nullptr;
+    bool ok = false;
+
+    ~StdioFileSink() override {
+        if (file) {
+            fclose(file);
+        }
+    }
+
+    bool begin(const char* name) override {
+        file = fopen(name, "wb");
+        ok = file != nullptr;
+        return ok;
+    }
+
+    void write(const void* data, size_t size) override {
+        if (file && fwrite(data, 1, size, file) != size) {
+            ok = false;
+        }
+    }
+
+    bool end() override {
+        if (!file) {
+            return false;
+        }
+        bool closed = fclose(file) == 0;
+        file = nullptr;
+        return ok && closed;
+    }
+};
+
+#ifdef FRAME_SINK_IO_URING
+// Writes files through io_uring so the encoding thread never blocks on the page cache or the
+// disk. Data is gathered into a small pool of (registered, when the kernel allows it) buffers;
+// each full buffer is queued as one write at its file offset and the buffer returns to the pool
+// when the kernel completes it; short writes are resubmitted for the rest. write() only waits
+// when every buffer is in flight. end() queues the tail and returns; the file is closed once its
+// last write completes. Opening the file is still a synchronous open(2); an existing file is
+// unlinked and a new one created, so rewriting one file every frame never mixes frames: writes
+// still queued for the previous frame land in the old, unlinked inode.
+//
+// With `direct` the file is opened O_DIRECT: buffers and offsets are kDirectAlignment aligned,
+// the tail is zero-padded to the alignment and the file truncated back to its real size.
+struct IoUringFileSink : FrameSink {
+    struct Options {
+        uint32_t bufferCount = 8;
+        size_t bufferSize = 1 << 20;
+        bool direct = false;
+    };
+    static constexpr size_t kDirectAlignment = 4096;
+
+    IoUringFileSink() : IoUringFileSink(Options()) {
+    }
+
+    explicit IoUringFileSink(Options opts) : options(opts) {
+        options.bufferSize = (options.bufferSize + kDirectAlignment - 1) & ~(kDirectAlignment - 1);
+        if (options.bufferCount == 0) {
+            options.bufferCount = 1;
+        }
+
+        io_uring_params params{};
+        ringFd = int(syscall(__NR_io_uring_setup, options.bufferCount, &params));
+        if (ringFd < 0) {
+            return;
+        }
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (singleMmap) {
+            sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+        }
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ringFd, IORING_OFF_SQ_RING);
+        cqRing = singleMmap ? sqRing
+                            : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        void* sqesMap = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             ringFd, IORING_OFF_SQES);
+        if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqesMap == MAP_FAILED) {
+            if (sqesMap != MAP_FAILED) {
+                munmap(sqesMap, sqesSize);
+            }
+            destroyRing();
+            return;
+        }
+        uint8_t* sq = static_cast<uint8_t*>(sqRing);
+        uint8_t* cq = static_cast<uint8_t*>(cqRing);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        sqes = static_cast<io_uring_sqe*>(sqesMap);
+
+        std::vector<iovec> iovecs;
+        for (uint32_t i = 0; i < options.bufferCount; ++i) {
+            void* buffer = aligned_alloc(kDirectAlignment, options.bufferSize);
+            if (!buffer) {
+                destroyRing();
+                return;
+            }
+            buffers.push_back(static_cast<uint8_t*>(buffer));
+            freeBuffers.push_back(i);
+            iovecs.push_back({buffer, options.bufferSize});
+        }
+        writes.resize(options.bufferCount);
+        // Registration pins the pages and can fail against RLIMIT_MEMLOCK on older kernels, in
+        // which case plain IORING_OP_WRITE is used with the same buffers.
+        registered = syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_BUFFERS,
+                             iovecs.data(), options.bufferCount) == 0;
+    }
+
+    ~IoUringFileSink() override {
+        if (currentFile != kNoFile) {
+            end();
+        }
+        drain();
+        // only left open when waiting for their writes failed
+        for (const auto& [id, file] : files) {
+            close(file.fd);
+        }
+        destroyRing();
+    }
+
+    // False if io_uring is unavailable (old kernel, seccomp); use StdioFileSink instead.
+    bool valid() const {
+        return ringFd >= 0;
+    }
+
+    // True if any write or close failed since the sink was created.
+    bool failed() const {
+        return writeFailed;
+    }
+
+    // Writes one block to an unlinked temporary file in `dir` and waits for it. Kernels before
+    // 5.6 set up rings but fail every IORING_OP_WRITE, which would drop every frame; false then,
+    // and also when no file can be created in `dir` to find out.
+    bool probe(const char* dir = ".") {
+        int fd = open(dir, O_TMPFILE | O_WRONLY | O_CLOEXEC | (options.direct ? O_DIRECT : 0),
+                      0600);
+        if (fd < 0) {
+            // no O_TMPFILE on this filesystem
+            std::string path = std::string(dir) + "/.frame_sink_probe_XXXXXX";
+            fd = mkstemp(path.data());
+            if (fd < 0) {
+                return false;
+            }
+            unlink(path.c_str());
+        }
+        startFile(fd);
+        std::vector<uint8_t> block(kDirectAlignment);
+        write(block.data(), block.size());
+        end();
+        drain();
+        bool ok = !failed();
+        writeFailed = false;
+        return ok;
+    }
+
+    bool begin(const char* name) override {
+        currentFile = kNoFile;
+        reap(false);
+        // a fresh inode instead of O_TRUNC: the last output to this path may still have writes
+        // (or its O_DIRECT truncate) queued
+        if (unlink(name) != 0 && errno != ENOENT) {
+            return false;
+        }
+        int flags = O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC | (options.direct ? O_DIRECT : 0);
+        int fd = open(name, flags, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        startFile(fd);
+        return true;
+    }
+
+    void write(const void* data, size_t size) override {
+        if (currentFile == kNoFile) {
+            return;
+        }
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        while (size > 0) {
+            if (current == kNoBuffer) {
+                current = acquireBuffer();
+                currentUsed = 0;
+                if (current == kNoBuffer) {
+                    return;
+                }
+            }
+            size_t chunk = std::min(size, options.bufferSize - currentUsed);
+            memcpy(buffers[current] + currentUsed, bytes, chunk);
+            currentUsed += chunk;
+            bytes += chunk;
+            size -= chunk;
+            if (currentUsed == options.bufferSize) {
+                submitCurrent(currentUsed);
+            }
+        }
+    }
+
+    bool end() override {
+        if (currentFile == kNoFile) {
+            return false;
+        }
+        File& file = files[currentFile];
+        file.size = file.offset;
+        if (current != kNoBuffer) {
+            size_t length = currentUsed;
+            file.size += currentUsed;
+            if (options.direct) {
+                length = (currentUsed + kDirectAlignment - 1) & ~(kDirectAlignment - 1);
+                memset(buffers[current] + currentUsed, 0, length - currentUsed);
+                file.truncate = length != currentUsed;
+            }
+            submitCurrent(length);
+        }
+        file.ended = true;
+        if (file.pending == 0) {
+            closeFile(currentFile);
+        }
+        currentFile = kNoFile;
+        // the file's own writes are still in flight; this reports earlier failures
+        return !writeFailed;
+    }
+
+    // Blocks until every queued write has completed and every ended file is closed, or waiting
+    // for completions fails.
+    void drain() {
+        while (freeBuffers.size() + (current != kNoBuffer ? 1 : 0) < buffers.size()) {
+            if (!reap(true)) {
+                return;
+            }
+        }
+    }
+
+  private:
+    struct File {
+        int fd = -1;
+        uint64_t offset = 0;
+        uint64_t size = 0;
+        uint32_t pending = 0;
+        bool ended = false;
+        bool truncate = false;
+    };
+    static constexpr uint32_t kNoBuffer = UINT32_MAX;
+    static constexpr uint32_t kNoFile = UINT32_MAX;
+
+    // A buffer's write in flight.
+    struct Write {
+        uint32_t file = kNoFile;
+        // file offset of the buffer's first byte
+        uint64_t offset = 0;
+        size_t length = 0;
+        // written by earlier, short completions
+        size_t done = 0;
+    };
+
+    int enter(unsigned toSubmit, unsigned minComplete, unsigned flags) {
+        int ret;
+        do {
+            ret = int(syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, nullptr,
+                              0));
+        } while (ret < 0 && errno == EINTR);
+        return ret;
+    }
+
+    void startFile(int fd) {
+        currentFile = nextFileId++;
+        files[currentFile] = File{fd};
+    }
+
+    // kNoBuffer if every buffer is in flight and waiting for one failed.
+    uint32_t acquireBuffer() {
+        while (freeBuffers.empty()) {
+            if (!reap(true)) {
+                return kNoBuffer;
+            }
+        }
+        uint32_t index = freeBuffers.back();
+        freeBuffers.pop_back();
+        return index;
+    }
+
+    void submitCurrent(size_t length) {
+        File& file = files[currentFile];
+        uint32_t buffer = current;
+        writes[buffer] = {currentFile, file.offset, length, 0};
+        file.offset += length;
+        file.pending++;
+        current = kNoBuffer;
+        if (!queueWrite(buffer)) {
+            file.offset -= length;
+        }
+    }
+
+    // Queues the unwritten rest of `buffer` and submits it. If the kernel doesn't take it, the
+    // entry is withdrawn and the write completed as failed, so nothing waits for it.
+    bool queueWrite(uint32_t buffer) {
+        const Write& w = writes[buffer];
+        // At most bufferCount writes are in flight, so the SQ (sized the same) never overflows.
+        unsigned tail = *sqTail;
+        unsigned index = tail & sqMask;
+        io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = registered ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        sqe->fd = files[w.file].fd;
+        sqe->addr = uint64_t(uintptr_t(buffers[buffer] + w.done));
+        sqe->len = uint32_t(w.length - w.done);
+        sqe->off = w.offset + w.done;
+        sqe->buf_index = registered ? uint16_t(buffer) : 0;
+        sqe->user_data = buffer;
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        if (enter(1, 0, 0) == 1) {
+            return true;
+        }
+        // not consumed by the kernel (no SQPOLL), so the tail can be taken back
+        __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+        writeFailed = true;
+        completeWrite(buffer);
+        return false;
+    }
+
+    // Returns the buffer to the pool and closes its file after the file's last write.
+    void completeWrite(uint32_t buffer) {
+        freeBuffers.push_back(buffer);
+        uint32_t fileId = writes[buffer].file;
+        File& file = files[fileId];
+        if (--file.pending == 0 && file.ended) {
+            closeFile(fileId);
+        }
+    }
+
+    // False if waiting for a completion failed; nothing more will complete then.
+    bool reap(bool wait) {
+        unsigned head = *cqHead;
+        if (wait && head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE) &&
+            enter(0, 1, IORING_ENTER_GETEVENTS) < 0) {
+            writeFailed = true;
+            return false;
+        }
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            const io_uring_cqe& cqe = cqes[head & cqMask];
+            uint32_t buffer = uint32_t(cqe.user_data);
+            Write& w = writes[buffer];
+            if (cqe.res > 0 && w.done + size_t(cqe.res) < w.length) {
+                w.done += size_t(cqe.res);
+                queueWrite(buffer);
+                continue;
+            }
+            if (cqe.res <= 0 || w.done + size_t(cqe.res) != w.length) {
+                writeFailed = true;
+            }
+            completeWrite(buffer);
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    void closeFile(uint32_t fileId) {
+        File& file = files[fileId];
+        if (file.truncate && ftruncate(file.fd, off_t(file.size)) != 0) {
+            writeFailed = true;
+        }
+        if (close(file.fd) != 0) {
+            writeFailed = true;
+        }
+        files.erase(fileId);
+    }
+
+    void destroyRing() {
+        for (uint8_t* buffer : buffers) {
+            free(buffer);
+        }
+        buffers.clear();
+        if (sqes) {
+            munmap(sqes, sqesSize);
+        }
+        if (cqRing && cqRing != MAP_FAILED && cqRing != sqRing) {
+            munmap(cqRing, cqRingSize);
+        }
+        if (sqRing && sqRing != MAP_FAILED) {
+            munmap(sqRing, sqRingSize);
+        }
+        sqes = nullptr;
+        sqRing = cqRing = nullptr;
+        if (ringFd >= 0) {
+            close(ringFd);
+        }
+        ringFd = -1;
+    }
+
+    Options options;
+    int ringFd = -1;
+    bool registered = false;
+    bool writeFailed = false;
+
+    void* sqRing = nullptr;
+    void* cqRing = nullptr;
+    size_t sqRingSize = 0;
+    size_t cqRingSize = 0;
+    size_t sqesSize = 0;
+    unsigned* sqTail = nullptr;
+    unsigned* sqArray = nullptr;
+    unsigned sqMask = 0;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned cqMask = 0;
+    io_uring_sqe* sqes = nullptr;
+    io_uring_cqe* cqes = nullptr;
+
+    std::vector<uint8_t*> buffers;
+    std::vector<Write> writes;
+    std::vector<uint32_t> freeBuffers;
+    uint32_t current = kNoBuffer;
+    size_t currentUsed = 0;
+
+    std::map<uint32_t, File> files;
+    uint32_t currentFile = kNoFile;
+    uint32_t nextFileId = 0;
+};
+#endif  // FRAME_SINK_IO_URING
+
+// Keeps every output in memory so it can be encoded on one thread and written to the real sink
+// on another, in order.
+struct MemorySink : FrameSink {
+    struct Output {
+        std::string name;
+        std::vector<uint8_t> data;
+    };
+    std::vector<Output> outputs;
+
+    bool begin(const char* name) override {
+        outputs.push_back({name, {}});
+        return true;
+    }
+
+    void write(const void* data, size_t size) override {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        outputs.back().data.insert(outputs.back().data.end(), bytes, bytes + size);
+    }
+
+    bool end() override {
+        return true;
+    }
+
+    // Writes every output to `sink` and forgets them.
+    void replay(FrameSink& sink) {
+        for (const Output& output : outputs) {
+            if (sink.begin(output.name.c_str())) {
+                sink.write(output.data.data(), output.data.size());
+                sink.end();
+            }
+        }
+        outputs.clear();
+    }
+};
+
+// The asynchronous io_uring sink when the kernel supports it, stdio otherwise.
+inline std::unique_ptr<FrameSink> makeFileSink() {
+#ifdef FRAME_SINK_IO_URING
+    auto sink = std::make_unique<IoUringFileSink>();
+    if (sink->valid()) {
+        if (sink->probe()) {
+            return sink;
+        }
+        fprintf(stderr, "io_uring writes fail on this kernel, writing frames with stdio\n");
+    }
+#endif
+    return std::make_unique<StdioFileSink>();
+}
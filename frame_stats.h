@@ -0,0 +1,329 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "frame_sink.h"
+
+// How long each frame spends in each stage on its way from draw() to the sink. Samples come
+// from the render thread, the thread running Dawn's callbacks and the encode workers. Each
+// thread records into its own histograms with relaxed atomic increments, so recording never
+// takes a lock (after a thread's first sample) and the histograms can be read or dumped while
+// frames are in flight.
+
+using FrameClock = std::chrono::steady_clock;
+
+enum class FrameStage : uint32_t {
+    EncoderCreate,  // CreateCommandEncoder for the render pass
+    RenderPass,     // recording the render pass and finishing the command buffer
+    Submit,         // Queue::Submit of the render pass
+    CopyRecord,     // recording the readback commands (copy and any GPU conversion)
+    CopySubmit,     // Queue::Submit of the readback
+    MapIssue,       // the MapAsync call
+    GpuDone,        // from the readback submit until the queue reports the work done
+    Map,            // from the work being done until the map callback
+    Encode,         // encoding, without the time spent in the sink
+    Write,          // in the sink's begin/write/end
+    Latency,        // from the start of draw() until the frame reached the outputs
+    GpuRender,      // the render pass on the GPU, from timestamp queries
+    GpuReadback,    // the readback commands (copy and GPU conversion) on the GPU
+};
+
+constexpr uint32_t kFrameStageCount = 13;
+
+inline const char* frameStageName(FrameStage stage) {
+    switch (stage) {
+        case FrameStage::EncoderCreate:
+            return "encoder_create";
+        case FrameStage::RenderPass:
+            return "render_pass";
+        case FrameStage::Submit:
+            return "submit";
+        case FrameStage::CopyRecord:
+            return "copy_record";
+        case FrameStage::CopySubmit:
+            return "copy_submit";
+        case FrameStage::MapIssue:
+            return "map_issue";
+        case FrameStage::GpuDone:
+            return "gpu_done";
+        case FrameStage::Map:
+            return "map";
+        case FrameStage::Encode:
+            return "encode";
+        case FrameStage::Write:
+            return "write";
+        case FrameStage::Latency:
+            return "latency";
+        case FrameStage::GpuRender:
+            return "gpu_render";
+        case FrameStage::GpuReadback:
+            return "gpu_readback";
+    }
+    return "";
+}
+
+// Log-linear histogram of nanosecond values in the style of HdrHistogram: exact below 32 ns,
+// then 32 sub-buckets per power of two (at most ~3% relative error) up to 2^40 ns (about 18
+// minutes); larger values land in the last bucket.
+struct LatencyHistogram {
+    static constexpr uint32_t kSubBucketBits = 5;
+    static constexpr uint32_t kSubBuckets = 1u << kSubBucketBits;
+    static constexpr uint32_t kMaxBits = 40;
+    static constexpr uint32_t kBucketCount = (kMaxBits - kSubBucketBits + 1) * kSubBuckets;
+
+    std::atomic<uint64_t> counts[kBucketCount] = {};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> max{0};
+
+    static uint32_t bucketOf(uint64_t ns) {
+        if (ns < kSubBuckets) {
+            return uint32_t(ns);
+        }
+        uint32_t magnitude = uint32_t(std::bit_width(ns)) - 1;
+        if (magnitude >= kMaxBits) {
+            return kBucketCount - 1;
+        }
+        uint32_t shift = magnitude - kSubBucketBits;
+        return (shift + 1) * kSubBuckets + uint32_t(ns >> shift) - kSubBuckets;
+    }
+
+    // The middle of a bucket's range.
+    static uint64_t bucketValue(uint32_t bucket) {
+        if (bucket < kSubBuckets) {
+            return bucket;
+        }
+        uint32_t shift = bucket / kSubBuckets - 1;
+        uint64_t lower = uint64_t(kSubBuckets + bucket % kSubBuckets) << shift;
+        return lower + (uint64_t(1) << shift) / 2;
+    }
+
+    // Only ever called from the owning thread.
+    void record(uint64_t ns) {
+        counts[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(ns, std::memory_order_relaxed);
+        if (ns > max.load(std::memory_order_relaxed)) {
+            max.store(ns, std::memory_order_relaxed);
+        }
+    }
+
+    void reset() {
+        for (std::atomic<uint64_t>& count : counts) {
+            count.store(0, std::memory_order_relaxed);
+        }
+        total.store(0, std::memory_order_relaxed);
+        sum.store(0, std::memory_order_relaxed);
+        max.store(0, std::memory_order_relaxed);
+    }
+};
+
+struct FrameStats {
+    // One stage merged over all threads, in microseconds.
+    struct Summary {
+        uint64_t count = 0;
+        double mean = 0;
+        double p50 = 0;
+        double p90 = 0;
+        double p99 = 0;
+        double p999 = 0;
+        double max = 0;
+    };
+
+    FrameStats() : id(nextId()) {
+    }
+
+    FrameStats(const FrameStats&) = delete;
+    FrameStats& operator=(const FrameStats&) = delete;
+
+    void record(FrameStage stage, FrameClock::duration duration) {
+        int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+        local().stages[uint32_t(stage)].record(uint64_t(std::max<int64_t>(ns, 0)));
+    }
+
+    // A frame (or a repeat) reached the outputs.
+    void frameDone() {
+        frames.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint64_t frameCount() const {
+        return frames.load(std::memory_order_relaxed);
+    }
+
+    // Percentile (0..100) of a stage in microseconds, 0 without samples.
+    double percentile(FrameStage stage, double p) {
+        std::vector<uint64_t> counts;
+        uint64_t total = merge(stage, counts);
+        return valueAt(counts, total, p);
+    }
+
+    Summary summary(FrameStage stage) {
+        std::vector<uint64_t> counts;
+        Summary s;
+        s.count = merge(stage, counts);
+        if (s.count == 0) {
+            return s;
+        }
+        uint64_t sum = 0;
+        uint64_t max = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (const auto& thread : threads) {
+                const LatencyHistogram& h = thread->stages[uint32_t(stage)];
+                sum += h.sum.load(std::memory_order_relaxed);
+                max = std::max(max, h.max.load(std::memory_order_relaxed));
+            }
+        }
+        s.mean = double(sum) / double(s.count) / 1000.0;
+        s.p50 = valueAt(counts, s.count, 50);
+        s.p90 = valueAt(counts, s.count, 90);
+        s.p99 = valueAt(counts, s.count, 99);
+        s.p999 = valueAt(counts, s.count, 99.9);
+        s.max = double(max) / 1000.0;
+        return s;
+    }
+
+    // Writes one line of JSON: the frame count and a summary of every stage with samples.
+    void dump(FILE* out) {
+        fprintf(out, "{\"frames\": %llu", (unsigned long long)frameCount());
+        for (uint32_t i = 0; i < kFrameStageCount; ++i) {
+            Summary s = summary(FrameStage(i));
+            if (s.count == 0) {
+                continue;
+            }
+            fprintf(out,
+                    ", \"%s\": {\"count\": %llu, \"mean\": %.1f, \"p50\": %.1f, \"p90\": %.1f, "
+                    "\"p99\": %.1f, \"p99.9\": %.1f, \"max\": %.1f}",
+                    frameStageName(FrameStage(i)), (unsigned long long)s.count, s.mean, s.p50,
+                    s.p90, s.p99, s.p999, s.max);
+        }
+        fprintf(out, "}\n");
+        fflush(out);
+    }
+
+    // Starts a new interval. Samples recorded concurrently may be lost.
+    void reset() {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& thread : threads) {
+            for (LatencyHistogram& h : thread->stages) {
+                h.reset();
+            }
+        }
+        frames.store(0, std::memory_order_relaxed);
+    }
+
+  private:
+    struct ThreadHistograms {
+        std::thread::id owner;
+        LatencyHistogram stages[kFrameStageCount];
+    };
+
+    static uint64_t nextId() {
+        static std::atomic<uint64_t> next{1};
+        return next.fetch_add(1);
+    }
+
+    // The calling thread's histograms, registered on its first sample. Cached per thread by
+    // id rather than address, since a new FrameStats may reuse a destroyed one's memory.
+    ThreadHistograms& local() {
+        thread_local uint64_t cachedId = 0;
+        thread_local ThreadHistograms* cached = nullptr;
+        if (cachedId != id) {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::thread::id self = std::this_thread::get_id();
+            auto it = std::find_if(threads.begin(), threads.end(),
+                                   [self](const auto& thread) { return thread->owner == self; });
+            if (it == threads.end()) {
+                threads.push_back(std::make_unique<ThreadHistograms>());
+                threads.back()->owner = self;
+                it = threads.end() - 1;
+            }
+            cached = it->get();
+            cachedId = id;
+        }
+        return *cached;
+    }
+
+    uint64_t merge(FrameStage stage, std::vector<uint64_t>& counts) {
+        counts.assign(LatencyHistogram::kBucketCount, 0);
+        uint64_t total = 0;
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& thread : threads) {
+            const LatencyHistogram& h = thread->stages[uint32_t(stage)];
+            for (uint32_t i = 0; i < LatencyHistogram::kBucketCount; ++i) {
+                uint64_t count = h.counts[i].load(std::memory_order_relaxed);
+                counts[i] += count;
+                total += count;
+            }
+        }
+        return total;
+    }
+
+    static double valueAt(const std::vector<uint64_t>& counts, uint64_t total, double p) {
+        if (total == 0) {
+            return 0;
+        }
+        uint64_t rank = std::max<uint64_t>(1, uint64_t(std::ceil(p / 100.0 * double(total))));
+        uint64_t seen = 0;
+        for (uint32_t i = 0; i < counts.size(); ++i) {
+            seen += counts[i];
+            if (seen >= rank) {
+                return double(LatencyHistogram::bucketValue(i)) / 1000.0;
+            }
+        }
+        return double(LatencyHistogram::bucketValue(uint32_t(counts.size()) - 1)) / 1000.0;
+    }
+
+    const uint64_t id;
+    // guards `threads` (the list, not the counters)
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadHistograms>> threads;
+    std::atomic<uint64_t> frames{0};
+};
+
+// Forwards to `inner` and adds up the time spent in it.
+struct TimedSink : FrameSink {
+    FrameSink& inner;
+    FrameClock::duration elapsed{};
+
+    explicit TimedSink(FrameSink& sink) : inner(sink) {
+    }
+
+    bool begin(const char* name) override {
+        FrameClock::time_point start = FrameClock::now();
+        bool ok = inner.begin(name);
+        elapsed += FrameClock::now() - start;
+        return ok;
+    }
+
+    void write(const void* data, size_t size) override {
+        FrameClock::time_point start = FrameClock::now();
+        inner.write(data, size);
+        elapsed += FrameClock::now() - start;
+    }
+
+    bool end() override {
+        FrameClock::time_point start = FrameClock::now();
+        bool ok = inner.end();
+        elapsed += FrameClock::now() - start;
+        return ok;
+    }
+
+    bool repeatLast() override {
+        return inner.repeatLast();
+    }
+
+    bool outputsAreFrames() const override {
+        return inner.outputsAreFrames();
+    }
+};
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Timeline of the frame pipeline in Chrome's trace-event JSON format, for chrome://tracing or
+// ui.perfetto.dev. Threads record complete events (a name, a start and a duration) into their
+// own fixed-size ring, overwriting their oldest events once full, so tracing has a bounded cost
+// and a long run keeps its most recent history. Recording takes no lock after a thread's first
+// event. write() may run while other threads record; their events from that moment can be
+// missing or garbled in the output.
+
+struct FrameTracer {
+    using Clock = std::chrono::steady_clock;
+
+    // Event names must be string literals (or otherwise outlive the tracer).
+    struct Event {
+        const char* name;
+        int64_t beginNs;
+        int64_t durationNs;
+        // kNoFrame when the event doesn't belong to one frame
+        uint64_t frame;
+        // tracks other than the recording thread's, e.g. the GPU queue; 0 for the thread
+        uint32_t track;
+    };
+
+    static constexpr uint64_t kNoFrame = UINT64_MAX;
+
+    explicit FrameTracer(size_t eventsPerThread = 1 << 16)
+        : capacity(std::max<size_t>(1, eventsPerThread)), id(nextId()), epoch(Clock::now()) {
+    }
+
+    FrameTracer(const FrameTracer&) = delete;
+    FrameTracer& operator=(const FrameTracer&) = delete;
+
+    // Names the calling thread in the trace.
+    void nameThread(const char* name) {
+        ThreadRing& ring = local();
+        if (ring.name != name) {
+            std::lock_guard<std::mutex> lock(mutex);
+            ring.name = name;
+        }
+    }
+
+    // A virtual track (tid) for events that aren't on any CPU thread; `track` is 1-based.
+    void nameTrack(uint32_t track, const char* name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (tracks.size() < track) {
+            tracks.resize(track);
+        }
+        tracks[track - 1] = name;
+    }
+
+    void record(const char* name, Clock::time_point begin, Clock::time_point end,
+                uint64_t frame = kNoFrame, uint32_t track = 0) {
+        ThreadRing& ring = local();
+        uint64_t index = ring.head.load(std::memory_order_relaxed);
+        ring.events[index % capacity] = {name, nanoseconds(begin), nanoseconds(end - begin), frame,
+                                         track};
+        ring.head.store(index + 1, std::memory_order_release);
+    }
+
+    // Writes everything recorded so far; false if the file couldn't be written.
+    bool write(const char* path) {
+        FILE* file = fopen(path, "wb");
+        if (!file) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+        bool first = true;
+        auto separator = [&] {
+            const char* s = first ? "  " : ",\n  ";
+            first = false;
+            return s;
+        };
+        fprintf(file, "%s{\"ph\": \"M\", \"pid\": 1, \"name\": \"process_name\", "
+                      "\"args\": {\"name\": \"webgpu-test\"}}",
+                separator());
+        for (size_t i = 0; i < tracks.size(); ++i) {
+            fprintf(file,
+                    "%s{\"ph\": \"M\", \"pid\": 1, \"tid\": %zu, \"name\": \"thread_name\", "
+                    "\"args\": {\"name\": \"%s\"}}",
+                    separator(), kTrackTidBase + i + 1, tracks[i].c_str());
+        }
+        for (size_t t = 0; t < threads.size(); ++t) {
+            const ThreadRing& ring = *threads[t];
+            size_t tid = t + 1;
+            if (!ring.name.empty()) {
+                fprintf(file,
+                        "%s{\"ph\": \"M\", \"pid\": 1, \"tid\": %zu, \"name\": \"thread_name\", "
+                        "\"args\": {\"name\": \"%s\"}}",
+                        separator(), tid, ring.name.c_str());
+            }
+            uint64_t head = ring.head.load(std::memory_order_acquire);
+            for (uint64_t i = head > capacity ? head - capacity : 0; i < head; ++i) {
+                const Event& e = ring.events[i % capacity];
+                fprintf(file,
+                        "%s{\"ph\": \"X\", \"pid\": 1, \"tid\": %zu, \"name\": \"%s\", "
+                        "\"ts\": %.3f, \"dur\": %.3f",
+                        separator(), e.track ? kTrackTidBase + e.track : tid, e.name,
+                        e.beginNs / 1000.0, e.durationNs / 1000.0);
+                if (e.frame != kNoFrame) {
+                    fprintf(file, ", \"args\": {\"frame\": %llu}", (unsigned long long)e.frame);
+                }
+                fprintf(file, "}");
+            }
+        }
+        fprintf(file, "\n]}\n");
+        return fclose(file) == 0;
+    }
+
+  private:
+    // tids of virtual tracks start above any thread's
+    static constexpr size_t kTrackTidBase = 1000;
+
+    struct ThreadRing {
+        std::thread::id owner;
+        std::string name;
+        std::unique_ptr<Event[]> events;
+        std::atomic<uint64_t> head{0};
+    };
+
+    static uint64_t nextId() {
+        static std::atomic<uint64_t> next{1};
+        return next.fetch_add(1);
+    }
+
+    int64_t nanoseconds(Clock::time_point t) const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(t - epoch).count();
+    }
+
+    int64_t nanoseconds(Clock::duration d) const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+    }
+
+    // The calling thread's ring, created on its first event; cached per thread like
+    // FrameStats's histograms.
+    ThreadRing& local() {
+        thread_local uint64_t cachedId = 0;
+        thread_local ThreadRing* cached = nullptr;
+        if (cachedId != id) {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::thread::id self = std::this_thread::get_id();
+            auto it = std::find_if(threads.begin(), threads.end(),
+                                   [self](const auto& ring) { return ring->owner == self; });
+            if (it == threads.end()) {
+                auto ring = std::make_unique<ThreadRing>();
+                ring->owner = self;
+                ring->events = std::make_unique<Event[]>(capacity);
+                threads.push_back(std::move(ring));
+                it = threads.end() - 1;
+            }
+            cached = it->get();
+            cachedId = id;
+        }
+        return *cached;
+    }
+
+    const size_t capacity;
+    const uint64_t id;
+    const Clock::time_point epoch;
+    // guards `threads`, `tracks` and thread names
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadRing>> threads;
+    std::vector<std::string> tracks;
+};
+
+// Records the enclosing scope as one event; does nothing without a tracer.
+struct TraceScope {
+    FrameTracer* tracer;
+    const char* name;
+    uint64_t frame;
+    FrameTracer::Clock::time_point begin;
+
+    TraceScope(FrameTracer* t, const char* eventName, uint64_t frameIndex = FrameTracer::kNoFrame)
+        : tracer(t), name(eventName), frame(frameIndex) {
+        if (tracer) {
+            begin = FrameTracer::Clock::now();
+        }
+    }
+
+    ~TraceScope() {
+        if (tracer) {
+            tracer->record(name, begin, FrameTracer::Clock::now(), frame);
+        }
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+};
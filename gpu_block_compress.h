@@ -0,0 +1,305 @@
+#pragma once
+
+#include <webgpu/webgpu_cpp.h>
+
+#include <cstdint>
+
+#include "alloc_stats.h"
+#include "shader_module.h"
+
+// GPU-ready texture output: the render target is block compressed on the GPU and only the
+// compressed blocks are read back, 4x4 texels per block in raster order, which is also how
+// KTX2 stores a level.
+enum class BlockCompression : uint32_t {
+    None,
+    BC1,  // opaque RGB, 8 bytes per block (8x smaller than RGBA)
+    BC7,  // RGBA in mode 6, 16 bytes per block (4x smaller)
+};
+
+// One invocation per block. Both encoders fit a line through the block's colors along their
+// principal axis (a few power iterations on the covariance) and pick the nearest palette
+// entry for every texel. BC1 takes the extreme texels on that axis as RGB565 endpoints in
+// four-color mode; BC7 uses mode 6 (one subset, RGBA endpoints of 7 bits plus a p-bit each,
+// 4-bit indices). Partial blocks at the edges repeat the last row and column.
+const char blockCompressShaderCode[] = R"(
+@group(0) @binding(0) var src: texture_2d<f32>;
+@group(0) @binding(1) var<storage, read_write> dst: array<u32>;
+
+fn loadBlock(block: vec2u) -> array<vec4f, 16> {
+    let size = textureDimensions(src);
+    var texels: array<vec4f, 16>;
+    for (var i = 0u; i < 16u; i++) {
+        let p = min(block * 4u + vec2u(i % 4u, i / 4u), size - 1u);
+        texels[i] = clamp(textureLoad(src, p, 0), vec4f(0.0), vec4f(1.0));
+    }
+    return texels;
+}
+
+fn blockIndex(block: vec2u) -> u32 {
+    let blocksX = (textureDimensions(src).x + 3u) / 4u;
+    return block.y * blocksX + block.x;
+}
+
+fn mean(texels: array<vec4f, 16>) -> vec4f {
+    var sum = vec4f(0.0);
+    for (var i = 0u; i < 16u; i++) {
+        sum += texels[i];
+    }
+    return sum / 16.0;
+}
+
+// principal axis of the texels around `center`, zero for a flat block
+fn principalAxis(texels: array<vec4f, 16>, center: vec4f) -> vec4f {
+    var cov = mat4x4f();
+    var lo = vec4f(1.0);
+    var hi = vec4f(0.0);
+    for (var i = 0u; i < 16u; i++) {
+        let d = texels[i] - center;
+        cov += mat4x4f(d * d.x, d * d.y, d * d.z, d * d.w);
+        lo = min(lo, texels[i]);
+        hi = max(hi, texels[i]);
+    }
+    var axis = hi - lo;
+    for (var k = 0; k < 8; k++) {
+        axis = cov * axis;
+        let len = length(axis);
+        if (len < 1e-12) {
+            return vec4f(0.0);
+        }
+        axis /= len;
+    }
+    return axis;
+}
+
+fn to565(c: vec3f) -> u32 {
+    let q = vec3u(round(c * vec3f(31.0, 63.0, 31.0)));
+    return (q.r << 11u) | (q.g << 5u) | q.b;
+}
+
+fn from565(v: u32) -> vec3f {
+    let r = (v >> 11u) & 31u;
+    let g = (v >> 5u) & 63u;
+    let b = v & 31u;
+    return vec3f(f32((r << 3u) | (r >> 2u)), f32((g << 2u) | (g >> 4u)),
+                 f32((b << 3u) | (b >> 2u))) / 255.0;
+}
+
+@compute @workgroup_size(8, 8)
+fn bc1(@builtin(global_invocation_id) id: vec3u) {
+    let size = textureDimensions(src);
+    if (any(id.xy * 4u >= size)) {
+        return;
+    }
+    var texels = loadBlock(id.xy);
+    for (var i = 0u; i < 16u; i++) {
+        texels[i].a = 0.0;
+    }
+    let center = mean(texels);
+    let axis = principalAxis(texels, center);
+    var lo = 0u;
+    var hi = 0u;
+    var loT = 1e9;
+    var hiT = -1e9;
+    for (var i = 0u; i < 16u; i++) {
+        let t = dot(texels[i] - center, axis);
+        if (t < loT) {
+            loT = t;
+            lo = i;
+        }
+        if (t > hiT) {
+            hiT = t;
+            hi = i;
+        }
+    }
+
+    // four-color mode needs color0 > color1
+    var c0 = to565(texels[hi].rgb);
+    var c1 = to565(texels[lo].rgb);
+    if (c0 < c1) {
+        let t = c0;
+        c0 = c1;
+        c1 = t;
+    }
+    var indices = 0u;
+    if (c0 != c1) {
+        let p0 = from565(c0);
+        let p1 = from565(c1);
+        var palette = array<vec3f, 4>(p0, p1, (2.0 * p0 + p1) / 3.0, (p0 + 2.0 * p1) / 3.0);
+        for (var i = 0u; i < 16u; i++) {
+            var best = 0u;
+            var bestError = 1e9;
+            for (var k = 0u; k < 4u; k++) {
+                let d = texels[i].rgb - palette[k];
+                let e = dot(d, d);
+                if (e < bestError) {
+                    best = k;
+                    bestError = e;
+                }
+            }
+            indices |= best << (2u * i);
+        }
+    }
+    let base = blockIndex(id.xy) * 2u;
+    dst[base] = c0 | (c1 << 16u);
+    dst[base + 1u] = indices;
+}
+
+// mode 6 endpoint: 7 bits per channel and the p-bit that minimizes the error
+fn quantize7(c: vec4f) -> vec4u {
+    let v = c * 255.0;
+    var best = vec4u(0u);
+    var bestError = 1e9;
+    for (var p = 0u; p < 2u; p++) {
+        let q = vec4u(clamp(round((v - f32(p)) * 0.5), vec4f(0.0), vec4f(127.0)));
+        let d = vec4f(q * 2u + p) - v;
+        let e = dot(d, d);
+        if (e < bestError) {
+            best = q * 2u + p;
+            bestError = e;
+        }
+    }
+    return best;
+}
+
+fn put(block: ptr<function, array<u32, 4>>, at: u32, count: u32, value: u32) {
+    let word = at / 32u;
+    let shift = at % 32u;
+    (*block)[word] |= value << shift;
+    if (shift + count > 32u) {
+        (*block)[word + 1u] |= value >> (32u - shift);
+    }
+}
+
+@compute @workgroup_size(8, 8)
+fn bc7(@builtin(global_invocation_id) id: vec3u) {
+    let size = textureDimensions(src);
+    if (any(id.xy * 4u >= size)) {
+        return;
+    }
+    var texels = loadBlock(id.xy);
+    let center = mean(texels);
+    let axis = principalAxis(texels, center);
+    var loT = 0.0;
+    var hiT = 0.0;
+    for (var i = 0u; i < 16u; i++) {
+        let t = dot(texels[i] - center, axis);
+        loT = min(loT, t);
+        hiT = max(hiT, t);
+    }
+    // 8-bit endpoints, the low bit being the p-bit
+    var e0 = quantize7(clamp(center + axis * loT, vec4f(0.0), vec4f(1.0)));
+    var e1 = quantize7(clamp(center + axis * hiT, vec4f(0.0), vec4f(1.0)));
+
+    var weights = array<u32, 16>(0u, 4u, 9u, 13u, 17u, 21u, 26u, 30u, 34u, 38u, 43u, 47u, 51u,
+                                 55u, 60u, 64u);
+    var palette: array<vec4f, 16>;
+    for (var k = 0u; k < 16u; k++) {
+        palette[k] = vec4f((e0 * (64u - weights[k]) + e1 * weights[k] + 32u) >> vec4u(6u));
+    }
+    var indices: array<u32, 16>;
+    for (var i = 0u; i < 16u; i++) {
+        let v = round(texels[i] * 255.0);
+        var bestError = 1e9;
+        for (var k = 0u; k < 16u; k++) {
+            let d = v - palette[k];
+            let e = dot(d, d);
+            if (e < bestError) {
+                indices[i] = k;
+                bestError = e;
+            }
+        }
+    }
+    // the first index is stored without its top bit
+    if (indices[0] >= 8u) {
+        let t = e0;
+        e0 = e1;
+        e1 = t;
+        for (var i = 0u; i < 16u; i++) {
+            indices[i] = 15u - indices[i];
+        }
+    }
+
+    var block = array<u32, 4>(1u << 6u, 0u, 0u, 0u);
+    for (var c = 0u; c < 4u; c++) {
+        put(&block, 7u + c * 14u, 7u, e0[c] >> 1u);
+        put(&block, 14u + c * 14u, 7u, e1[c] >> 1u);
+    }
+    put(&block, 63u, 1u, e0.x & 1u);
+    put(&block, 64u, 1u, e1.x & 1u);
+    put(&block, 65u, 3u, indices[0]);
+    for (var i = 1u; i < 16u; i++) {
+        put(&block, 64u + i * 4u, 4u, indices[i]);
+    }
+    let base = blockIndex(id.xy) * 4u;
+    for (var w = 0u; w < 4u; w++) {
+        dst[base + w] = block[w];
+    }
+}
+)";
+
+struct GpuBlockCompressor {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    BlockCompression compression = BlockCompression::None;
+    wgpu::Buffer blockBuffer;
+    wgpu::ComputePipeline pipeline;
+    wgpu::BindGroup bindGroup;
+
+    // `view` must be a non-sRGB view of an 8-bit RGBA/BGRA target with TextureBinding usage;
+    // blocks hold the texels as stored, so an sRGB target gives sRGB blocks.
+    void init(const wgpu::Device& device, const wgpu::TextureView& view, uint32_t frameWidth,
+              uint32_t frameHeight, BlockCompression format) {
+        width = frameWidth;
+        height = frameHeight;
+        compression = format;
+
+        wgpu::BufferDescriptor blockDesc;
+        blockDesc.label = "Compressed blocks";
+        blockDesc.usage = wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopySrc;
+        blockDesc.size = compressedSize();
+        blockBuffer = createTrackedBuffer(device, blockDesc);
+
+        wgpu::ComputePipelineDescriptor pipelineDesc{
+            .compute = {.module = createShaderModule(device, blockCompressShaderCode),
+                        .entryPoint = compression == BlockCompression::BC7 ? "bc7" : "bc1"}};
+        pipeline = device.CreateComputePipeline(&pipelineDesc);
+
+        wgpu::BindGroupEntry entries[2] = {};
+        entries[0].binding = 0;
+        entries[0].textureView = view;
+        entries[1].binding = 1;
+        entries[1].buffer = blockBuffer;
+        wgpu::BindGroupDescriptor bindGroupDesc{
+            .layout = pipeline.GetBindGroupLayout(0), .entryCount = 2, .entries = entries};
+        bindGroup = device.CreateBindGroup(&bindGroupDesc);
+    }
+
+    bool enabled() const {
+        return bool(pipeline);
+    }
+
+    uint32_t blocksX() const {
+        return (width + 3) / 4;
+    }
+
+    uint32_t blocksY() const {
+        return (height + 3) / 4;
+    }
+
+    uint32_t blockBytes() const {
+        return compression == BlockCompression::BC7 ? 16 : 8;
+    }
+
+    uint64_t compressedSize() const {
+        return uint64_t(blocksX()) * blocksY() * blockBytes();
+    }
+
+    void encode(const wgpu::CommandEncoder& encoder, const wgpu::Buffer& readback) const {
+        wgpu::ComputePassEncoder pass = encoder.BeginComputePass();
+        pass.SetPipeline(pipeline);
+        pass.SetBindGroup(0, bindGroup);
+        pass.DispatchWorkgroups((blocksX() + 7) / 8, (blocksY() + 7) / 8);
+        pass.End();
+        encoder.CopyBufferToBuffer(blockBuffer, 0, readback, 0, compressedSize());
+    }
+};
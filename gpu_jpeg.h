@@ -0,0 +1,235 @@
+#pragma once
+
+#include <webgpu/webgpu_cpp.h>
+
+#include <cstdint>
+
+#include "alloc_stats.h"
+#include "shader_module.h"
+
+// JPEG front end on the GPU: the JFIF color conversion, 8x8 AAN DCT and quantization of
+// stbi_write_jpg, one workgroup per MCU. The readback holds the quantized coefficients as
+// int16, 64 per data unit in zigzag order, MCUs in raster order, which is the layout
+// stbi_write_jpg_coefficients_to_func takes; the CPU only does the Huffman coding. At quality
+// <= 90 the chroma is subsampled 2x2 and the coefficients take 3/4 of the RGBA frame's bytes.
+
+const char jpegShaderCode[] = R"(
+@group(0) @binding(0) var src: texture_2d<f32>;
+// stbi_write_jpg_quant_tables: Y divisors, then U/V, row major
+@group(0) @binding(1) var<storage, read> fdtbl: array<f32, 128>;
+@group(0) @binding(2) var<storage, read_write> coefs: array<u32>;
+
+// row major index of each zigzag position
+var<private> naturalOrder: array<u32, 64> = array<u32, 64>(
+    0u, 1u, 8u, 16u, 9u, 2u, 3u, 10u, 17u, 24u, 32u, 25u, 18u, 11u, 4u, 5u,
+    12u, 19u, 26u, 33u, 40u, 48u, 41u, 34u, 27u, 20u, 13u, 6u, 7u, 14u, 21u, 28u,
+    35u, 42u, 49u, 56u, 57u, 50u, 43u, 36u, 29u, 22u, 15u, 23u, 30u, 37u, 44u, 51u,
+    58u, 59u, 52u, 45u, 38u, 31u, 39u, 46u, 53u, 60u, 61u, 54u, 47u, 55u, 62u, 63u);
+
+// the MCU's data units: Y (four when subsampled), then U and V
+var<workgroup> units: array<array<f32, 64>, 6>;
+
+// Y - 128, U, V of a pixel, repeating the last row and column past the edges
+fn yuv(p: vec2u) -> vec3f {
+    let size = textureDimensions(src);
+    let c = round(clamp(textureLoad(src, min(p, size - 1u), 0), vec4f(0.0), vec4f(1.0)) * 255.0);
+    return vec3f(0.299 * c.r + 0.587 * c.g + 0.114 * c.b - 128.0,
+                 -0.16874 * c.r - 0.33126 * c.g + 0.5 * c.b,
+                 0.5 * c.r - 0.41869 * c.g - 0.08131 * c.b);
+}
+
+// stbiw__jpg_DCT
+fn dct8(d: array<f32, 8>) -> array<f32, 8> {
+    let tmp0 = d[0] + d[7];
+    let tmp7 = d[0] - d[7];
+    let tmp1 = d[1] + d[6];
+    let tmp6 = d[1] - d[6];
+    let tmp2 = d[2] + d[5];
+    let tmp5 = d[2] - d[5];
+    let tmp3 = d[3] + d[4];
+    let tmp4 = d[3] - d[4];
+
+    // even part
+    let tmp10 = tmp0 + tmp3;
+    let tmp13 = tmp0 - tmp3;
+    let tmp11 = tmp1 + tmp2;
+    let tmp12 = tmp1 - tmp2;
+    var o: array<f32, 8>;
+    o[0] = tmp10 + tmp11;
+    o[4] = tmp10 - tmp11;
+    let z1 = (tmp12 + tmp13) * 0.707106781;
+    o[2] = tmp13 + z1;
+    o[6] = tmp13 - z1;
+
+    // odd part
+    let odd10 = tmp4 + tmp5;
+    let odd11 = tmp5 + tmp6;
+    let odd12 = tmp6 + tmp7;
+    let z5 = (odd10 - odd12) * 0.382683433;
+    let z2 = odd10 * 0.541196100 + z5;
+    let z4 = odd12 * 1.306562965 + z5;
+    let z3 = odd11 * 0.707106781;
+    let z11 = tmp7 + z3;
+    let z13 = tmp7 - z3;
+    o[5] = z13 + z2;
+    o[3] = z13 - z2;
+    o[1] = z11 + z4;
+    o[7] = z11 - z4;
+    return o;
+}
+
+// Transforms and quantizes the MCU's `count` data units and writes them as int16 pairs.
+fn finish(index: u32, mcu: u32, count: u32) {
+    // one 8-point DCT per invocation: rows, then columns
+    let unit = index / 8u;
+    let line = index % 8u;
+    if (unit < count) {
+        var d: array<f32, 8>;
+        for (var i = 0u; i < 8u; i++) {
+            d[i] = units[unit][line * 8u + i];
+        }
+        d = dct8(d);
+        for (var i = 0u; i < 8u; i++) {
+            units[unit][line * 8u + i] = d[i];
+        }
+    }
+    workgroupBarrier();
+    if (unit < count) {
+        var d: array<f32, 8>;
+        for (var i = 0u; i < 8u; i++) {
+            d[i] = units[unit][i * 8u + line];
+        }
+        d = dct8(d);
+        for (var i = 0u; i < 8u; i++) {
+            units[unit][i * 8u + line] = d[i];
+        }
+    }
+    workgroupBarrier();
+
+    let base = mcu * count * 32u;
+    for (var w = index; w < count * 32u; w += 64u) {
+        let b = w / 32u;
+        let table = select(0u, 64u, b + 2u >= count);
+        var q: array<i32, 2>;
+        for (var k = 0u; k < 2u; k++) {
+            let j = naturalOrder[(w % 32u) * 2u + k];
+            let v = units[b][j] * fdtbl[table + j];
+            // rounded half away from zero
+            q[k] = i32(select(v + 0.5, v - 0.5, v < 0.0));
+        }
+        coefs[base + w] = (bitcast<u32>(q[0]) & 0xffffu) | (bitcast<u32>(q[1]) << 16u);
+    }
+}
+
+// 16x16 MCU, 4:2:0: each invocation converts a 2x2 quad and averages its chroma
+@compute @workgroup_size(8, 8)
+fn mcu420(@builtin(workgroup_id) wg: vec3u, @builtin(num_workgroups) groups: vec3u,
+          @builtin(local_invocation_id) local: vec3u,
+          @builtin(local_invocation_index) index: u32) {
+    var u = 0.0;
+    var v = 0.0;
+    for (var k = 0u; k < 4u; k++) {
+        let q = local.xy * 2u + vec2u(k % 2u, k / 2u);
+        let c = yuv(wg.xy * 16u + q);
+        units[(q.y / 8u) * 2u + q.x / 8u][(q.y % 8u) * 8u + q.x % 8u] = c.x;
+        u += c.y;
+        v += c.z;
+    }
+    units[4][index] = u * 0.25;
+    units[5][index] = v * 0.25;
+    workgroupBarrier();
+    finish(index, wg.y * groups.x + wg.x, 6u);
+}
+
+// 8x8 MCU, 4:4:4: one pixel per invocation
+@compute @workgroup_size(8, 8)
+fn mcu444(@builtin(workgroup_id) wg: vec3u, @builtin(num_workgroups) groups: vec3u,
+          @builtin(local_invocation_id) local: vec3u,
+          @builtin(local_invocation_index) index: u32) {
+    let c = yuv(wg.xy * 8u + local.xy);
+    units[0][index] = c.x;
+    units[1][index] = c.y;
+    units[2][index] = c.z;
+    workgroupBarrier();
+    finish(index, wg.y * groups.x + wg.x, 3u);
+}
+)";
+
+struct GpuJpegEncoder {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    bool subsample = true;
+    wgpu::Buffer tableBuffer;
+    wgpu::Buffer coefficientBuffer;
+    wgpu::ComputePipeline pipeline;
+    wgpu::BindGroup bindGroup;
+
+    // `view` must be a non-sRGB view of an 8-bit RGBA/BGRA target with TextureBinding usage.
+    // `fdtbl` holds the Y and then the U/V divisors and `chromaSubsampled` the return value of
+    // stbi_write_jpg_quant_tables for the quality the coefficients will be written with.
+    void init(const wgpu::Device& device, const wgpu::TextureView& view, uint32_t frameWidth,
+              uint32_t frameHeight, const float fdtbl[128], bool chromaSubsampled) {
+        width = frameWidth;
+        height = frameHeight;
+        subsample = chromaSubsampled;
+
+        wgpu::BufferDescriptor tableDesc;
+        tableDesc.label = "JPEG quantization tables";
+        tableDesc.usage = wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopyDst;
+        tableDesc.size = 128 * sizeof(float);
+        tableBuffer = createTrackedBuffer(device, tableDesc);
+        device.GetQueue().WriteBuffer(tableBuffer, 0, fdtbl, tableDesc.size);
+
+        wgpu::BufferDescriptor coefficientDesc;
+        coefficientDesc.label = "JPEG coefficients";
+        coefficientDesc.usage = wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopySrc;
+        coefficientDesc.size = coefficientsSize();
+        coefficientBuffer = createTrackedBuffer(device, coefficientDesc);
+
+        wgpu::ComputePipelineDescriptor pipelineDesc{
+            .compute = {.module = createShaderModule(device, jpegShaderCode),
+                        .entryPoint = subsample ? "mcu420" : "mcu444"}};
+        pipeline = device.CreateComputePipeline(&pipelineDesc);
+
+        wgpu::BindGroupEntry entries[3] = {};
+        entries[0].binding = 0;
+        entries[0].textureView = view;
+        entries[1].binding = 1;
+        entries[1].buffer = tableBuffer;
+        entries[2].binding = 2;
+        entries[2].buffer = coefficientBuffer;
+        wgpu::BindGroupDescriptor bindGroupDesc{
+            .layout = pipeline.GetBindGroupLayout(0), .entryCount = 3, .entries = entries};
+        bindGroup = device.CreateBindGroup(&bindGroupDesc);
+    }
+
+    bool enabled() const {
+        return bool(pipeline);
+    }
+
+    uint32_t mcuSize() const {
+        return subsample ? 16 : 8;
+    }
+
+    uint32_t mcusX() const {
+        return (width + mcuSize() - 1) / mcuSize();
+    }
+
+    uint32_t mcusY() const {
+        return (height + mcuSize() - 1) / mcuSize();
+    }
+
+    // 64 int16 per data unit, six data units per MCU when subsampled, three otherwise.
+    uint64_t coefficientsSize() const {
+        return uint64_t(mcusX()) * mcusY() * (subsample ? 6 : 3) * 64 * sizeof(int16_t);
+    }
+
+    void encode(const wgpu::CommandEncoder& encoder, const wgpu::Buffer& readback) const {
+        wgpu::ComputePassEncoder pass = encoder.BeginComputePass();
+        pass.SetPipeline(pipeline);
+        pass.SetBindGroup(0, bindGroup);
+        pass.DispatchWorkgroups(mcusX(), mcusY());
+        pass.End();
+        encoder.CopyBufferToBuffer(coefficientBuffer, 0, readback, 0, coefficientsSize());
+    }
+};
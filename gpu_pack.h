@@ -0,0 +1,311 @@
+#pragma once
+
+#include <webgpu/webgpu_cpp.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "alloc_stats.h"
+#include "shader_module.h"
+
+// Layouts the render target can be converted to on the GPU before readback, so the copy and
+// map only move the bytes the consumer wants instead of width*height*4.
+enum class ReadbackLayout : uint32_t {
+    RGBA,   // texels as stored, no conversion pass
+    RGB24,  // tightly packed RGB, 3 bytes per pixel
+    I420,   // Y plane, then U and V planes at half resolution
+    NV12,   // Y plane, then interleaved UV plane at half resolution
+    R8,     // full-range luma only
+};
+
+// Every invocation produces whole u32 words (WGSL storage has no byte stores), covering four
+// consecutive bytes of its plane. Planes start at 4-byte aligned offsets. Y/U/V use BT.709
+// limited range, R8 BT.709 full-range luma.
+const char packShaderCode[] = R"(
+struct Params {
+    width: u32,
+    height: u32,
+    offset0: u32,  // first output word of the plane (U for the planar chroma pass)
+    offset1: u32,  // V plane for the planar chroma pass
+}
+
+@group(0) @binding(0) var src: texture_2d<f32>;
+@group(0) @binding(1) var<storage, read_write> dst: array<u32>;
+@group(0) @binding(2) var<uniform> params: Params;
+
+fn invocation(wg: vec3u, nwg: vec3u, local: u32) -> u32 {
+    return (wg.y * nwg.x + wg.x) * 64u + local;
+}
+
+// texel at linear pixel index p, clamped to the last pixel
+fn texel(p: u32) -> vec3f {
+    let count = params.width * params.height;
+    let q = min(p, count - 1u);
+    return textureLoad(src, vec2u(q % params.width, q / params.width), 0).rgb;
+}
+
+fn to8(v: f32) -> u32 {
+    return u32(clamp(v, 0.0, 1.0) * 255.0 + 0.5);
+}
+
+fn luma(c: vec3f) -> f32 {
+    return dot(c, vec3f(0.2126, 0.7152, 0.0722));
+}
+
+fn videoY(c: vec3f) -> u32 {
+    return u32(clamp(16.0 + 219.0 * luma(c), 0.0, 255.0) + 0.5);
+}
+
+fn videoUV(c: vec3f) -> vec2u {
+    let y = luma(c);
+    let u = 128.0 + 224.0 * (c.b - y) / 1.8556;
+    let v = 128.0 + 224.0 * (c.r - y) / 1.5748;
+    return vec2u(u32(clamp(u, 0.0, 255.0) + 0.5), u32(clamp(v, 0.0, 255.0) + 0.5));
+}
+
+// average of the 2x2 block behind chroma sample (cx, cy)
+fn chroma(cx: u32, cy: u32) -> vec3f {
+    let x0 = min(cx * 2u, params.width - 1u);
+    let y0 = min(cy * 2u, params.height - 1u);
+    let x1 = min(x0 + 1u, params.width - 1u);
+    let y1 = min(y0 + 1u, params.height - 1u);
+    return 0.25 * (textureLoad(src, vec2u(x0, y0), 0).rgb + textureLoad(src, vec2u(x1, y0), 0).rgb +
+                   textureLoad(src, vec2u(x0, y1), 0).rgb + textureLoad(src, vec2u(x1, y1), 0).rgb);
+}
+
+fn pack4(a: u32, b: u32, c: u32, d: u32) -> u32 {
+    return a | (b << 8u) | (c << 16u) | (d << 24u);
+}
+
+// 4 pixels -> 3 words. The plane holds only the words that contain pixel bytes, so when the
+// pixel count isn't a multiple of 4 the last invocation skips the words past its end.
+@compute @workgroup_size(64)
+fn pack_rgb24(@builtin(workgroup_id) wg: vec3u, @builtin(num_workgroups) nwg: vec3u,
+              @builtin(local_invocation_index) local: u32) {
+    let i = invocation(wg, nwg, local);
+    let pixels = params.width * params.height;
+    if (i * 4u >= pixels) {
+        return;
+    }
+    let words = (pixels * 3u + 3u) / 4u;
+    let p0 = texel(i * 4u);
+    let p1 = texel(i * 4u + 1u);
+    let p2 = texel(i * 4u + 2u);
+    let p3 = texel(i * 4u + 3u);
+    dst[params.offset0 + i * 3u] = pack4(to8(p0.r), to8(p0.g), to8(p0.b), to8(p1.r));
+    if (i * 3u + 1u < words) {
+        dst[params.offset0 + i * 3u + 1u] = pack4(to8(p1.g), to8(p1.b), to8(p2.r), to8(p2.g));
+    }
+    if (i * 3u + 2u < words) {
+        dst[params.offset0 + i * 3u + 2u] = pack4(to8(p2.b), to8(p3.r), to8(p3.g), to8(p3.b));
+    }
+}
+
+// 4 pixels -> 1 word of full-range luma
+@compute @workgroup_size(64)
+fn pack_gray(@builtin(workgroup_id) wg: vec3u, @builtin(num_workgroups) nwg: vec3u,
+             @builtin(local_invocation_index) local: u32) {
+    let i = invocation(wg, nwg, local);
+    if (i * 4u >= params.width * params.height) {
+        return;
+    }
+    dst[params.offset0 + i] = pack4(to8(luma(texel(i * 4u))), to8(luma(texel(i * 4u + 1u))),
+                                    to8(luma(texel(i * 4u + 2u))), to8(luma(texel(i * 4u + 3u))));
+}
+
+// 4 pixels -> 1 word of video-range Y
+@compute @workgroup_size(64)
+fn pack_y(@builtin(workgroup_id) wg: vec3u, @builtin(num_workgroups) nwg: vec3u,
+          @builtin(local_invocation_index) local: u32) {
+    let i = invocation(wg, nwg, local);
+    if (i * 4u >= params.width * params.height) {
+        return;
+    }
+    dst[params.offset0 + i] = pack4(videoY(texel(i * 4u)), videoY(texel(i * 4u + 1u)),
+                                    videoY(texel(i * 4u + 2u)), videoY(texel(i * 4u + 3u)));
+}
+
+fn chromaAt(c: u32) -> vec2u {
+    let cw = (params.width + 1u) / 2u;
+    let ch = (params.height + 1u) / 2u;
+    let q = min(c, cw * ch - 1u);
+    return videoUV(chroma(q % cw, q / cw));
+}
+
+// 4 chroma samples -> 1 word of U and 1 word of V
+@compute @workgroup_size(64)
+fn pack_uv_planar(@builtin(workgroup_id) wg: vec3u, @builtin(num_workgroups) nwg: vec3u,
+                  @builtin(local_invocation_index) local: u32) {
+    let i = invocation(wg, nwg, local);
+    if (i * 4u >= ((params.width + 1u) / 2u) * ((params.height + 1u) / 2u)) {
+        return;
+    }
+    let c0 = chromaAt(i * 4u);
+    let c1 = chromaAt(i * 4u + 1u);
+    let c2 = chromaAt(i * 4u + 2u);
+    let c3 = chromaAt(i * 4u + 3u);
+    dst[params.offset0 + i] = pack4(c0.x, c1.x, c2.x, c3.x);
+    dst[params.offset1 + i] = pack4(c0.y, c1.y, c2.y, c3.y);
+}
+
+// 2 chroma samples -> 1 word of UVUV
+@compute @workgroup_size(64)
+fn pack_uv_interleaved(@builtin(workgroup_id) wg: vec3u, @builtin(num_workgroups) nwg: vec3u,
+                       @builtin(local_invocation_index) local: u32) {
+    let i = invocation(wg, nwg, local);
+    if (i * 2u >= ((params.width + 1u) / 2u) * ((params.height + 1u) / 2u)) {
+        return;
+    }
+    let c0 = chromaAt(i * 2u);
+    let c1 = chromaAt(i * 2u + 1u);
+    dst[params.offset0 + i] = pack4(c0.x, c0.y, c1.x, c1.y);
+}
+)";
+
+// Byte sizes and offsets of the planes of `layout` for a width x height image.
+struct PackedPlanes {
+    uint64_t offset[3] = {};
+    uint64_t size[3] = {};
+    uint32_t count = 0;
+    uint64_t totalSize = 0;
+};
+
+inline PackedPlanes packedPlanes(ReadbackLayout layout, uint32_t width, uint32_t height) {
+    auto align4 = [](uint64_t v) { return (v + 3) & ~uint64_t(3); };
+    uint64_t pixels = uint64_t(width) * height;
+    uint64_t chroma = uint64_t((width + 1) / 2) * ((height + 1) / 2);
+    PackedPlanes planes;
+    switch (layout) {
+        case ReadbackLayout::RGBA:
+            planes.size[0] = pixels * 4;
+            planes.count = 1;
+            break;
+        case ReadbackLayout::RGB24:
+            planes.size[0] = pixels * 3;
+            planes.count = 1;
+            break;
+        case ReadbackLayout::R8:
+            planes.size[0] = pixels;
+            planes.count = 1;
+            break;
+        case ReadbackLayout::I420:
+            planes.size[0] = pixels;
+            planes.size[1] = planes.size[2] = chroma;
+            planes.count = 3;
+            break;
+        case ReadbackLayout::NV12:
+            planes.size[0] = pixels;
+            planes.size[1] = chroma * 2;
+            planes.count = 2;
+            break;
+    }
+    uint64_t offset = 0;
+    for (uint32_t i = 0; i < planes.count; ++i) {
+        planes.offset[i] = offset;
+        offset = align4(offset + planes.size[i]);
+    }
+    planes.totalSize = offset;
+    return planes;
+}
+
+// Converts the render target into a packed storage buffer with compute passes. encode() records
+// the conversion plus the copy of the packed bytes into the readback buffer.
+struct GpuPacker {
+    struct Dispatch {
+        wgpu::ComputePipeline pipeline;
+        wgpu::BindGroup bindGroup;
+        uint32_t groupsX;
+        uint32_t groupsY;
+    };
+
+    ReadbackLayout layout = ReadbackLayout::RGBA;
+    PackedPlanes planes;
+    wgpu::Buffer packedBuffer;
+    std::vector<Dispatch> dispatches;
+
+    // `view` must be a non-sRGB view of the target so the shader sees the stored bytes.
+    void init(const wgpu::Device& device, const wgpu::TextureView& view, uint32_t width,
+              uint32_t height, ReadbackLayout packLayout) {
+        layout = packLayout;
+        planes = packedPlanes(layout, width, height);
+        dispatches.clear();
+        if (layout == ReadbackLayout::RGBA) {
+            return;
+        }
+
+        wgpu::ShaderModule module = createShaderModule(device, packShaderCode);
+
+        wgpu::BufferDescriptor packedDesc;
+        packedDesc.label = "Packed readback";
+        packedDesc.usage = wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopySrc;
+        packedDesc.size = planes.totalSize;
+        packedBuffer = createTrackedBuffer(device, packedDesc);
+
+        uint64_t pixels = uint64_t(width) * height;
+        uint64_t chroma = uint64_t((width + 1) / 2) * ((height + 1) / 2);
+        auto add = [&](const char* entryPoint, uint64_t invocations, uint64_t offset0,
+                       uint64_t offset1) {
+            wgpu::ComputePipelineDescriptor pipelineDesc{
+                .compute = {.module = module, .entryPoint = entryPoint}};
+            wgpu::ComputePipeline pipeline = device.CreateComputePipeline(&pipelineDesc);
+
+            uint32_t params[4] = {width, height, uint32_t(offset0 / 4), uint32_t(offset1 / 4)};
+            wgpu::BufferDescriptor paramsDesc;
+            paramsDesc.usage = wgpu::BufferUsage::Uniform | wgpu::BufferUsage::CopyDst;
+            paramsDesc.size = sizeof(params);
+            wgpu::Buffer paramsBuffer = createTrackedBuffer(device, paramsDesc);
+            device.GetQueue().WriteBuffer(paramsBuffer, 0, params, sizeof(params));
+
+            wgpu::BindGroupEntry entries[3] = {};
+            entries[0].binding = 0;
+            entries[0].textureView = view;
+            entries[1].binding = 1;
+            entries[1].buffer = packedBuffer;
+            entries[2].binding = 2;
+            entries[2].buffer = paramsBuffer;
+            wgpu::BindGroupDescriptor bindGroupDesc{
+                .layout = pipeline.GetBindGroupLayout(0), .entryCount = 3, .entries = entries};
+
+            // 64 invocations per group; spill into Y past the 65535 groups-per-dimension limit
+            uint64_t groups = (invocations + 63) / 64;
+            uint32_t groupsX = uint32_t(std::min<uint64_t>(groups, 65535));
+            uint32_t groupsY = uint32_t((groups + groupsX - 1) / groupsX);
+            dispatches.push_back(
+                {pipeline, device.CreateBindGroup(&bindGroupDesc), groupsX, groupsY});
+        };
+
+        switch (layout) {
+            case ReadbackLayout::RGB24:
+                add("pack_rgb24", (pixels + 3) / 4, planes.offset[0], 0);
+                break;
+            case ReadbackLayout::R8:
+                add("pack_gray", (pixels + 3) / 4, planes.offset[0], 0);
+                break;
+            case ReadbackLayout::I420:
+                add("pack_y", (pixels + 3) / 4, planes.offset[0], 0);
+                add("pack_uv_planar", (chroma + 3) / 4, planes.offset[1], planes.offset[2]);
+                break;
+            case ReadbackLayout::NV12:
+                add("pack_y", (pixels + 3) / 4, planes.offset[0], 0);
+                add("pack_uv_interleaved", (chroma + 1) / 2, planes.offset[1], 0);
+                break;
+            case ReadbackLayout::RGBA:
+                break;
+        }
+    }
+
+    bool enabled() const {
+        return layout != ReadbackLayout::RGBA;
+    }
+
+    void encode(const wgpu::CommandEncoder& encoder, const wgpu::Buffer& readback) const {
+        wgpu::ComputePassEncoder pass = encoder.BeginComputePass();
+        for (const Dispatch& dispatch : dispatches) {
+            pass.SetPipeline(dispatch.pipeline);
+            pass.SetBindGroup(0, dispatch.bindGroup);
+            pass.DispatchWorkgroups(dispatch.groupsX, dispatch.groupsY);
+        }
+        pass.End();
+        encoder.CopyBufferToBuffer(packedBuffer, 0, readback, 0, planes.totalSize);
+    }
+};
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <webgpu/webgpu_cpp.h>
+
+#include <cstdint>
+
+#include "alloc_stats.h"
+#include "shader_module.h"
+
+// PNG scanline filtering on the GPU. One workgroup per row tries the five PNG filters, keeps
+// the one with the lowest sum of absolute (signed) filtered bytes, which is the heuristic
+// stbi_write_png uses, and writes the row as it goes into the zlib stream: the filter type
+// byte followed by the filtered RGBA bytes, rows back to back. The readback can be handed
+// straight to stbi_write_png_filtered_to_func, which only deflates it, and produces the same
+// file as stbi_write_png on the unfiltered frame.
+//
+// Rows are 4 * width + 1 bytes, so neighbouring rows share a storage word; those boundary
+// words are OR-ed in by both rows into a buffer cleared beforehand.
+
+const char pngFilterShaderCode[] = R"(
+@group(0) @binding(0) var src: texture_2d<f32>;
+@group(0) @binding(1) var<storage, read_write> dst: array<atomic<u32>>;
+
+var<workgroup> sad: array<atomic<u32>, 5>;
+
+// 8-bit texel; zero left of and above the image, as PNG filters expect
+fn pixel(x: i32, y: i32) -> vec4i {
+    let size = vec2i(textureDimensions(src));
+    if (x < 0 || y < 0 || x >= size.x || y >= size.y) {
+        return vec4i(0);
+    }
+    let v = clamp(textureLoad(src, vec2i(x, y), 0), vec4f(0.0), vec4f(1.0));
+    return vec4i(round(v * 255.0));
+}
+
+fn paeth(a: vec4i, b: vec4i, c: vec4i) -> vec4i {
+    let p = a + b - c;
+    let pa = abs(p - a);
+    let pb = abs(p - b);
+    let pc = abs(p - c);
+    return select(select(c, b, pb <= pc), a, (pa <= pb) & (pa <= pc));
+}
+
+fn filtered(x: i32, y: i32, f: u32) -> vec4u {
+    let cur = pixel(x, y);
+    let a = pixel(x - 1, y);
+    let b = pixel(x, y - 1);
+    let c = pixel(x - 1, y - 1);
+    var v = cur;
+    switch f {
+        case 1u: {
+            v = cur - a;
+        }
+        case 2u: {
+            v = cur - b;
+        }
+        case 3u: {
+            v = cur - ((a + b) >> vec4u(1u));
+        }
+        case 4u: {
+            v = cur - paeth(a, b, c);
+        }
+        default: {
+        }
+    }
+    return vec4u(v & vec4i(255));
+}
+
+// |(signed char) byte| summed over the pixel
+fn cost(v: vec4i) -> u32 {
+    let b = v & vec4i(255);
+    let s = select(b, 256 - b, b >= vec4i(128));
+    return u32(s.x + s.y + s.z + s.w);
+}
+
+@compute @workgroup_size(256)
+fn main(@builtin(workgroup_id) wg: vec3u, @builtin(local_invocation_index) local: u32) {
+    let width = i32(textureDimensions(src).x);
+    let y = i32(wg.x);
+
+    var sums = array<u32, 5>(0u, 0u, 0u, 0u, 0u);
+    for (var x = i32(local); x < width; x += 256) {
+        let cur = pixel(x, y);
+        let a = pixel(x - 1, y);
+        let b = pixel(x, y - 1);
+        let c = pixel(x - 1, y - 1);
+        sums[0] += cost(cur);
+        sums[1] += cost(cur - a);
+        sums[2] += cost(cur - b);
+        sums[3] += cost(cur - ((a + b) >> vec4u(1u)));
+        sums[4] += cost(cur - paeth(a, b, c));
+    }
+    for (var k = 0u; k < 5u; k++) {
+        atomicAdd(&sad[k], sums[k]);
+    }
+    workgroupBarrier();
+    // lowest cost, first filter on ties
+    var best = 0u;
+    var bestCost = atomicLoad(&sad[0]);
+    for (var k = 1u; k < 5u; k++) {
+        let s = atomicLoad(&sad[k]);
+        if (s < bestCost) {
+            best = k;
+            bestCost = s;
+        }
+    }
+
+    let rowBytes = u32(width) * 4u + 1u;
+    let start = u32(y) * rowBytes;
+    let end = start + rowBytes;
+    let firstWord = start / 4u;
+    let lastWord = (end - 1u) / 4u;
+    for (var k = firstWord + local; k <= lastWord; k += 256u) {
+        // row data index of the word's first byte, -1 being the filter type byte; the word
+        // spans pixels p0 and p0 + 1
+        let base = i32(k * 4u) - i32(start) - 1;
+        let p0 = (base + 4) / 4 - 1;
+        let f0 = filtered(p0, y, best);
+        let f1 = filtered(p0 + 1, y, best);
+        var word = 0u;
+        for (var t = 0; t < 4; t++) {
+            let d = base + t;
+            var value = 0u;
+            if (d == -1) {
+                value = best;
+            } else if (d >= 0 && d < width * 4) {
+                let f = select(f1, f0, d / 4 == p0);
+                value = f[d % 4];
+            }
+            word |= value << (8u * u32(t));
+        }
+        let straddles = (k == firstWord && start % 4u != 0u) || (k == lastWord && end % 4u != 0u);
+        if (straddles) {
+            atomicOr(&dst[k], word);
+        } else {
+            atomicStore(&dst[k], word);
+        }
+    }
+}
+)";
+
+struct GpuPngFilter {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    wgpu::Buffer filteredBuffer;
+    wgpu::ComputePipeline pipeline;
+    wgpu::BindGroup bindGroup;
+
+    // `view` must be a non-sRGB view of an 8-bit RGBA/BGRA target with TextureBinding usage.
+    void init(const wgpu::Device& device, const wgpu::TextureView& view, uint32_t frameWidth,
+              uint32_t frameHeight) {
+        width = frameWidth;
+        height = frameHeight;
+
+        wgpu::BufferDescriptor filteredDesc;
+        filteredDesc.label = "PNG filtered rows";
+        filteredDesc.usage = wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopySrc |
+                             wgpu::BufferUsage::CopyDst;
+        filteredDesc.size = bufferSize();
+        filteredBuffer = createTrackedBuffer(device, filteredDesc);
+
+        wgpu::ComputePipelineDescriptor pipelineDesc{
+            .compute = {.module = createShaderModule(device, pngFilterShaderCode),
+                        .entryPoint = "main"}};
+        pipeline = device.CreateComputePipeline(&pipelineDesc);
+
+        wgpu::BindGroupEntry entries[2] = {};
+        entries[0].binding = 0;
+        entries[0].textureView = view;
+        entries[1].binding = 1;
+        entries[1].buffer = filteredBuffer;
+        wgpu::BindGroupDescriptor bindGroupDesc{
+            .layout = pipeline.GetBindGroupLayout(0), .entryCount = 2, .entries = entries};
+        bindGroup = device.CreateBindGroup(&bindGroupDesc);
+    }
+
+    bool enabled() const {
+        return bool(pipeline);
+    }
+
+    // Filter byte plus RGBA row, without padding.
+    uint64_t filteredSize() const {
+        return (uint64_t(width) * 4 + 1) * height;
+    }
+
+    // Rounded up to whole storage words, the size of the readback buffer.
+    uint64_t bufferSize() const {
+        return (filteredSize() + 3) & ~uint64_t(3);
+    }
+
+    void encode(const wgpu::CommandEncoder& encoder, const wgpu::Buffer& readback) const {
+        encoder.ClearBuffer(filteredBuffer, 0, bufferSize());
+        wgpu::ComputePassEncoder pass = encoder.BeginComputePass();
+        pass.SetPipeline(pipeline);
+        pass.SetBindGroup(0, bindGroup);
+        pass.DispatchWorkgroups(height);
+        pass.End();
+        encoder.CopyBufferToBuffer(filteredBuffer, 0, readback, 0, bufferSize());
+    }
+};
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <webgpu/webgpu_cpp.h>
+
+#include <chrono>
+#include <cstdint>
+
+#include "alloc_stats.h"
+
+// GPU-side durations of a frame's render pass and readback from timestamp queries (device
+// feature TimestampQuery). The render pass writes timestamps 0 and 1; the readback commands
+// are bracketed by empty compute passes writing 2 and 3. All four are resolved and copied
+// behind the frame in its readback buffer, so they are mapped together with it. Timestamps are
+// in nanoseconds; Dawn quantizes them unless the timestamp_quantization toggle is disabled.
+
+constexpr uint32_t kGpuTimestampCount = 4;
+
+struct GpuFrameTimer {
+    wgpu::QuerySet querySet;
+    wgpu::Buffer resolveBuffer;
+    // where the timestamps start in each readback buffer
+    uint64_t readbackOffset = 0;
+
+    // `frameBytes` is the size of the frame data in the readback buffers.
+    void init(const wgpu::Device& device, uint64_t frameBytes) {
+        wgpu::QuerySetDescriptor querySetDesc;
+        querySetDesc.label = "Frame timestamps";
+        querySetDesc.type = wgpu::QueryType::Timestamp;
+        querySetDesc.count = kGpuTimestampCount;
+        querySet = device.CreateQuerySet(&querySetDesc);
+
+        wgpu::BufferDescriptor resolveDesc;
+        resolveDesc.label = "Frame timestamps resolve";
+        resolveDesc.usage = wgpu::BufferUsage::QueryResolve | wgpu::BufferUsage::CopySrc;
+        resolveDesc.size = kGpuTimestampCount * sizeof(uint64_t);
+        resolveBuffer = createTrackedBuffer(device, resolveDesc);
+
+        readbackOffset = (frameBytes + 255) & ~uint64_t(255);
+    }
+
+    bool enabled() const {
+        return bool(querySet);
+    }
+
+    // Readback buffer size with the timestamps behind the frame.
+    uint64_t readbackSize() const {
+        return readbackOffset + kGpuTimestampCount * sizeof(uint64_t);
+    }
+
+    // For RenderPassDescriptor::timestampWrites.
+    wgpu::RenderPassTimestampWrites renderPassWrites() const {
+        return {.querySet = querySet, .beginningOfPassWriteIndex = 0, .endOfPassWriteIndex = 1};
+    }
+
+    // Before the readback commands.
+    void encodeBegin(const wgpu::CommandEncoder& encoder) const {
+        wgpu::ComputePassTimestampWrites writes{.querySet = querySet,
+                                                .beginningOfPassWriteIndex = 2};
+        wgpu::ComputePassDescriptor passDesc{.timestampWrites = &writes};
+        encoder.BeginComputePass(&passDesc).End();
+    }
+
+    // After the readback commands: resolves all four timestamps into `readback`.
+    void encodeEnd(const wgpu::CommandEncoder& encoder, const wgpu::Buffer& readback) const {
+        wgpu::ComputePassTimestampWrites writes{.querySet = querySet, .endOfPassWriteIndex = 3};
+        wgpu::ComputePassDescriptor passDesc{.timestampWrites = &writes};
+        encoder.BeginComputePass(&passDesc).End();
+        encoder.ResolveQuerySet(querySet, 0, kGpuTimestampCount, resolveBuffer, 0);
+        encoder.CopyBufferToBuffer(resolveBuffer, 0, readback, readbackOffset,
+                                   kGpuTimestampCount * sizeof(uint64_t));
+    }
+
+    // Render pass and readback durations from the mapped timestamps; zero where the clock
+    // went backwards (e.g. across a GPU power state change).
+    static void durations(const uint64_t timestamps[kGpuTimestampCount],
+                          std::chrono::nanoseconds& render, std::chrono::nanoseconds& readback) {
+        auto between = [](uint64_t begin, uint64_t end) {
+            return std::chrono::nanoseconds(end > begin ? int64_t(end - begin) : 0);
+        };
+        render = between(timestamps[0], timestamps[1]);
+        readback = between(timestamps[2], timestamps[3]);
+    }
+};
@@ -0,0 +1,329 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Deterministic synthetic images for encoder benchmarks, so numbers compare across machines
+// and commits. Everything is driven by a fixed-seed integer PRNG and integer arithmetic (the
+// only floating point is the sRGB curve of the rendered scenes), never by std::
+// distributions, whose output differs between standard libraries.
+
+enum class CorpusImage : uint32_t {
+    Flat,          // one color
+    Gradient,      // smooth ramps
+    UiText,        // panels, buttons and lines of glyph-like text
+    PhotoNoise,    // multi-octave value noise plus a little sensor noise
+    Checkerboard,  // 1-pixel checker, worst case for prediction
+    Triangle,      // what the app's WGSL pipeline renders into an sRGB target
+    Scene,         // many overlapping shaded triangles over a sky gradient
+};
+
+constexpr CorpusImage kCorpusImages[] = {
+    CorpusImage::Flat,         CorpusImage::Gradient, CorpusImage::UiText, CorpusImage::PhotoNoise,
+    CorpusImage::Checkerboard, CorpusImage::Triangle, CorpusImage::Scene};
+
+inline const char* corpusImageName(CorpusImage image) {
+    switch (image) {
+        case CorpusImage::Flat:
+            return "flat";
+        case CorpusImage::Gradient:
+            return "gradient";
+        case CorpusImage::UiText:
+            return "ui_text";
+        case CorpusImage::PhotoNoise:
+            return "photo_noise";
+        case CorpusImage::Checkerboard:
+            return "checkerboard";
+        case CorpusImage::Triangle:
+            return "triangle";
+        case CorpusImage::Scene:
+            return "scene";
+    }
+    return "";
+}
+
+// xorshift32 with a splitmix-style seed scramble
+struct CorpusRng {
+    uint32_t state;
+
+    explicit CorpusRng(uint32_t seed) {
+        uint32_t z = seed + 0x9e3779b9u;
+        z = (z ^ (z >> 16)) * 0x85ebca6bu;
+        z = (z ^ (z >> 13)) * 0xc2b2ae35u;
+        state = (z ^ (z >> 16)) | 1u;
+    }
+
+    uint32_t next() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    // [0, n)
+    uint32_t below(uint32_t n) {
+        return uint32_t((uint64_t(next()) * n) >> 32);
+    }
+};
+
+namespace corpus_detail {
+
+using Rgba = std::vector<uint8_t>;
+
+inline void fillRect(Rgba& image, int width, int height, int x0, int y0, int x1, int y1,
+                     const uint8_t color[4]) {
+    x0 = std::max(x0, 0);
+    y0 = std::max(y0, 0);
+    x1 = std::min(x1, width);
+    y1 = std::min(y1, height);
+    for (int y = y0; y < y1; ++y) {
+        for (int x = x0; x < x1; ++x) {
+            memcpy(&image[(size_t(y) * width + x) * 4], color, 4);
+        }
+    }
+}
+
+inline uint8_t srgbEncode(float linear) {
+    linear = std::clamp(linear, 0.0f, 1.0f);
+    float v = linear <= 0.0031308f ? linear * 12.92f : 1.055f * std::pow(linear, 1 / 2.4f) - 0.055f;
+    return uint8_t(v * 255.0f + 0.5f);
+}
+
+struct Vertex {
+    int64_t x;  // 1/16 pixel
+    int64_t y;
+    float color[3];  // linear
+};
+
+// Rasterizes with pixel centers and a top-left-agnostic inclusive edge test, interpolating
+// linear color and encoding it to sRGB like a render into an *Srgb target.
+inline void drawTriangle(Rgba& image, int width, int height, Vertex a, Vertex b, Vertex c) {
+    auto edge = [](const Vertex& p, const Vertex& q, int64_t x, int64_t y) {
+        return (q.x - p.x) * (y - p.y) - (q.y - p.y) * (x - p.x);
+    };
+    int64_t area = edge(a, b, c.x, c.y);
+    if (area == 0) {
+        return;
+    }
+    if (area < 0) {
+        std::swap(b, c);
+        area = -area;
+    }
+    int x0 = std::max<int64_t>(0, std::min({a.x, b.x, c.x}) / 16);
+    int x1 = std::min<int64_t>(width - 1, std::max({a.x, b.x, c.x}) / 16 + 1);
+    int y0 = std::max<int64_t>(0, std::min({a.y, b.y, c.y}) / 16);
+    int y1 = std::min<int64_t>(height - 1, std::max({a.y, b.y, c.y}) / 16 + 1);
+    for (int y = y0; y <= y1; ++y) {
+        for (int x = x0; x <= x1; ++x) {
+            int64_t px = x * 16 + 8;
+            int64_t py = y * 16 + 8;
+            int64_t w0 = edge(b, c, px, py);
+            int64_t w1 = edge(c, a, px, py);
+            int64_t w2 = edge(a, b, px, py);
+            if (w0 < 0 || w1 < 0 || w2 < 0) {
+                continue;
+            }
+            uint8_t* p = &image[(size_t(y) * width + x) * 4];
+            for (int k = 0; k < 3; ++k) {
+                float v = (a.color[k] * float(w0) + b.color[k] * float(w1) +
+                           c.color[k] * float(w2)) / float(area);
+                p[k] = srgbEncode(v);
+            }
+            p[3] = 255;
+        }
+    }
+}
+
+// WGSL clip space (y up) to 1/16 pixel
+inline Vertex clipVertex(float x, float y, int width, int height, float r, float g, float b) {
+    return {int64_t(std::lround((x * 0.5f + 0.5f) * width * 16)),
+            int64_t(std::lround((0.5f - y * 0.5f) * height * 16)),
+            {r, g, b}};
+}
+
+// bilinear interpolation of a random lattice with `cell` pixel spacing, 0..255
+inline int valueNoise(const std::vector<uint8_t>& lattice, int latticeWidth, int x, int y,
+                      int cell) {
+    int cx = x / cell;
+    int cy = y / cell;
+    int fx = (x % cell) * 256 / cell;
+    int fy = (y % cell) * 256 / cell;
+    auto at = [&](int i, int j) { return int(lattice[size_t(j) * latticeWidth + i]); };
+    int top = at(cx, cy) * (256 - fx) + at(cx + 1, cy) * fx;
+    int bottom = at(cx, cy + 1) * (256 - fx) + at(cx + 1, cy + 1) * fx;
+    return (top * (256 - fy) + bottom * fy) >> 16;
+}
+
+inline Rgba generateRgba(CorpusImage kind, int width, int height, uint32_t seed) {
+    Rgba image(size_t(width) * height * 4, 255);
+    CorpusRng rng(seed);
+    switch (kind) {
+        case CorpusImage::Flat: {
+            uint8_t color[4] = {uint8_t(rng.below(256)), uint8_t(rng.below(256)),
+                                uint8_t(rng.below(256)), 255};
+            fillRect(image, width, height, 0, 0, width, height, color);
+            break;
+        }
+        case CorpusImage::Gradient: {
+            int phase = int(rng.below(256));
+            for (int y = 0; y < height; ++y) {
+                for (int x = 0; x < width; ++x) {
+                    uint8_t* p = &image[(size_t(y) * width + x) * 4];
+                    p[0] = uint8_t(x * 255 / std::max(1, width - 1));
+                    p[1] = uint8_t(y * 255 / std::max(1, height - 1));
+                    p[2] = uint8_t((x + y + phase) * 255 / (width + height + 255));
+                }
+            }
+            break;
+        }
+        case CorpusImage::UiText: {
+            const uint8_t background[4] = {240, 240, 242, 255};
+            const uint8_t panel[4] = {255, 255, 255, 255};
+            const uint8_t border[4] = {200, 200, 205, 255};
+            const uint8_t accent[4] = {40, 110, 220, 255};
+            const uint8_t ink[4] = {30, 30, 35, 255};
+            fillRect(image, width, height, 0, 0, width, height, background);
+            // glyph-like 5x7 bitmaps, one per "letter"
+            uint64_t glyphs[32];
+            for (uint64_t& glyph : glyphs) {
+                glyph = (uint64_t(rng.next()) << 32 | rng.next()) & ((1ull << 35) - 1);
+            }
+            int panels = std::max(1, width * height / (320 * 240));
+            for (int i = 0; i < panels; ++i) {
+                int pw = 120 + int(rng.below(200));
+                int ph = 60 + int(rng.below(160));
+                int px = int(rng.below(uint32_t(std::max(1, width - pw))));
+                int py = int(rng.below(uint32_t(std::max(1, height - ph))));
+                fillRect(image, width, height, px, py, px + pw, py + ph, border);
+                fillRect(image, width, height, px + 1, py + 1, px + pw - 1, py + ph - 1, panel);
+                fillRect(image, width, height, px + 8, py + ph - 24, px + 72, py + ph - 8,
+                         accent);
+                for (int line = py + 8; line + 7 < py + ph - 28; line += 10) {
+                    int length = int(rng.below(uint32_t(std::max(1, (pw - 16) / 6))));
+                    for (int ch = 0; ch < length; ++ch) {
+                        uint32_t letter = rng.below(40);
+                        if (letter >= 32) {
+                            continue;  // space
+                        }
+                        for (int bit = 0; bit < 35; ++bit) {
+                            if (glyphs[letter] >> bit & 1) {
+                                int gx = px + 8 + ch * 6 + bit % 5;
+                                int gy = line + bit / 5;
+                                fillRect(image, width, height, gx, gy, gx + 1, gy + 1, ink);
+                            }
+                        }
+                    }
+                }
+            }
+            break;
+        }
+        case CorpusImage::PhotoNoise: {
+            // three octaves of value noise per channel plus +-3 of per-pixel noise
+            const int cells[3] = {128, 32, 8};
+            const int weights[3] = {5, 2, 1};
+            std::vector<int> sum(size_t(width) * height * 3, 0);
+            for (int octave = 0; octave < 3; ++octave) {
+                int lw = width / cells[octave] + 2;
+                int lh = height / cells[octave] + 2;
+                for (int k = 0; k < 3; ++k) {
+                    std::vector<uint8_t> lattice(size_t(lw) * lh);
+                    for (uint8_t& v : lattice) {
+                        v = uint8_t(rng.below(256));
+                    }
+                    for (int y = 0; y < height; ++y) {
+                        for (int x = 0; x < width; ++x) {
+                            sum[(size_t(y) * width + x) * 3 + k] +=
+                                valueNoise(lattice, lw, x, y, cells[octave]) * weights[octave];
+                        }
+                    }
+                }
+            }
+            for (size_t i = 0; i < size_t(width) * height; ++i) {
+                for (int k = 0; k < 3; ++k) {
+                    int v = sum[i * 3 + k] / 8 + int(rng.below(7)) - 3;
+                    image[i * 4 + k] = uint8_t(std::clamp(v, 0, 255));
+                }
+            }
+            break;
+        }
+        case CorpusImage::Checkerboard: {
+            uint8_t colors[2][4];
+            for (auto& color : colors) {
+                color[0] = uint8_t(rng.below(256));
+                color[1] = uint8_t(rng.below(256));
+                color[2] = uint8_t(rng.below(256));
+                color[3] = 255;
+            }
+            for (int y = 0; y < height; ++y) {
+                for (int x = 0; x < width; ++x) {
+                    memcpy(&image[(size_t(y) * width + x) * 4], colors[(x ^ y) & 1], 4);
+                }
+            }
+            break;
+        }
+        case CorpusImage::Triangle: {
+            // clear to 0.5 linear gray, then the vertex colors of the app's shader
+            uint8_t gray = srgbEncode(0.5f);
+            uint8_t clear[4] = {gray, gray, gray, 255};
+            fillRect(image, width, height, 0, 0, width, height, clear);
+            drawTriangle(image, width, height, clipVertex(-0.5f, -0.5f, width, height, 1, 0, 0),
+                         clipVertex(0.5f, -0.5f, width, height, 0, 1, 0),
+                         clipVertex(0.0f, 0.5f, width, height, 0, 0, 1));
+            break;
+        }
+        case CorpusImage::Scene: {
+            for (int y = 0; y < height; ++y) {
+                float t = float(y) / float(std::max(1, height - 1));
+                uint8_t sky[4] = {srgbEncode(0.2f + 0.3f * t), srgbEncode(0.35f + 0.3f * t),
+                                  srgbEncode(0.8f - 0.2f * t), 255};
+                fillRect(image, width, height, 0, y, width, y + 1, sky);
+            }
+            auto unit = [&rng] { return float(rng.below(65536)) / 65535.0f; };
+            for (int i = 0; i < 64; ++i) {
+                float cx = unit() * 2 - 1;
+                float cy = unit() * 2 - 1;
+                float size = 0.05f + 0.4f * unit();
+                Vertex v[3];
+                for (Vertex& vertex : v) {
+                    float shade = 0.2f + 0.8f * unit();
+                    vertex = clipVertex(cx + (unit() * 2 - 1) * size, cy + (unit() * 2 - 1) * size,
+                                        width, height, shade * unit(), shade * unit(),
+                                        shade * unit());
+                }
+                drawTriangle(image, width, height, v[0], v[1], v[2]);
+            }
+            break;
+        }
+    }
+    return image;
+}
+
+}  // namespace corpus_detail
+
+// `kind` at width x height with 1 (luma), 2 (luma, alpha), 3 (RGB) or 4 (RGBA) channels;
+// the same arguments always give the same bytes.
+inline std::vector<uint8_t> generateCorpusImage(CorpusImage kind, int width, int height,
+                                                int channels, uint32_t seed = 1) {
+    std::vector<uint8_t> rgba = corpus_detail::generateRgba(kind, width, height, seed);
+    if (channels == 4) {
+        return rgba;
+    }
+    size_t pixels = size_t(width) * height;
+    std::vector<uint8_t> image(pixels * channels);
+    for (size_t i = 0; i < pixels; ++i) {
+        const uint8_t* p = &rgba[i * 4];
+        if (channels >= 3) {
+            memcpy(&image[i * channels], p, size_t(channels));
+        } else {
+            // BT.601 luma in integers
+            image[i * channels] = uint8_t((p[0] * 77 + p[1] * 150 + p[2] * 29 + 128) >> 8);
+            if (channels == 2) {
+                image[i * channels + 1] = p[3];
+            }
+        }
+    }
+    return image;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "frame_sink.h"
+
+// Minimal KTX2 container writer for block-compressed 2D textures: one layer, one face, any
+// number of mip levels, no supercompression and no key/value data. The data format descriptor
+// is the basic block the spec requires for the format.
+
+struct Ktx2Format {
+    uint32_t vkFormat;
+    uint8_t colorModel;  // KHR_DF_MODEL_*
+    uint8_t blockBytes;
+    bool srgb;
+};
+
+inline Ktx2Format ktx2Bc1Format(bool srgb) {
+    // VK_FORMAT_BC1_RGB_{UNORM,SRGB}_BLOCK, KHR_DF_MODEL_BC1A
+    return {srgb ? 132u : 131u, 128, 8, srgb};
+}
+
+inline Ktx2Format ktx2Bc7Format(bool srgb) {
+    // VK_FORMAT_BC7_{UNORM,SRGB}_BLOCK, KHR_DF_MODEL_BC7
+    return {srgb ? 146u : 145u, 135, 16, srgb};
+}
+
+// One mip level: its compressed blocks in raster order, level 0 being the largest.
+struct Ktx2Level {
+    const void* data;
+    uint64_t size;
+};
+
+// Writes the whole file between the caller's sink->begin() and sink->end().
+inline void writeKtx2(FrameSink& sink, const Ktx2Format& format, uint32_t width,
+                      uint32_t height, const std::vector<Ktx2Level>& levels) {
+    static const uint8_t identifier[12] = {0xAB, 'K',  'T',  'X',  ' ',  '2',
+                                           '0',  0xBB, 0x0D, 0x0A, 0x1A, 0x0A};
+    const uint32_t levelCount = uint32_t(levels.size());
+    const uint32_t headerBytes = 80;
+    const uint32_t levelIndexBytes = 24 * levelCount;
+    const uint32_t dfdBytes = 4 + 24 + 16;  // total size, basic block, one sample
+
+    // level data is aligned to lcm(block size, 4) and stored smallest level first
+    std::vector<uint64_t> offsets(levelCount);
+    uint64_t end = headerBytes + levelIndexBytes + dfdBytes;
+    for (uint32_t i = levelCount; i-- > 0;) {
+        end = (end + format.blockBytes - 1) / format.blockBytes * format.blockBytes;
+        offsets[i] = end;
+        end += levels[i].size;
+    }
+
+    std::vector<uint8_t> head;
+    auto put32 = [&head](uint32_t v) {
+        for (int i = 0; i < 4; ++i) {
+            head.push_back(uint8_t(v >> (8 * i)));
+        }
+    };
+    auto put64 = [&put32](uint64_t v) {
+        put32(uint32_t(v));
+        put32(uint32_t(v >> 32));
+    };
+    head.insert(head.end(), identifier, identifier + sizeof(identifier));
+    put32(format.vkFormat);
+    put32(1);  // typeSize
+    put32(width);
+    put32(height);
+    put32(0);  // pixelDepth
+    put32(0);  // layerCount
+    put32(1);  // faceCount
+    put32(levelCount);
+    put32(0);  // supercompressionScheme
+    put32(headerBytes + levelIndexBytes);  // dfdByteOffset
+    put32(dfdBytes);
+    put32(0);  // kvdByteOffset
+    put32(0);  // kvdByteLength
+    put64(0);  // sgdByteOffset
+    put64(0);  // sgdByteLength
+    for (uint32_t i = 0; i < levelCount; ++i) {
+        put64(offsets[i]);
+        put64(levels[i].size);
+        put64(levels[i].size);  // uncompressedByteLength
+    }
+
+    // basic descriptor block (vendor KHR, version 1.3): BT.709 primaries, sRGB or linear
+    // transfer, straight alpha, 4x4 texel blocks of blockBytes in plane 0
+    put32(dfdBytes);
+    put32(0);
+    put32(2 | ((dfdBytes - 4) << 16));
+    put32(format.colorModel | (1u << 8) | ((format.srgb ? 2u : 1u) << 16));
+    put32(3 | (3 << 8));
+    put32(format.blockBytes);
+    put32(0);
+    // one sample over the whole block; channel 0 is the color channel of both models
+    put32(uint32_t(format.blockBytes * 8 - 1) << 16);
+    put32(0);           // sample position
+    put32(0);           // sampleLower
+    put32(UINT32_MAX);  // sampleUpper
+    sink.write(head.data(), head.size());
+
+    static const uint8_t zeros[16] = {};
+    uint64_t at = head.size();
+    for (uint32_t i = levelCount; i-- > 0;) {
+        sink.write(zeros, size_t(offsets[i] - at));
+        sink.write(levels[i].data, size_t(levels[i].size));
+        at = offsets[i] + levels[i].size;
+    }
+}
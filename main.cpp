@@ -1,256 +1,262 @@
-#include <GLFW/glfw3.h>
-#include <webgpu/webgpu_cpp.h>
-#include <webgpu/webgpu_glfw.h>
-
+#include <atomic>
+#include <csignal>
 #include <cstdio>
-#include <iostream>
+#include <future>
+#include <memory>
 
-#include "dawn/native/DawnNative.h"
+#include "alloc_stats.h"
 
+// stb's heap use goes through the counting hooks, reported with --alloc-stats
+#define STBIW_MALLOC(size) countedMalloc(size)
+#define STBIW_REALLOC_SIZED(p, oldSize, newSize) countedRealloc(p, oldSize, newSize)
+#define STBIW_FREE(p) countedFree(p)
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #define __STDC_LIB_EXT1__
 #include "stb_image_write.h"
 
-const char shaderCode[] = R"(
-struct VertexOutput {
-    @builtin(position) Position : vec4f,
-    @location(0) Color: vec3f
-}
-
-@vertex
-fn vs_main(@builtin(vertex_index) in_vertex_index: u32) -> VertexOutput {
-    var output: VertexOutput;
-
-    if (in_vertex_index == 0u) {
-        output.Position = vec4<f32>(-0.5, -0.5, 0.0, 1.0);
-        output.Color = vec3<f32>(1.0, 0.0, 0.0);
-    } else if (in_vertex_index == 1u) {
-        output.Position = vec4<f32>(0.5, -0.5, 0.0, 1.0);
-        output.Color = vec3<f32>(0.0, 1.0, 0.0);
-    } else {
-        output.Position = vec4<f32>(0.0, 0.5, 0.0, 1.0);
-        output.Color = vec3<f32>(0.0, 0.0, 1.0);
-    }
-
-    return output;
-}
-
-@fragment
-fn fs_main(input: VertexOutput) -> @location(0) vec4f {
-     return vec4<f32>(input.Color, 1.0);
-}
-)";
-
-struct WebGpuRenderer {
-    std::unique_ptr<dawn::native::Instance> instance;
-    wgpu::BackendType backendType = wgpu::BackendType::Vulkan;
-    wgpu::AdapterType adapterType = wgpu::AdapterType::Unknown;
-    std::vector<std::string> enableToggles;
-    std::vector<std::string> disableToggles;
-    wgpu::SwapChain swapChain;
-
-    wgpu::Device device;
-    wgpu::RenderPipeline pipeline;
-    wgpu::TextureView targetTextureView;
-    wgpu::Texture targetTexture;
-    wgpu::BufferDescriptor bufferDesc;
-    wgpu::Buffer buffer;
-
-    uint32_t m_width;
-    uint32_t m_height;
+#include "webgpu_renderer.h"
+
+// Usage: app [--pack frames.pack] [--commit-every N] [--ring /shm-name]
+//   --pack          append every frame to this archive instead of rewriting
+//                   test_output_buffer.png
+//   --commit-every  fsync the pack every N frames (default: never)
+//   --ring          publish raw frames to a shared-memory ring
+//   --mapped        write each frame uncompressed through a file mapping (.bmp or raw)
+//   --mapped-sync   none, async or sync: how hard to push mapped frames to disk
+//   --dirty-tiles   on: read back only the tiles that changed since the previous frame
+//   --skip-repeats  on: don't encode or write frames identical to the previous one; packs
+//                   record them as repeats
+//   --gpu-png-filter on: filter PNG scanlines on the GPU (no --ring or --mapped)
+//   --gpu-jpeg      quality: save JPEG, transformed and quantized on the GPU (no --ring or
+//                   --mapped)
+//   --compress      bc1 or bc7: save block-compressed KTX2 textures, compressed on the GPU
+//                   (no --ring or --mapped)
+//   --thumbnails    on: also save 1/2, 1/4 and 1/8 size PNGs, downsampled on the GPU (no
+//                   --ring, --mapped or --pack)
+//   --deep-zoom     base path: write each frame as a tile pyramid instead (base.dzi and
+//                   base_files/, or base/z/x/y for xyz)
+//   --tile-layout   dzi or xyz
+//   --tile-format   png or jpg
+//   --tile-size     tile edge in pixels (default 256)
+//   --readback      rgba, rgb24, i420, nv12 or r8: layout converted to on the GPU before
+//                   readback (rgb24 is saved as JPEG, i420/nv12 as raw .yuv)
+//   --readback-depth frames read back at once (default 1)
+//   --encode-workers threads encoding frames outside the map callback (default 0, none;
+//                   no --ring, --mapped or --skip-repeats)
+//   --stats-every   seconds: print per-stage frame latencies to stderr as one JSON line per
+//                   interval
+//   --trace         path: record a timeline of the frame pipeline and write it there as
+//                   Chrome trace-event JSON on exit (and on SIGUSR1 where there is one)
+//   --fast-start    on: bring the device up while the window opens and compile the pipeline
+//                   while resources are allocated
+//   --startup-report on: print how long each startup phase took to stderr as JSON
+//   --blob-cache    directory: keep compiled shaders and pipelines there across runs
+//   --alloc-stats   on: print encoder heap use per format and GPU memory to stderr as JSON,
+//                   every --stats-every interval and on exit
+// Without --pack, frames are only encoded to test_output_buffer.png when no other output
+// is selected.
+
+// set from the signal handler, the trace is written from the main loop
+std::atomic<bool> traceRequested{false};
+
+int main(int argc, char** argv) {
+    WebGpuRenderer renderer;
+    const uint32_t width = 512;
+    const uint32_t height = 512;
 
-    void init(GLFWwindow* window, uint32_t width, uint32_t height) {
-        m_width = width;
-        m_height = height;
-        WGPUInstanceDescriptor instanceDescriptor{};
-        instanceDescriptor.features.timedWaitAnyEnable = true;
-        instance = std::make_unique<dawn::native::Instance>(&instanceDescriptor);
-        wgpu::RequestAdapterOptions options = {};
-        options.backendType = backendType;
-        auto adapters = instance->EnumerateAdapters(&options);
-        wgpu::DawnAdapterPropertiesPowerPreference power_props{};
-        wgpu::AdapterProperties adapterProperties{};
-        adapterProperties.nextInChain = &power_props;
-        auto isAdapterType = [this, &adapterProperties](const auto& adapter) -> bool {
-            if (adapterType == wgpu::AdapterType::Unknown) {
-                return true;
+    const char* packPath = nullptr;
+    const char* ringName = nullptr;
+    const char* mappedPath = nullptr;
+    const char* mappedSync = "none";
+    uint32_t commitEvery = 0;
+    double statsEvery = 0;
+    const char* tracePath = nullptr;
+    bool startupReport = false;
+    bool allocStats = false;
+    for (int i = 1; i < argc; i += 2) {
+        if (i + 1 == argc) {
+            fprintf(stderr, "Missing value for %s\n", argv[i]);
+            return 1;
+        }
+        if (strcmp(argv[i], "--pack") == 0) {
+            packPath = argv[i + 1];
+        } else if (strcmp(argv[i], "--commit-every") == 0) {
+            commitEvery = uint32_t(atoi(argv[i + 1]));
+        } else if (strcmp(argv[i], "--ring") == 0) {
+            ringName = argv[i + 1];
+        } else if (strcmp(argv[i], "--mapped") == 0) {
+            mappedPath = argv[i + 1];
+        } else if (strcmp(argv[i], "--mapped-sync") == 0) {
+            mappedSync = argv[i + 1];
+        } else if (strcmp(argv[i], "--dirty-tiles") == 0) {
+            renderer.trackDirtyTiles = strcmp(argv[i + 1], "on") == 0;
+        } else if (strcmp(argv[i], "--skip-repeats") == 0) {
+            renderer.skipRepeats = strcmp(argv[i + 1], "on") == 0;
+        } else if (strcmp(argv[i], "--gpu-png-filter") == 0) {
+            renderer.gpuPngFilter = strcmp(argv[i + 1], "on") == 0;
+        } else if (strcmp(argv[i], "--gpu-jpeg") == 0) {
+            renderer.gpuJpegQuality = std::clamp(atoi(argv[i + 1]), 0, 100);
+        } else if (strcmp(argv[i], "--deep-zoom") == 0) {
+            renderer.deepZoomOptions.basePath = argv[i + 1];
+        } else if (strcmp(argv[i], "--tile-layout") == 0) {
+            renderer.deepZoomOptions.layout =
+                strcmp(argv[i + 1], "xyz") == 0 ? DeepZoomLayout::Xyz : DeepZoomLayout::Dzi;
+        } else if (strcmp(argv[i], "--tile-format") == 0) {
+            renderer.deepZoomOptions.extension = strcmp(argv[i + 1], "jpg") == 0 ? "jpg" : "png";
+        } else if (strcmp(argv[i], "--tile-size") == 0) {
+            renderer.deepZoomOptions.tileSize = std::max(16, atoi(argv[i + 1]));
+        } else if (strcmp(argv[i], "--readback-depth") == 0) {
+            renderer.readbackDepth = uint32_t(std::max(1, atoi(argv[i + 1])));
+        } else if (strcmp(argv[i], "--encode-workers") == 0) {
+            renderer.encodeWorkers = uint32_t(std::max(0, atoi(argv[i + 1])));
+        } else if (strcmp(argv[i], "--trace") == 0) {
+            tracePath = argv[i + 1];
+        } else if (strcmp(argv[i], "--stats-every") == 0) {
+            statsEvery = atof(argv[i + 1]);
+        } else if (strcmp(argv[i], "--fast-start") == 0) {
+            renderer.fastStart = strcmp(argv[i + 1], "on") == 0;
+        } else if (strcmp(argv[i], "--blob-cache") == 0) {
+            renderer.blobCachePath = argv[i + 1];
+        } else if (strcmp(argv[i], "--alloc-stats") == 0) {
+            allocStats = strcmp(argv[i + 1], "on") == 0;
+        } else if (strcmp(argv[i], "--startup-report") == 0) {
+            startupReport = strcmp(argv[i + 1], "on") == 0;
+        } else if (strcmp(argv[i], "--thumbnails") == 0) {
+            renderer.thumbnails = strcmp(argv[i + 1], "on") == 0;
+        } else if (strcmp(argv[i], "--compress") == 0) {
+            if (strcmp(argv[i + 1], "bc1") == 0) {
+                renderer.blockCompression = BlockCompression::BC1;
+            } else if (strcmp(argv[i + 1], "bc7") == 0) {
+                renderer.blockCompression = BlockCompression::BC7;
+            } else {
+                fprintf(stderr, "Unknown block compression %s\n", argv[i + 1]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--readback") == 0) {
+            static const std::pair<const char*, ReadbackLayout> layouts[] = {
+                {"rgba", ReadbackLayout::RGBA}, {"rgb24", ReadbackLayout::RGB24},
+                {"i420", ReadbackLayout::I420}, {"nv12", ReadbackLayout::NV12},
+                {"r8", ReadbackLayout::R8}};
+            auto it = std::find_if(std::begin(layouts), std::end(layouts), [&](const auto& l) {
+                return strcmp(l.first, argv[i + 1]) == 0;
+            });
+            if (it == std::end(layouts)) {
+                fprintf(stderr, "Unknown readback layout %s\n", argv[i + 1]);
+                return 1;
             }
-            adapter.GetProperties(&adapterProperties);
-            return adapterProperties.adapterType == adapterType;
-        };
-        auto preferredAdapter = std::find_if(adapters.begin(), adapters.end(), isAdapterType);
-        if (preferredAdapter == adapters.end()) {
-            fprintf(stderr, "Failed to find an adapter! Please try another adapter type.\n");
-            device = wgpu::Device();
-            return;
+            renderer.readbackLayout = it->second;
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
         }
-
-        WGPUDeviceDescriptor deviceDesc = {};
-        WGPUDevice backendDevice = preferredAdapter->CreateDevice(&deviceDesc);
-
-        // DawnProcTable backendProcs = dawn::native::GetProcs();
-        // auto surfaceChainedDesc = wgpu::glfw::SetupWindowAndGetSurfaceDescriptor(window);
-        // WGPUSurfaceDescriptor surfaceDesc;
-        // surfaceDesc.label = "surface";
-        // surfaceDesc.nextInChain = reinterpret_cast<WGPUChainedStruct*>(surfaceChainedDesc.get());
-        // WGPUSurface surface = backendProcs.instanceCreateSurface(instance->Get(), &surfaceDesc);
-        // WGPUSwapChainDescriptor swapChainDesc = {};
-        // swapChainDesc.usage = WGPUTextureUsage_RenderAttachment;
-        // swapChainDesc.format = static_cast<WGPUTextureFormat>(wgpu::TextureFormat::BGRA8Unorm);
-        // swapChainDesc.width = width;
-        // swapChainDesc.height = height;
-        // swapChainDesc.presentMode = WGPUPresentMode_Mailbox;
-        // WGPUSwapChain backendSwapChain =
-        //     backendProcs.deviceCreateSwapChain(backendDevice, surface, &swapChainDesc);
-        // swapChain = wgpu::SwapChain::Acquire(backendSwapChain);
-
-        WGPUDevice cDevice = nullptr;
-
-        cDevice = backendDevice;
-
-        device = wgpu::Device::Acquire(cDevice);
-
-        /////////////
-        wgpu::ShaderModuleWGSLDescriptor wgslDesc{};
-        wgslDesc.code = shaderCode;
-
-        wgpu::ShaderModuleDescriptor shaderModuleDescriptor{.nextInChain = &wgslDesc};
-        wgpu::ShaderModule shaderModule = device.CreateShaderModule(&shaderModuleDescriptor);
-
-        wgpu::ColorTargetState colorTargetState{.format = wgpu::TextureFormat::BGRA8Unorm};
-
-        wgpu::FragmentState fragmentState{
-            .module = shaderModule, .targetCount = 1, .targets = &colorTargetState};
-
-        wgpu::RenderPipelineDescriptor descriptor{.vertex = {.module = shaderModule},
-                                                  .fragment = &fragmentState};
-        pipeline = device.CreateRenderPipeline(&descriptor);
-
-        wgpu::TextureDescriptor targetTextureDesc;
-        targetTextureDesc.label = "Render target";
-        targetTextureDesc.dimension = wgpu::TextureDimension::e2D;
-        targetTextureDesc.size = {width, height, 1};
-        targetTextureDesc.format = wgpu::TextureFormat::RGBA8UnormSrgb;
-        targetTextureDesc.mipLevelCount = 1;
-        targetTextureDesc.sampleCount = 1;
-        targetTextureDesc.usage =
-            wgpu::TextureUsage::RenderAttachment | wgpu::TextureUsage::CopySrc;
-        targetTextureDesc.viewFormats = nullptr;
-        targetTextureDesc.viewFormatCount = 0;
-        targetTexture = device.CreateTexture(&targetTextureDesc);
-
-        wgpu::TextureViewDescriptor targetTextureViewDesc;
-        targetTextureViewDesc.label = "Render texture view";
-        targetTextureViewDesc.baseArrayLayer = 0;
-        targetTextureViewDesc.arrayLayerCount = 1;
-        targetTextureViewDesc.baseMipLevel = 0;
-        targetTextureViewDesc.mipLevelCount = 1;
-        targetTextureViewDesc.aspect = wgpu::TextureAspect::All;
-        targetTextureView = targetTexture.CreateView(&targetTextureViewDesc);
-
-        bufferDesc.usage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::MapRead;
-        bufferDesc.mappedAtCreation = false;
-        bufferDesc.size = width * height * 4;
-        buffer = device.CreateBuffer(&bufferDesc);
     }
-
-    void draw() {
-        wgpu::RenderPassColorAttachment attachment{//.view = swapChain.GetCurrentTextureView(),
-                                                   .view = targetTextureView,
-                                                   .loadOp = wgpu::LoadOp::Clear,
-                                                   .storeOp = wgpu::StoreOp::Store,
-                                                   .clearValue = wgpu::Color{0.5, 0.5, 0.5, 1.0}};
-
-        wgpu::RenderPassDescriptor renderpass{.colorAttachmentCount = 1,
-                                              .colorAttachments = &attachment};
-
-        wgpu::CommandEncoder encoder = device.CreateCommandEncoder();
-        wgpu::RenderPassEncoder pass = encoder.BeginRenderPass(&renderpass);
-        pass.SetPipeline(pipeline);
-        pass.Draw(3);
-        pass.End();
-        wgpu::CommandBuffer commands = encoder.Finish();
-        device.GetQueue().Submit(1, &commands);
-
-        //////////////////////
-        // swapChain.Present();
-        ///////////////////////
-
-        encoder = device.CreateCommandEncoder();
-        wgpu::ImageCopyTexture source;
-        source.texture = targetTexture;
-
-        wgpu::ImageCopyBuffer destination;
-        destination.buffer = buffer;
-        destination.layout.bytesPerRow = 4 * m_width;
-        destination.layout.offset = 0;
-        destination.layout.rowsPerImage = m_height;
-        wgpu::Extent3D copyExtent = {m_width, m_height, 1};
-        encoder.CopyTextureToBuffer(&source, &destination, &copyExtent);
-
-        commands = encoder.Finish();
-        device.GetQueue().Submit(1, &commands);
-
-        /////////////////////
-
-        struct UserData {
-            wgpu::BufferDescriptor* bufferDesc;
-            wgpu::Buffer* buffer;
-            int width;
-            int height;
-        };
-
-        UserData userData = {&bufferDesc, &buffer, m_width, m_height};
-
-        buffer.MapAsync(
-            wgpu::MapMode::Read, 0, bufferDesc.size,
-            [](WGPUBufferMapAsyncStatus status, void* userdata_) {
-                UserData* userData = (UserData*)userdata_;
-                if (status == WGPUBufferMapAsyncStatus_Success) {
-                    wgpu::Buffer* buffer = static_cast<wgpu::Buffer*>(userData->buffer);
-                    wgpu::BufferDescriptor* bufferDesc =
-                        static_cast<wgpu::BufferDescriptor*>(userData->bufferDesc);
-
-                    unsigned char* pixelData =
-                        (unsigned char*)buffer->GetConstMappedRange(0, bufferDesc->size);
-
-                    if (pixelData == NULL) {
-                        return;
-                    }
-                    std::vector<char> vec(pixelData, pixelData + bufferDesc->size);
-
-                    int bytesPerRow = 4 * userData->width;
-                    int success = stbi_write_png("test_output_buffer.png", (int)userData->width,
-                                                 (int)userData->height, 4, pixelData, bytesPerRow);
-
-                    buffer->Unmap();
-                } else {
-                    std::cerr << "Error: Failed to map buffer to CPU memory. Error code: " << status
-                              << std::endl;
-                }
-            },
-            (void*)(&userData));
-
-        device.Tick();
-
-        dawn::native::InstanceProcessEvents(instance->Get());
+#ifdef FRAME_PACK_POSIX
+    if (packPath) {
+        auto pack = std::make_unique<FramePackSink>(packPath, commitEvery);
+        if (!pack->valid()) {
+            fprintf(stderr, "Failed to open frame pack %s\n", packPath);
+            return 1;
+        }
+        renderer.sink = std::move(pack);
+    }
+#endif
+#ifdef FRAME_RING_SHM
+    if (ringName) {
+        uint64_t slotBytes = uint64_t(paddedBytesPerRow(width, renderer.targetFormat)) * height;
+        if (renderer.readbackLayout != ReadbackLayout::RGBA) {
+            slotBytes = packedPlanes(renderer.readbackLayout, width, height).totalSize;
+        }
+        renderer.ring = std::make_unique<FrameRingProducer>(ringName, 8, slotBytes);
+        if (!renderer.ring->valid()) {
+            fprintf(stderr, "Failed to create frame ring %s\n", ringName);
+            return 1;
+        }
+    }
+#endif
+
+#ifdef MAPPED_FRAME_WRITER
+    if (mappedPath) {
+        renderer.mappedOutputPath = mappedPath;
+        renderer.mappedDurability = strcmp(mappedSync, "sync") == 0 ? MappedFrameDurability::Sync
+                                    : strcmp(mappedSync, "async") == 0
+                                        ? MappedFrameDurability::Async
+                                        : MappedFrameDurability::None;
+    }
+#endif
+    if (!packPath && !ringName && !mappedPath && renderer.deepZoomOptions.basePath.empty()) {
+        renderer.sink = makeFileSink();
     }
-};
 
-int main() {
-    WebGpuRenderer renderer;
+    FrameStats stats;
+    if (statsEvery > 0) {
+        renderer.stats = &stats;
+    }
+    std::unique_ptr<FrameTracer> tracer;
+    if (tracePath) {
+        tracer = std::make_unique<FrameTracer>();
+        renderer.tracer = tracer.get();
+#ifdef SIGUSR1
+        std::signal(SIGUSR1, [](int) { traceRequested = true; });
+#endif
+    }
+    auto writeTrace = [&] {
+        if (!tracer->write(tracePath)) {
+            fprintf(stderr, "Failed to write trace %s\n", tracePath);
+        }
+    };
 
+    // init() doesn't use the window, so with fastStart it runs while GLFW starts up
+    std::future<void> initialized;
+    if (renderer.fastStart) {
+        initialized =
+            std::async(std::launch::async, [&] { renderer.init(nullptr, width, height); });
+    }
+    FrameClock::time_point windowStart = FrameClock::now();
     glfwInit();
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
     glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
-    const uint32_t width = 512;
-    const uint32_t height = 512;
     GLFWwindow* window = glfwCreateWindow(width, height, "webgpu-test", nullptr, nullptr);
+    FrameClock::time_point windowEnd = FrameClock::now();
+    if (renderer.fastStart) {
+        initialized.get();
+    } else {
+        renderer.init(window, width, height);
+    }
+    renderer.addStartupPhase("window", windowStart, windowEnd);
+    if (startupReport) {
+        renderer.startup.print(stderr);
+        if (renderer.blobCache) {
+            fprintf(stderr,
+                    "{\"blob_cache\": {\"hits\": %llu, \"misses\": %llu, \"stores\": %llu}}\n",
+                    (unsigned long long)renderer.blobCache->hits.load(),
+                    (unsigned long long)renderer.blobCache->misses.load(),
+                    (unsigned long long)renderer.blobCache->stores.load());
+        }
+    }
 
-    renderer.init(window, width, height);
-
+    FrameClock::time_point statsDumped = FrameClock::now();
     while (!glfwWindowShouldClose(window)) {
         glfwPollEvents();
         renderer.draw();
+        if (statsEvery > 0 && FrameClock::now() - statsDumped >=
+                                  std::chrono::duration<double>(statsEvery)) {
+            stats.dump(stderr);
+            stats.reset();
+            if (allocStats) {
+                allocationStats.dump(stderr);
+            }
+            statsDumped = FrameClock::now();
+        }
+        if (tracer && traceRequested.exchange(false)) {
+            writeTrace();
+        }
+    }
+    // frames still being read back or encoded, and an unfinished deep zoom export
+    renderer.flush();
+    if (tracer) {
+        writeTrace();
+    }
+    if (allocStats) {
+        allocationStats.dump(stderr);
     }
 }
\ No newline at end of file
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#ifndef _WIN32
+#define MAPPED_FRAME_WRITER
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Writes uncompressed frames by mapping the output file and copying rows straight from the
+// readback mapping into it, so the pixels never pass through stdio or an encoder buffer. The
+// file is preallocated to its final size, the header written once, and each row copied (and
+// flipped/swizzled for BMP) into place.
+
+enum class MappedFrameFormat {
+    Raw,  // rows of width * bytesPerPixel, top-down, no header
+    Bmp,  // 32-bit BGRA BMP with a V4 header, bottom-up (same layout as stbi_write_bmp)
+};
+
+enum class MappedFrameDurability {
+    None,   // leave write-back to the kernel
+    Async,  // msync(MS_ASYNC): start write-back before returning
+    Sync,   // msync(MS_SYNC): data is on disk when the call returns
+};
+
+inline uint8_t* putLE(uint8_t* o, uint32_t value, int bytes) {
+    for (int i = 0; i < bytes; ++i) {
+        *o++ = uint8_t(value >> (8 * i));
+    }
+    return o;
+}
+
+// Header that stbi_write_bmp emits for 4-component images.
+inline void writeBmpV4Header(uint8_t* o, uint32_t width, uint32_t height) {
+    const uint32_t headerSize = 14 + 108;
+    o = putLE(o, 'B', 1);
+    o = putLE(o, 'M', 1);
+    o = putLE(o, headerSize + width * height * 4, 4);
+    o = putLE(o, 0, 4);
+    o = putLE(o, headerSize, 4);
+    o = putLE(o, 108, 4);
+    o = putLE(o, width, 4);
+    o = putLE(o, height, 4);
+    o = putLE(o, 1, 2);
+    o = putLE(o, 32, 2);
+    o = putLE(o, 3, 4);  // BI_BITFIELDS
+    for (int i = 0; i < 5; ++i) {
+        o = putLE(o, 0, 4);
+    }
+    o = putLE(o, 0xff0000, 4);
+    o = putLE(o, 0xff00, 4);
+    o = putLE(o, 0xff, 4);
+    o = putLE(o, 0xff000000u, 4);
+    memset(o, 0, 4 + 36 + 12);  // color space type, endpoints, gamma
+}
+
+// RGBA <-> BGRA on whole 32-bit pixels; compilers vectorize this loop.
+inline void swizzleRowRB(uint8_t* dst, const uint8_t* src, uint32_t width) {
+    for (uint32_t x = 0; x < width; ++x) {
+        uint32_t p;
+        memcpy(&p, src + x * 4, 4);
+        p = (p & 0xff00ff00u) | ((p >> 16) & 0xffu) | ((p & 0xffu) << 16);
+        memcpy(dst + x * 4, &p, 4);
+    }
+}
+
+// `pixels` holds height rows of srcBytesPerRow bytes (the padded readback layout), each with
+// width pixels of bytesPerPixel bytes. For Bmp, pixels must be 4-byte RGBA, or BGRA with
+// `isBGRA`.
+inline bool writeMappedFrame(const char* path, MappedFrameFormat format, const uint8_t* pixels,
+                             uint32_t width, uint32_t height, uint32_t srcBytesPerRow,
+                             uint32_t bytesPerPixel, bool isBGRA = false,
+                             MappedFrameDurability durability = MappedFrameDurability::None) {
+    if (format == MappedFrameFormat::Bmp && bytesPerPixel != 4) {
+        return false;
+    }
+    size_t rowBytes = size_t(width) * bytesPerPixel;
+    size_t headerSize = format == MappedFrameFormat::Bmp ? 14 + 108 : 0;
+    size_t fileSize = headerSize + rowBytes * height;
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    // Reserve the blocks up front so the copy never faults into a full filesystem (SIGBUS).
+    bool ok = fileSize == 0 || posix_fallocate(fd, 0, off_t(fileSize)) == 0;
+    void* mapping = MAP_FAILED;
+    if (ok && fileSize > 0) {
+        mapping = mmap(nullptr, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ok = mapping != MAP_FAILED;
+    }
+    if (ok && fileSize > 0) {
+        uint8_t* out = static_cast<uint8_t*>(mapping);
+        madvise(mapping, fileSize, MADV_SEQUENTIAL);
+        if (format == MappedFrameFormat::Bmp) {
+            writeBmpV4Header(out, width, height);
+            // bottom-up rows of BGRA
+            for (uint32_t y = 0; y < height; ++y) {
+                const uint8_t* src = pixels + size_t(height - 1 - y) * srcBytesPerRow;
+                uint8_t* dst = out + headerSize + size_t(y) * rowBytes;
+                if (isBGRA) {
+                    memcpy(dst, src, rowBytes);
+                } else {
+                    swizzleRowRB(dst, src, width);
+                }
+            }
+        } else if (srcBytesPerRow == rowBytes) {
+            memcpy(out, pixels, rowBytes * height);
+        } else {
+            for (uint32_t y = 0; y < height; ++y) {
+                memcpy(out + size_t(y) * rowBytes, pixels + size_t(y) * srcBytesPerRow,
+                       rowBytes);
+            }
+        }
+        if (durability != MappedFrameDurability::None) {
+            ok = msync(mapping, fileSize,
+                       durability == MappedFrameDurability::Sync ? MS_SYNC : MS_ASYNC) == 0;
+        }
+        munmap(mapping, fileSize);
+    }
+    return close(fd) == 0 && ok;
+}
+#endif  // !_WIN32
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <webgpu/webgpu_cpp.h>
+
+#include <algorithm>
+#include <cstdint>
+
+#include "alloc_stats.h"
+#include "shader_module.h"
+
+// 1/2, 1/4 and 1/8 size versions of the render target, downsampled on the GPU in a single
+// pass and read back together with the full frame. Each invocation reads an 8x8 block of the
+// target and box-filters it down through all three levels in registers, so no level waits on
+// another dispatch. Sampling goes through the target's own view, so an sRGB target is
+// averaged in linear light and re-encoded to sRGB on store.
+
+constexpr uint32_t kMipPyramidLevels = 3;
+
+const char mipPyramidShaderCode[] = R"(
+override srgbOutput: bool = false;
+
+@group(0) @binding(0) var src: texture_2d<f32>;
+@group(0) @binding(1) var level1: texture_storage_2d<rgba8unorm, write>;
+@group(0) @binding(2) var level2: texture_storage_2d<rgba8unorm, write>;
+@group(0) @binding(3) var level3: texture_storage_2d<rgba8unorm, write>;
+
+fn source(p: vec2u) -> vec4f {
+    return textureLoad(src, min(p, textureDimensions(src) - 1u), 0);
+}
+
+fn encoded(c: vec4f) -> vec4f {
+    if (!srgbOutput) {
+        return c;
+    }
+    let rgb = clamp(c.rgb, vec3f(0.0), vec3f(1.0));
+    let curve = 1.055 * pow(rgb, vec3f(1.0 / 2.4)) - 0.055;
+    return vec4f(select(curve, rgb * 12.92, rgb <= vec3f(0.0031308)), c.a);
+}
+
+// each invocation covers 4x4 texels of level 1, 2x2 of level 2 and one of level 3
+@compute @workgroup_size(8, 8)
+fn main(@builtin(global_invocation_id) id: vec3u) {
+    var l1: array<vec4f, 16>;
+    for (var i = 0u; i < 16u; i++) {
+        let p = id.xy * 4u + vec2u(i % 4u, i / 4u);
+        let s = p * 2u;
+        l1[i] = (source(s) + source(s + vec2u(1u, 0u)) + source(s + vec2u(0u, 1u)) +
+                 source(s + vec2u(1u, 1u))) * 0.25;
+        if (all(p < textureDimensions(level1))) {
+            textureStore(level1, p, encoded(l1[i]));
+        }
+    }
+    var l2: array<vec4f, 4>;
+    for (var i = 0u; i < 4u; i++) {
+        let p = id.xy * 2u + vec2u(i % 2u, i / 2u);
+        let k = (i / 2u) * 8u + (i % 2u) * 2u;
+        l2[i] = (l1[k] + l1[k + 1u] + l1[k + 4u] + l1[k + 5u]) * 0.25;
+        if (all(p < textureDimensions(level2))) {
+            textureStore(level2, p, encoded(l2[i]));
+        }
+    }
+    if (all(id.xy < textureDimensions(level3))) {
+        textureStore(level3, id.xy, encoded((l2[0] + l2[1] + l2[2] + l2[3]) * 0.25));
+    }
+}
+)";
+
+struct MipPyramid {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    // levels 1..kMipPyramidLevels of the target as mips 0.. of one RGBA8 texture
+    wgpu::Texture levels;
+    wgpu::ComputePipeline pipeline;
+    wgpu::BindGroup bindGroup;
+    // where each level lands in the readback buffer, rows padded to 256 bytes
+    uint64_t offset[kMipPyramidLevels] = {};
+    uint32_t bytesPerRow[kMipPyramidLevels] = {};
+    uint64_t end = 0;
+
+    // `view` is the target's default view (TextureBinding usage); `srgb` whether its format
+    // is sRGB. Levels are placed in the readback buffer from `readbackOffset` (a multiple of
+    // 4) on; `end` is where they stop.
+    void init(const wgpu::Device& device, const wgpu::TextureView& view, uint32_t frameWidth,
+              uint32_t frameHeight, bool srgb, uint64_t readbackOffset) {
+        width = frameWidth;
+        height = frameHeight;
+
+        wgpu::TextureDescriptor levelsDesc;
+        levelsDesc.label = "Mip pyramid";
+        levelsDesc.size = {levelWidth(1), levelHeight(1), 1};
+        levelsDesc.format = wgpu::TextureFormat::RGBA8Unorm;
+        levelsDesc.mipLevelCount = kMipPyramidLevels;
+        levelsDesc.usage = wgpu::TextureUsage::StorageBinding | wgpu::TextureUsage::CopySrc;
+        levels = createTrackedTexture(device, levelsDesc);
+
+        end = readbackOffset;
+        for (uint32_t i = 0; i < kMipPyramidLevels; ++i) {
+            offset[i] = (end + 255) & ~uint64_t(255);
+            bytesPerRow[i] = (levelWidth(i + 1) * 4 + 255) & ~uint32_t(255);
+            end = offset[i] + uint64_t(bytesPerRow[i]) * levelHeight(i + 1);
+        }
+
+        wgpu::ConstantEntry srgbConstant{.key = "srgbOutput", .value = srgb ? 1.0 : 0.0};
+        wgpu::ComputePipelineDescriptor pipelineDesc{
+            .compute = {.module = createShaderModule(device, mipPyramidShaderCode),
+                        .entryPoint = "main",
+                        .constantCount = 1,
+                        .constants = &srgbConstant}};
+        pipeline = device.CreateComputePipeline(&pipelineDesc);
+
+        wgpu::BindGroupEntry entries[1 + kMipPyramidLevels] = {};
+        entries[0].binding = 0;
+        entries[0].textureView = view;
+        for (uint32_t i = 0; i < kMipPyramidLevels; ++i) {
+            wgpu::TextureViewDescriptor levelViewDesc;
+            levelViewDesc.baseMipLevel = i;
+            levelViewDesc.mipLevelCount = 1;
+            entries[1 + i].binding = 1 + i;
+            entries[1 + i].textureView = levels.CreateView(&levelViewDesc);
+        }
+        wgpu::BindGroupDescriptor bindGroupDesc{.layout = pipeline.GetBindGroupLayout(0),
+                                                .entryCount = 1 + kMipPyramidLevels,
+                                                .entries = entries};
+        bindGroup = device.CreateBindGroup(&bindGroupDesc);
+    }
+
+    bool enabled() const {
+        return bool(pipeline);
+    }
+
+    // Size of level `level` (0 being the full frame).
+    uint32_t levelWidth(uint32_t level) const {
+        return std::max(1u, width >> level);
+    }
+
+    uint32_t levelHeight(uint32_t level) const {
+        return std::max(1u, height >> level);
+    }
+
+    // Downsamples the target and copies every level into `readback`, one copy per level.
+    void encode(const wgpu::CommandEncoder& encoder, const wgpu::Buffer& readback) const {
+        wgpu::ComputePassEncoder pass = encoder.BeginComputePass();
+        pass.SetPipeline(pipeline);
+        pass.SetBindGroup(0, bindGroup);
+        pass.DispatchWorkgroups((levelWidth(1) + 31) / 32, (levelHeight(1) + 31) / 32);
+        pass.End();
+
+        for (uint32_t i = 0; i < kMipPyramidLevels; ++i) {
+            wgpu::ImageCopyTexture source;
+            source.texture = levels;
+            source.mipLevel = i;
+
+            wgpu::ImageCopyBuffer destination;
+            destination.buffer = readback;
+            destination.layout.offset = offset[i];
+            destination.layout.bytesPerRow = bytesPerRow[i];
+            destination.layout.rowsPerImage = levelHeight(i + 1);
+            wgpu::Extent3D extent = {levelWidth(i + 1), levelHeight(i + 1), 1};
+            encoder.CopyTextureToBuffer(&source, &destination, &extent);
+        }
+    }
+};
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PIXEL_CONVERT_X86
+#include <immintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define PIXEL_CONVERT_NEON
+#include <arm_neon.h>
+#endif
+
+// IEEE 754 binary16 -> binary32, including subnormals, infinities and NaNs.
+inline float halfToFloat(uint16_t h) {
+    uint32_t sign = uint32_t(h & 0x8000) << 16;
+    uint32_t exponent = (h >> 10) & 0x1f;
+    uint32_t mantissa = h & 0x3ff;
+    uint32_t bits;
+    if (exponent == 0x1f) {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    } else if (exponent != 0) {
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    } else if (mantissa == 0) {
+        bits = sign;
+    } else {
+        // Subnormal half: shift the mantissa up until it has an implicit leading one.
+        exponent = 113;
+        while (!(mantissa & 0x400)) {
+            mantissa <<= 1;
+            --exponent;
+        }
+        bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+    }
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+inline void halfToFloatScalar(const uint16_t* src, float* dst, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        dst[i] = halfToFloat(src[i]);
+    }
+}
+
+#if defined(PIXEL_CONVERT_X86) && (defined(__GNUC__) || defined(__clang__) || defined(__F16C__))
+#if !defined(__F16C__)
+__attribute__((target("avx,f16c")))
+#endif
+inline void halfToFloatF16C(const uint16_t* src, float* dst, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(h));
+    }
+    halfToFloatScalar(src + i, dst + i, count - i);
+}
+
+inline bool cpuHasF16C() {
+#if defined(__F16C__)
+    return true;
+#else
+    static const bool hasF16C = __builtin_cpu_supports("f16c");
+    return hasF16C;
+#endif
+}
+#define PIXEL_CONVERT_F16C
+#endif
+
+// Converts `count` half floats, using F16C (runtime-detected) or NEON when available.
+inline void halfToFloat(const uint16_t* src, float* dst, size_t count) {
+#if defined(PIXEL_CONVERT_F16C)
+    if (cpuHasF16C()) {
+        halfToFloatF16C(src, dst, count);
+        return;
+    }
+#elif defined(PIXEL_CONVERT_NEON)
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        float16x4_t h = vreinterpret_f16_u16(vld1_u16(src + i));
+        vst1q_f32(dst + i, vcvt_f32_f16(h));
+    }
+    src += i;
+    dst += i;
+    count -= i;
+#endif
+    halfToFloatScalar(src, dst, count);
+}
+
+// Unpacks a readback of `height` rows of `bytesPerRow` (padded for the copy alignment) holding
+// `width` pixels of 4 half or full floats each into tightly packed RGBA floats.
+inline void readbackRowsToFloat(const uint8_t* src, uint32_t bytesPerRow, uint32_t width,
+                                uint32_t height, bool isHalf, float* dst) {
+    size_t rowFloats = size_t(width) * 4;
+    for (uint32_t y = 0; y < height; ++y) {
+        const uint8_t* row = src + size_t(y) * bytesPerRow;
+        float* out = dst + y * rowFloats;
+        if (isHalf) {
+            halfToFloat(reinterpret_cast<const uint16_t*>(row), out, rowFloats);
+        } else {
+            memcpy(out, row, rowFloats * sizeof(float));
+        }
+    }
+}
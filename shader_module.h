@@ -0,0 +1,62 @@
+#pragma once
+
+#include <webgpu/webgpu_cpp.h>
+
+#include <cstdint>
+#include <cstring>
+
+// Shader modules from SPIR-V compiled at build time, falling back to the WGSL. With
+// PRECOMPILED_SHADERS, the build runs every WGSL shader in shader_tool.cpp through Tint (which
+// also validates it) and embeds the SPIR-V in precompiled_shaders.h, keyed by a hash of the WGSL
+// it came from; WGSL that changed since, or that isn't precompiled (shaders with pipeline-
+// overridable constants, which Tint would have to bake in), is compiled at runtime as before.
+// CMake only enables this when Dawn is built with Tint's SPIR-V reader, which accepts SPIR-V
+// on every backend.
+
+struct PrecompiledShader {
+    uint64_t wgslHash;
+    const uint32_t* spirv;
+    uint32_t spirvWords;
+};
+
+// 64-bit FNV-1a of the source text.
+inline uint64_t wgslHash(const char* wgsl) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (const char* c = wgsl; *c; ++c) {
+        hash = (hash ^ uint8_t(*c)) * 0x100000001b3;
+    }
+    return hash;
+}
+
+#ifdef PRECOMPILED_SHADERS
+// generated by shader_tool: kPrecompiledShaders
+#include "precompiled_shaders.h"
+#endif
+
+inline const PrecompiledShader* findPrecompiledShader(const char* wgsl) {
+#ifdef PRECOMPILED_SHADERS
+    uint64_t hash = wgslHash(wgsl);
+    for (const PrecompiledShader& shader : kPrecompiledShaders) {
+        if (shader.wgslHash == hash) {
+            return &shader;
+        }
+    }
+#else
+    (void)wgsl;
+#endif
+    return nullptr;
+}
+
+inline wgpu::ShaderModule createShaderModule(const wgpu::Device& device, const char* wgsl) {
+    if (const PrecompiledShader* shader = findPrecompiledShader(wgsl)) {
+        wgpu::ShaderModuleSPIRVDescriptor spirvDesc;
+        spirvDesc.codeSize = shader->spirvWords;
+        spirvDesc.code = shader->spirv;
+        wgpu::ShaderModuleDescriptor shaderModuleDescriptor{.nextInChain = &spirvDesc};
+        return device.CreateShaderModule(&shaderModuleDescriptor);
+    }
+    wgpu::ShaderModuleWGSLDescriptor wgslDesc{};
+    wgslDesc.code = wgsl;
+    wgpu::ShaderModuleDescriptor shaderModuleDescriptor{.nextInChain = &wgslDesc};
+    return device.CreateShaderModule(&shaderModuleDescriptor);
+}
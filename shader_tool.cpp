@@ -0,0 +1,115 @@
+// Build step for PRECOMPILED_SHADERS (see shader_module.h), run by CMake around Tint:
+//   shader_tool dump dir    writes every shader below to dir/<name>.wgsl for Tint
+//   shader_tool embed dir   reads Tint's dir/<name>.spv and writes dir/precompiled_shaders.h
+// The WGSL comes from the headers themselves, so it can't drift from what the app embeds.
+// Shaders with pipeline-overridable constants (deep zoom, mip pyramid) aren't listed: Tint
+// would bake the constants into the SPIR-V.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "stb_image_write.h"
+#include "webgpu_renderer.h"
+
+namespace {
+
+struct Shader {
+    const char* name;
+    const char* wgsl;
+};
+
+#define SHADER(code) {#code, code}
+const Shader kShaders[] = {
+    SHADER(shaderCode),
+    SHADER(dirtyTileShaderCode),
+    SHADER(frameHashShaderCode),
+    SHADER(blockCompressShaderCode),
+    SHADER(jpegShaderCode),
+    SHADER(packShaderCode),
+    SHADER(pngFilterShaderCode),
+};
+#undef SHADER
+
+bool dump(const std::string& dir) {
+    for (const Shader& shader : kShaders) {
+        std::string path = dir + "/" + shader.name + ".wgsl";
+        FILE* file = fopen(path.c_str(), "wb");
+        if (!file) {
+            fprintf(stderr, "Failed to write %s\n", path.c_str());
+            return false;
+        }
+        fwrite(shader.wgsl, 1, strlen(shader.wgsl), file);
+        if (fclose(file) != 0) {
+            fprintf(stderr, "Failed to write %s\n", path.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+bool readSpirv(const std::string& path, std::vector<uint32_t>& words) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    std::vector<uint8_t> bytes;
+    uint8_t chunk[4096];
+    size_t read;
+    while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        bytes.insert(bytes.end(), chunk, chunk + read);
+    }
+    fclose(file);
+    if (bytes.empty() || bytes.size() % 4 != 0) {
+        return false;
+    }
+    words.resize(bytes.size() / 4);
+    memcpy(words.data(), bytes.data(), bytes.size());
+    // SPIR-V magic number in host byte order
+    return words[0] == 0x07230203;
+}
+
+bool embed(const std::string& dir) {
+    std::string path = dir + "/precompiled_shaders.h";
+    FILE* out = fopen(path.c_str(), "wb");
+    if (!out) {
+        fprintf(stderr, "Failed to write %s\n", path.c_str());
+        return false;
+    }
+    fprintf(out, "// Generated by shader_tool from the WGSL in the headers; do not edit.\n\n");
+    fprintf(out, "#pragma once\n\n");
+    for (const Shader& shader : kShaders) {
+        std::string spirvPath = dir + "/" + shader.name + ".spv";
+        std::vector<uint32_t> words;
+        if (!readSpirv(spirvPath, words)) {
+            fprintf(stderr, "%s is not SPIR-V\n", spirvPath.c_str());
+            fclose(out);
+            return false;
+        }
+        fprintf(out, "const uint32_t %sSpirv[] = {", shader.name);
+        for (size_t i = 0; i < words.size(); ++i) {
+            fprintf(out, "%s0x%08x,", i % 8 ? " " : "\n    ", words[i]);
+        }
+        fprintf(out, "\n};\n\n");
+    }
+    fprintf(out, "const PrecompiledShader kPrecompiledShaders[] = {\n");
+    for (const Shader& shader : kShaders) {
+        fprintf(out, "    {0x%016llxull, %sSpirv, uint32_t(sizeof(%sSpirv) / 4)},\n",
+                (unsigned long long)wgslHash(shader.wgsl), shader.name, shader.name);
+    }
+    fprintf(out, "};\n");
+    return fclose(out) == 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    if (argc != 3 || (strcmp(argv[1], "dump") != 0 && strcmp(argv[1], "embed") != 0)) {
+        fprintf(stderr, "Usage: shader_tool dump|embed dir\n");
+        return 1;
+    }
+    bool ok = strcmp(argv[1], "dump") == 0 ? dump(argv[2]) : embed(argv[2]);
+    return ok ? 0 : 1;
+}
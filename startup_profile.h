@@ -0,0 +1,50 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+// Wall time of each phase of bringing the renderer up. Phases may overlap (a pipeline compiled
+// asynchronously while resources are allocated), so each keeps its own start.
+
+struct StartupProfile {
+    using Clock = std::chrono::steady_clock;
+
+    struct Phase {
+        const char* name;
+        Clock::time_point begin;
+        Clock::time_point end;
+    };
+
+    Clock::time_point origin = Clock::now();
+    std::vector<Phase> phases;
+
+    void add(const char* name, Clock::time_point begin, Clock::time_point end) {
+        phases.push_back({name, begin, end});
+    }
+
+    // From `origin` to the end of the last phase.
+    Clock::duration total() const {
+        Clock::time_point last = origin;
+        for (const Phase& phase : phases) {
+            last = std::max(last, phase.end);
+        }
+        return last - origin;
+    }
+
+    // One line of JSON: start and duration of every phase and the total, in milliseconds.
+    void print(FILE* out) const {
+        auto ms = [](Clock::duration d) {
+            return std::chrono::duration<double, std::milli>(d).count();
+        };
+        fprintf(out, "{\"startup\": {");
+        for (size_t i = 0; i < phases.size(); ++i) {
+            fprintf(out, "%s\"%s\": {\"start\": %.2f, \"duration\": %.2f}", i ? ", " : "",
+                    phases[i].name, ms(phases[i].begin - origin),
+                    ms(phases[i].end - phases[i].begin));
+        }
+        fprintf(out, "}, \"total\": %.2f}\n", ms(total()));
+        fflush(out);
+    }
+};
@@ -31,6 +31,8 @@ BUILDING:
    unsigned char * my_compress(unsigned char *data, int data_len, int *out_len, int quality);
    The returned data will be freed with STBIW_FREE() (free() by default),
    so it must be heap allocated with STBIW_MALLOC() (malloc() by default),
+   You can #define STBIW_NO_SIMD to disable the SSE2/NEON code paths (currently
+   used by the HDR float->RGBE conversion).
 
 UNICODE:
 
@@ -64,10 +66,30 @@ USAGE:
    where the callback is:
       void stbi_write_func(void *context, void *data, int size);
 
+   If the PNG scanlines have already been filtered elsewhere (e.g. on a GPU), only the
+   deflate and chunk framing are left to do:
+
+     int stbi_write_png_filtered_to_func(stbi_write_func *func, void *context, int w, int h, int comp, const void *filtered);
+
+   Likewise for JPEG, when color conversion, DCT and quantization have been done elsewhere,
+   only the Huffman coding is left:
+
+     int stbi_write_jpg_quant_tables(int quality, float fdtbl_y[64], float fdtbl_uv[64]);
+     int stbi_write_jpg_coefficients_to_func(stbi_write_func *func, void *context, int w, int h, const short *coefs, int quality);
+
    You can configure it with these global variables:
       int stbi_write_tga_with_rle;             // defaults to true; set to 0 to disable RLE
       int stbi_write_png_compression_level;    // defaults to 8; set to higher for more compression
       int stbi_write_force_png_filter;         // defaults to -1; set to 0..5 to force a filter mode
+      int stbi_write_buffer_size;              // defaults to 1 MB; output buffer for BMP/TGA/HDR/JPEG
+      int stbi_write_flush_scanlines;          // defaults to 0; set to 1 to flush after every scanline
+
+   BMP, TGA, HDR and JPEG output is gathered in a buffer of 'stbi_write_buffer_size'
+   bytes (allocated with STBIW_MALLOC) and handed to the write function when it fills
+   up, so a file is written with a handful of large fwrite() calls. Set it to 0 to
+   use a small fixed buffer instead. 'stbi_write_flush_scanlines' additionally
+   flushes after every BMP/TGA/HDR scanline, for callbacks that consume rows as they
+   are produced.
 
 
    You can define STBI_WRITE_NO_STDIO to disable the file variant of these
@@ -99,6 +121,11 @@ USAGE:
    PNG allows you to set the deflate compression level by setting the global
    variable 'stbi_write_png_compression_level' (it defaults to 8).
 
+   stbi_write_png_filtered_to_func takes the data exactly as it goes into the
+   zlib stream: h rows, each a filter type byte (0..4) followed by w*comp
+   filtered bytes, with no padding between rows. The filters must treat
+   pixels left of and above the image as 0, as the PNG spec does.
+
    HDR expects linear float data. Since the format is always 32-bit rgb(e)
    data, alpha (if provided) is discarded, and for monochrome data it is
    replicated across all three channels.
@@ -110,6 +137,17 @@ USAGE:
    Higher quality looks better but results in a bigger image.
    JPEG baseline (no JPEG progressive).
 
+   stbi_write_jpg_coefficients_to_func takes the quantized DCT coefficients as
+   shorts, 64 per data unit in zigzag order. Data units are grouped in MCUs in
+   raster order: at quality <= 90 an MCU covers 16x16 pixels and holds the
+   four Y units (top left, top right, bottom left, bottom right) followed by
+   one 2x2 averaged U and one V unit; above 90 it covers 8x8 pixels with one
+   Y, U and V unit each. Edge MCUs repeat the last row and column. Use
+   stbi_write_jpg_quant_tables for the divisors that match `quality`: the
+   coefficient at row-major position k (after an AAN DCT of Y-128, U, V with
+   the JFIF conversion) is multiplied by fdtbl[k] and rounded half away from
+   zero. It returns 1 if that quality subsamples the chroma.
+
 CREDITS:
 
 
@@ -170,6 +208,8 @@ LICENSE
 STBIWDEF int stbi_write_tga_with_rle;
 STBIWDEF int stbi_write_png_compression_level;
 STBIWDEF int stbi_write_force_png_filter;
+STBIWDEF int stbi_write_buffer_size;
+STBIWDEF int stbi_write_flush_scanlines;
 #endif
 
 #ifndef STBI_WRITE_NO_STDIO
@@ -191,6 +231,9 @@ STBIWDEF int stbi_write_bmp_to_func(stbi_write_func *func, void *context, int w,
 STBIWDEF int stbi_write_tga_to_func(stbi_write_func *func, void *context, int w, int h, int comp, const void  *data);
 STBIWDEF int stbi_write_hdr_to_func(stbi_write_func *func, void *context, int w, int h, int comp, const float *data);
 STBIWDEF int stbi_write_jpg_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void  *data, int quality);
+STBIWDEF int stbi_write_png_filtered_to_func(stbi_write_func *func, void *context, int w, int h, int comp, const void *filtered);
+STBIWDEF int stbi_write_jpg_quant_tables(int quality, float fdtbl_y[64], float fdtbl_uv[64]);
+STBIWDEF int stbi_write_jpg_coefficients_to_func(stbi_write_func *func, void *context, int w, int h, const short *coefs, int quality);
 
 STBIWDEF void stbi_flip_vertically_on_write(int flip_boolean);
 
@@ -247,14 +290,28 @@ STBIWDEF void stbi_flip_vertically_on_write(int flip_boolean);
 
 #define STBIW_UCHAR(x) (unsigned char) ((x) & 0xff)
 
+#ifndef STBIW_NO_SIMD
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define STBIW_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define STBIW_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
 #ifdef STB_IMAGE_WRITE_STATIC
 static int stbi_write_png_compression_level = 8;
 static int stbi_write_tga_with_rle = 1;
 static int stbi_write_force_png_filter = -1;
+static int stbi_write_buffer_size = 1 << 20;
+static int stbi_write_flush_scanlines = 0;
 #else
 int stbi_write_png_compression_level = 8;
 int stbi_write_tga_with_rle = 1;
 int stbi_write_force_png_filter = -1;
+int stbi_write_buffer_size = 1 << 20;
+int stbi_write_flush_scanlines = 0;
 #endif
 
 static int stbi__flip_vertically_on_write = 0;
@@ -268,8 +325,10 @@ typedef struct
 {
    stbi_write_func *func;
    void *context;
-   unsigned char buffer[64];
+   unsigned char *buffer;
+   int buf_size;
    int buf_used;
+   unsigned char small_buffer[64];
 } stbi__write_context;
 
 // initialize a callback-based context
@@ -277,6 +336,33 @@ static void stbi__start_write_callbacks(stbi__write_context *s, stbi_write_func
 {
    s->func    = c;
    s->context = context;
+   s->buffer  = s->small_buffer;
+   s->buf_size = sizeof(s->small_buffer);
+   s->buf_used = 0;
+   if (stbi_write_buffer_size > (int) sizeof(s->small_buffer)) {
+      unsigned char *b = (unsigned char *) STBIW_MALLOC(stbi_write_buffer_size);
+      if (b) { // fall back to the small buffer if the allocation fails
+         s->buffer = b;
+         s->buf_size = stbi_write_buffer_size;
+      }
+   }
+}
+
+static void stbiw__write_flush(stbi__write_context *s)
+{
+   if (s->buf_used) {
+      s->func(s->context, s->buffer, s->buf_used);
+      s->buf_used = 0;
+   }
+}
+
+// flush any pending output and release the buffer
+static void stbi__end_write_callbacks(stbi__write_context *s)
+{
+   stbiw__write_flush(s);
+   if (s->buffer != s->small_buffer)
+      STBIW_FREE(s->buffer);
+   s->buffer = s->small_buffer;
 }
 
 #ifndef STBI_WRITE_NO_STDIO
@@ -332,12 +418,18 @@ static FILE *stbiw__fopen(char const *filename, char const *mode)
 static int stbi__start_write_file(stbi__write_context *s, const char *filename)
 {
    FILE *f = stbiw__fopen(filename, "wb");
+   if (!f)
+      return 0;
    stbi__start_write_callbacks(s, stbi__stdio_write, (void *) f);
-   return f != NULL;
+   // we already buffer; don't copy everything a second time through the FILE buffer
+   if (s->buffer != s->small_buffer)
+      setvbuf(f, NULL, _IONBF, 0);
+   return 1;
 }
 
 static void stbi__end_write_file(stbi__write_context *s)
 {
+   stbi__end_write_callbacks(s);
    fclose((FILE *)s->context);
 }
 
@@ -346,19 +438,32 @@ static void stbi__end_write_file(stbi__write_context *s)
 typedef unsigned int stbiw_uint32;
 typedef int stb_image_write_test[sizeof(stbiw_uint32)==4 ? 1 : -1];
 
+static void stbiw__write(stbi__write_context *s, const void *data, int size)
+{
+   if (s->buf_used + size > s->buf_size) {
+      stbiw__write_flush(s);
+      if (size > s->buf_size) { // too big to be worth copying
+         s->func(s->context, (void *) data, size);
+         return;
+      }
+   }
+   memcpy(s->buffer + s->buf_used, data, size);
+   s->buf_used += size;
+}
+
 static void stbiw__writefv(stbi__write_context *s, const char *fmt, va_list v)
 {
    while (*fmt) {
       switch (*fmt++) {
          case ' ': break;
          case '1': { unsigned char x = STBIW_UCHAR(va_arg(v, int));
-                     s->func(s->context,&x,1);
+                     stbiw__write(s,&x,1);
                      break; }
          case '2': { int x = va_arg(v,int);
                      unsigned char b[2];
                      b[0] = STBIW_UCHAR(x);
                      b[1] = STBIW_UCHAR(x>>8);
-                     s->func(s->context,b,2);
+                     stbiw__write(s,b,2);
                      break; }
          case '4': { stbiw_uint32 x = va_arg(v,int);
                      unsigned char b[4];
@@ -366,7 +471,7 @@ static void stbiw__writefv(stbi__write_context *s, const char *fmt, va_list v)
                      b[1]=STBIW_UCHAR(x>>8);
                      b[2]=STBIW_UCHAR(x>>16);
                      b[3]=STBIW_UCHAR(x>>24);
-                     s->func(s->context,b,4);
+                     stbiw__write(s,b,4);
                      break; }
          default:
             STBIW_ASSERT(0);
@@ -383,75 +488,85 @@ static void stbiw__writef(stbi__write_context *s, const char *fmt, ...)
    va_end(v);
 }
 
-static void stbiw__write_flush(stbi__write_context *s)
-{
-   if (s->buf_used) {
-      s->func(s->context, &s->buffer, s->buf_used);
-      s->buf_used = 0;
-   }
-}
-
-static void stbiw__putc(stbi__write_context *s, unsigned char c)
-{
-   s->func(s->context, &c, 1);
-}
-
 static void stbiw__write1(stbi__write_context *s, unsigned char a)
 {
-   if ((size_t)s->buf_used + 1 > sizeof(s->buffer))
+   if (s->buf_used + 1 > s->buf_size)
       stbiw__write_flush(s);
    s->buffer[s->buf_used++] = a;
 }
 
-static void stbiw__write3(stbi__write_context *s, unsigned char a, unsigned char b, unsigned char c)
+static void stbiw__putc(stbi__write_context *s, unsigned char c)
 {
-   int n;
-   if ((size_t)s->buf_used + 3 > sizeof(s->buffer))
-      stbiw__write_flush(s);
-   n = s->buf_used;
-   s->buf_used = n+3;
-   s->buffer[n+0] = a;
-   s->buffer[n+1] = b;
-   s->buffer[n+2] = c;
+   stbiw__write1(s, c);
 }
 
-static void stbiw__write_pixel(stbi__write_context *s, int rgb_dir, int comp, int write_alpha, int expand_mono, unsigned char *d)
+static unsigned char *stbiw__encode_pixel(unsigned char *o, int rgb_dir, int comp, int write_alpha, int expand_mono, unsigned char *d)
 {
    unsigned char bg[3] = { 255, 0, 255}, px[3];
    int k;
 
    if (write_alpha < 0)
-      stbiw__write1(s, d[comp - 1]);
+      *o++ = d[comp - 1];
 
    switch (comp) {
       case 2: // 2 pixels = mono + alpha, alpha is written separately, so same as 1-channel case
       case 1:
-         if (expand_mono)
-            stbiw__write3(s, d[0], d[0], d[0]); // monochrome bmp
-         else
-            stbiw__write1(s, d[0]);  // monochrome TGA
+         if (expand_mono) {
+            o[0] = o[1] = o[2] = d[0]; // monochrome bmp
+            o += 3;
+         } else
+            *o++ = d[0];  // monochrome TGA
          break;
       case 4:
          if (!write_alpha) {
             // composite against pink background
             for (k = 0; k < 3; ++k)
                px[k] = bg[k] + ((d[k] - bg[k]) * d[3]) / 255;
-            stbiw__write3(s, px[1 - rgb_dir], px[1], px[1 + rgb_dir]);
+            o[0] = px[1 - rgb_dir]; o[1] = px[1]; o[2] = px[1 + rgb_dir];
+            o += 3;
             break;
          }
          /* FALLTHROUGH */
       case 3:
-         stbiw__write3(s, d[1 - rgb_dir], d[1], d[1 + rgb_dir]);
+         o[0] = d[1 - rgb_dir]; o[1] = d[1]; o[2] = d[1 + rgb_dir];
+         o += 3;
          break;
    }
    if (write_alpha > 0)
-      stbiw__write1(s, d[comp - 1]);
+      *o++ = d[comp - 1];
+   return o;
+}
+
+static void stbiw__write_pixel(stbi__write_context *s, int rgb_dir, int comp, int write_alpha, int expand_mono, unsigned char *d)
+{
+   unsigned char px[4];
+   stbiw__write(s, px, (int) (stbiw__encode_pixel(px, rgb_dir, comp, write_alpha, expand_mono, d) - px));
+}
+
+// encode a row of x pixels into o; the common RGB/RGBA layouts get a loop without the per-pixel switch
+static unsigned char *stbiw__encode_row(unsigned char *o, int rgb_dir, int comp, int write_alpha, int expand_mono, unsigned char *d, int x)
+{
+   int i;
+   if (comp == 3 && !write_alpha) {
+      for (i=0; i < x; ++i, d += 3, o += 3) {
+         o[0] = d[1 - rgb_dir]; o[1] = d[1]; o[2] = d[1 + rgb_dir];
+      }
+   } else if (comp == 4 && write_alpha > 0) {
+      for (i=0; i < x; ++i, d += 4, o += 4) {
+         o[0] = d[1 - rgb_dir]; o[1] = d[1]; o[2] = d[1 + rgb_dir]; o[3] = d[3];
+      }
+   } else {
+      for (i=0; i < x; ++i, d += comp)
+         o = stbiw__encode_pixel(o, rgb_dir, comp, write_alpha, expand_mono, d);
+   }
+   return o;
 }
 
 static void stbiw__write_pixels(stbi__write_context *s, int rgb_dir, int vdir, int x, int y, int comp, void *data, int write_alpha, int scanline_pad, int expand_mono)
 {
    stbiw_uint32 zero = 0;
    int i,j, j_end;
+   int row_bytes = x * (((comp >= 3 || expand_mono) ? 3 : 1) + (write_alpha ? 1 : 0)) + scanline_pad;
 
    if (y <= 0)
       return;
@@ -466,12 +581,22 @@ static void stbiw__write_pixels(stbi__write_context *s, int rgb_dir, int vdir, i
    }
 
    for (; j != j_end; j += vdir) {
-      for (i=0; i < x; ++i) {
-         unsigned char *d = (unsigned char *) data + (j*x+i)*comp;
-         stbiw__write_pixel(s, rgb_dir, comp, write_alpha, expand_mono, d);
+      unsigned char *d = (unsigned char *) data + j*x*comp;
+      if (row_bytes <= s->buf_size) {
+         // build the whole scanline in place in the output buffer
+         unsigned char *o;
+         if (s->buf_used + row_bytes > s->buf_size)
+            stbiw__write_flush(s);
+         o = stbiw__encode_row(s->buffer + s->buf_used, rgb_dir, comp, write_alpha, expand_mono, d, x);
+         memset(o, 0, scanline_pad);
+         s->buf_used += row_bytes;
+      } else {
+         for (i=0; i < x; ++i)
+            stbiw__write_pixel(s, rgb_dir, comp, write_alpha, expand_mono, d + i*comp);
+         stbiw__write(s, &zero, scanline_pad);
       }
-      stbiw__write_flush(s);
-      s->func(s->context, &zero, scanline_pad);
+      if (stbi_write_flush_scanlines)
+         stbiw__write_flush(s);
    }
 }
 
@@ -512,8 +637,11 @@ static int stbi_write_bmp_core(stbi__write_context *s, int x, int y, int comp, c
 STBIWDEF int stbi_write_bmp_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void *data)
 {
    stbi__write_context s = {};
+   int r;
    stbi__start_write_callbacks(&s, func, context);
-   return stbi_write_bmp_core(&s, x, y, comp, data);
+   r = stbi_write_bmp_core(&s, x, y, comp, data);
+   stbi__end_write_callbacks(&s);
+   return r;
 }
 
 #ifndef STBI_WRITE_NO_STDIO
@@ -602,6 +730,8 @@ static int stbi_write_tga_core(stbi__write_context *s, int x, int y, int comp, v
                stbiw__write_pixel(s, -1, comp, has_alpha, 0, begin);
             }
          }
+         if (stbi_write_flush_scanlines)
+            stbiw__write_flush(s);
       }
       stbiw__write_flush(s);
    }
@@ -611,8 +741,11 @@ static int stbi_write_tga_core(stbi__write_context *s, int x, int y, int comp, v
 STBIWDEF int stbi_write_tga_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void *data)
 {
    stbi__write_context s = {};
+   int r;
    stbi__start_write_callbacks(&s, func, context);
-   return stbi_write_tga_core(&s, x, y, comp, (void *) data);
+   r = stbi_write_tga_core(&s, x, y, comp, (void *) data);
+   stbi__end_write_callbacks(&s);
+   return r;
 }
 
 #ifndef STBI_WRITE_NO_STDIO
@@ -636,87 +769,154 @@ STBIWDEF int stbi_write_tga(char const *filename, int x, int y, int comp, const
 
 #ifndef STBI_WRITE_NO_STDIO
 
+// The exponent is taken straight from the IEEE bits instead of calling frexp():
+// for a normal float m*2^e with m in [0.5,1) the biased exponent field is e+126,
+// so the RGBE exponent byte (e+128) is field+2, and the 256/2^e normalizer is the
+// power of two whose exponent field is 261-field. Both are exact, so the output
+// is bit-identical to the frexp() version.
 static void stbiw__linear_to_rgbe(unsigned char *rgbe, float *linear)
 {
-   int exponent;
    float maxcomp = stbiw__max(linear[0], stbiw__max(linear[1], linear[2]));
 
    if (maxcomp < 1e-32f) {
       rgbe[0] = rgbe[1] = rgbe[2] = rgbe[3] = 0;
    } else {
-      float normalize = (float) frexp(maxcomp, &exponent) * 256.0f/maxcomp;
+      stbiw_uint32 bits, field;
+      float normalize;
+      memcpy(&bits, &maxcomp, 4);
+      field = (bits >> 23) & 0xff;
+      bits = (261 - field) << 23;
+      memcpy(&normalize, &bits, 4);
 
       rgbe[0] = (unsigned char)(linear[0] * normalize);
       rgbe[1] = (unsigned char)(linear[1] * normalize);
       rgbe[2] = (unsigned char)(linear[2] * normalize);
-      rgbe[3] = (unsigned char)(exponent + 128);
+      rgbe[3] = (unsigned char)(field + 2);
    }
 }
 
-static void stbiw__write_run_data(stbi__write_context *s, int length, unsigned char databyte)
+// convert a scanline to RGBE, stored planar (all R, then all G, B and E) in scratch
+static void stbiw__linear_to_rgbe_planar(unsigned char *scratch, int width, int ncomp, float *scanline)
+{
+   unsigned char rgbe[4];
+   float linear[3];
+   int x = 0;
+
+#if defined(STBIW_SSE2) || defined(STBIW_NEON)
+   // 4 pixels at a time; packed ends up as r0..r3 g0..g3 b0..b3 e0..e3. The exponent is
+   // masked to 8 bits before packing so that it wraps like the scalar cast does (to 0 for
+   // maxcomp >= 2^127) instead of saturating. Non-finite colors have no RGBE encoding; their
+   // mantissa bytes differ between the paths just as the scalar float->uchar cast is undefined.
+   for (; x+4 <= width; x += 4) {
+      float r[4], g[4], b[4];
+      unsigned char packed[16];
+      int k;
+      for (k=0; k < 4; ++k) {
+         float *p = scanline + (x+k)*ncomp;
+         if (ncomp >= 3) {
+            r[k] = p[0]; g[k] = p[1]; b[k] = p[2];
+         } else {
+            r[k] = g[k] = b[k] = p[0];
+         }
+      }
+#ifdef STBIW_SSE2
+      {
+         __m128 vr = _mm_loadu_ps(r), vg = _mm_loadu_ps(g), vb = _mm_loadu_ps(b);
+         __m128 maxc = _mm_max_ps(vr, _mm_max_ps(vg, vb));
+         __m128i field = _mm_and_si128(_mm_srli_epi32(_mm_castps_si128(maxc), 23), _mm_set1_epi32(0xff));
+         __m128 norm = _mm_castsi128_ps(_mm_slli_epi32(_mm_sub_epi32(_mm_set1_epi32(261), field), 23));
+         __m128i keep = _mm_castps_si128(_mm_cmpge_ps(maxc, _mm_set1_ps(1e-32f)));
+         __m128i ir = _mm_and_si128(_mm_cvttps_epi32(_mm_mul_ps(vr, norm)), keep);
+         __m128i ig = _mm_and_si128(_mm_cvttps_epi32(_mm_mul_ps(vg, norm)), keep);
+         __m128i ib = _mm_and_si128(_mm_cvttps_epi32(_mm_mul_ps(vb, norm)), keep);
+         __m128i ie = _mm_and_si128(_mm_add_epi32(field, _mm_set1_epi32(2)), _mm_and_si128(keep, _mm_set1_epi32(0xff)));
+         __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(ir, ig), _mm_packs_epi32(ib, ie));
+         _mm_storeu_si128((__m128i *) packed, bytes);
+      }
+#else
+      {
+         float32x4_t vr = vld1q_f32(r), vg = vld1q_f32(g), vb = vld1q_f32(b);
+         float32x4_t maxc = vmaxq_f32(vr, vmaxq_f32(vg, vb));
+         uint32x4_t field = vandq_u32(vshrq_n_u32(vreinterpretq_u32_f32(maxc), 23), vdupq_n_u32(0xff));
+         float32x4_t norm = vreinterpretq_f32_u32(vshlq_n_u32(vsubq_u32(vdupq_n_u32(261), field), 23));
+         uint32x4_t keep = vcgeq_f32(maxc, vdupq_n_f32(1e-32f));
+         uint32x4_t ir = vandq_u32(vcvtq_u32_f32(vmulq_f32(vr, norm)), keep);
+         uint32x4_t ig = vandq_u32(vcvtq_u32_f32(vmulq_f32(vg, norm)), keep);
+         uint32x4_t ib = vandq_u32(vcvtq_u32_f32(vmulq_f32(vb, norm)), keep);
+         uint32x4_t ie = vandq_u32(vaddq_u32(field, vdupq_n_u32(2)), vandq_u32(keep, vdupq_n_u32(0xff)));
+         uint16x8_t rg = vcombine_u16(vqmovn_u32(ir), vqmovn_u32(ig));
+         uint16x8_t be = vcombine_u16(vqmovn_u32(ib), vqmovn_u32(ie));
+         vst1q_u8(packed, vcombine_u8(vqmovn_u16(rg), vqmovn_u16(be)));
+      }
+#endif
+      memcpy(scratch + x + width*0, packed + 0,  4);
+      memcpy(scratch + x + width*1, packed + 4,  4);
+      memcpy(scratch + x + width*2, packed + 8,  4);
+      memcpy(scratch + x + width*3, packed + 12, 4);
+   }
+#endif
+
+   for (; x < width; x++) {
+      switch (ncomp) {
+         case 4: /* fallthrough */
+         case 3: linear[2] = scanline[x*ncomp + 2];
+                 linear[1] = scanline[x*ncomp + 1];
+                 linear[0] = scanline[x*ncomp + 0];
+                 break;
+         default:
+                 linear[0] = linear[1] = linear[2] = scanline[x*ncomp + 0];
+                 break;
+      }
+      stbiw__linear_to_rgbe(rgbe, linear);
+      scratch[x + width*0] = rgbe[0];
+      scratch[x + width*1] = rgbe[1];
+      scratch[x + width*2] = rgbe[2];
+      scratch[x + width*3] = rgbe[3];
+   }
+}
+
+static unsigned char *stbiw__write_run_data(unsigned char *o, int length, unsigned char databyte)
 {
-   unsigned char lengthbyte = STBIW_UCHAR(length+128);
    STBIW_ASSERT(length+128 <= 255);
-   s->func(s->context, &lengthbyte, 1);
-   s->func(s->context, &databyte, 1);
+   *o++ = STBIW_UCHAR(length+128);
+   *o++ = databyte;
+   return o;
 }
 
-static void stbiw__write_dump_data(stbi__write_context *s, int length, unsigned char *data)
+static unsigned char *stbiw__write_dump_data(unsigned char *o, int length, unsigned char *data)
 {
-   unsigned char lengthbyte = STBIW_UCHAR(length);
    STBIW_ASSERT(length <= 128); // inconsistent with spec but consistent with official code
-   s->func(s->context, &lengthbyte, 1);
-   s->func(s->context, data, length);
+   *o++ = STBIW_UCHAR(length);
+   memcpy(o, data, length);
+   return o + length;
 }
 
-static void stbiw__write_hdr_scanline(stbi__write_context *s, int width, int ncomp, unsigned char *scratch, float *scanline)
+// worst case RLE output for one scanline: header plus 2 bytes per pixel per component
+#define stbiw__hdr_scanline_bound(width)  (4 + (width)*8)
+
+// scratch holds width*4 planar RGBE bytes, out holds stbiw__hdr_scanline_bound(width) bytes;
+// the whole encoded scanline is added to the output buffer in one call
+static void stbiw__write_hdr_scanline(stbi__write_context *s, int width, int ncomp, unsigned char *scratch, unsigned char *out, float *scanline)
 {
-   unsigned char scanlineheader[4] = { 2, 2, 0, 0 };
-   unsigned char rgbe[4];
-   float linear[3];
+   unsigned char *o = out;
    int x;
 
-   scanlineheader[2] = (width&0xff00)>>8;
-   scanlineheader[3] = (width&0x00ff);
+   stbiw__linear_to_rgbe_planar(scratch, width, ncomp, scanline);
 
    /* skip RLE for images too small or large */
    if (width < 8 || width >= 32768) {
       for (x=0; x < width; x++) {
-         switch (ncomp) {
-            case 4: /* fallthrough */
-            case 3: linear[2] = scanline[x*ncomp + 2];
-                    linear[1] = scanline[x*ncomp + 1];
-                    linear[0] = scanline[x*ncomp + 0];
-                    break;
-            default:
-                    linear[0] = linear[1] = linear[2] = scanline[x*ncomp + 0];
-                    break;
-         }
-         stbiw__linear_to_rgbe(rgbe, linear);
-         s->func(s->context, rgbe, 4);
+         *o++ = scratch[x + width*0];
+         *o++ = scratch[x + width*1];
+         *o++ = scratch[x + width*2];
+         *o++ = scratch[x + width*3];
       }
    } else {
       int c,r;
-      /* encode into scratch buffer */
-      for (x=0; x < width; x++) {
-         switch(ncomp) {
-            case 4: /* fallthrough */
-            case 3: linear[2] = scanline[x*ncomp + 2];
-                    linear[1] = scanline[x*ncomp + 1];
-                    linear[0] = scanline[x*ncomp + 0];
-                    break;
-            default:
-                    linear[0] = linear[1] = linear[2] = scanline[x*ncomp + 0];
-                    break;
-         }
-         stbiw__linear_to_rgbe(rgbe, linear);
-         scratch[x + width*0] = rgbe[0];
-         scratch[x + width*1] = rgbe[1];
-         scratch[x + width*2] = rgbe[2];
-         scratch[x + width*3] = rgbe[3];
-      }
-
-      s->func(s->context, scanlineheader, 4);
+      *o++ = 2;
+      *o++ = 2;
+      *o++ = STBIW_UCHAR(width >> 8);
+      *o++ = STBIW_UCHAR(width);
 
       /* RLE each component separately */
       for (c=0; c < 4; c++) {
@@ -737,7 +937,7 @@ static void stbiw__write_hdr_scanline(stbi__write_context *s, int width, int nco
             while (x < r) {
                int len = r-x;
                if (len > 128) len = 128;
-               stbiw__write_dump_data(s, len, &comp[x]);
+               o = stbiw__write_dump_data(o, len, &comp[x]);
                x += len;
             }
             // if there's a run, output it
@@ -749,13 +949,17 @@ static void stbiw__write_hdr_scanline(stbi__write_context *s, int width, int nco
                while (x < r) {
                   int len = r-x;
                   if (len > 127) len = 127;
-                  stbiw__write_run_data(s, len, comp[x]);
+                  o = stbiw__write_run_data(o, len, comp[x]);
                   x += len;
                }
             }
          }
       }
    }
+   STBIW_ASSERT(o - out <= stbiw__hdr_scanline_bound(width));
+   stbiw__write(s, out, (int) (o - out));
+   if (stbi_write_flush_scanlines)
+      stbiw__write_flush(s);
 }
 
 static int stbi_write_hdr_core(stbi__write_context *s, int x, int y, int comp, float *data)
@@ -763,22 +967,24 @@ static int stbi_write_hdr_core(stbi__write_context *s, int x, int y, int comp, f
    if (y <= 0 || x <= 0 || data == NULL)
       return 0;
    else {
-      // Each component is stored separately. Allocate scratch space for full output scanline.
-      unsigned char *scratch = (unsigned char *) STBIW_MALLOC(x*4);
+      // Each component is stored separately. Allocate scratch space for the planar RGBE
+      // scanline, followed by room for the encoded scanline.
+      unsigned char *scratch = (unsigned char *) STBIW_MALLOC(x*4 + stbiw__hdr_scanline_bound(x));
       int i, len;
       char buffer[128];
       char header[] = "#?RADIANCE\n# Written by stb_image_write.h\nFORMAT=32-bit_rle_rgbe\n";
-      s->func(s->context, header, sizeof(header)-1);
+      if (!scratch) return 0;
+      stbiw__write(s, header, sizeof(header)-1);
 
 #if defined(_WIN32) && defined(__STDC_WANT_SECURE_LIB__)
       len = sprintf_s(buffer, sizeof(buffer), "EXPOSURE=          1.0000000000000\n\n-Y %d +X %d\n", y, x);
 #else
       len = sprintf(buffer, "EXPOSURE=          1.0000000000000\n\n-Y %d +X %d\n", y, x);
 #endif
-      s->func(s->context, buffer, len);
+      stbiw__write(s, buffer, len);
 
       for(i=0; i < y; i++)
-         stbiw__write_hdr_scanline(s, x, comp, scratch, data + comp*x*(stbi__flip_vertically_on_write ? y-1-i : i));
+         stbiw__write_hdr_scanline(s, x, comp, scratch, scratch + x*4, data + comp*x*(stbi__flip_vertically_on_write ? y-1-i : i));
       STBIW_FREE(scratch);
       return 1;
    }
@@ -787,8 +993,11 @@ static int stbi_write_hdr_core(stbi__write_context *s, int x, int y, int comp, f
 STBIWDEF int stbi_write_hdr_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const float *data)
 {
    stbi__write_context s = {};
+   int r;
    stbi__start_write_callbacks(&s, func, context);
-   return stbi_write_hdr_core(&s, x, y, comp, (float *) data);
+   r = stbi_write_hdr_core(&s, x, y, comp, (float *) data);
+   stbi__end_write_callbacks(&s);
+   return r;
 }
 
 STBIWDEF int stbi_write_hdr(char const *filename, int x, int y, int comp, const float *data)
@@ -1125,14 +1334,57 @@ static void stbiw__encode_png_line(unsigned char *pixels, int stride_bytes, int
    }
 }
 
-STBIWDEF unsigned char *stbi_write_png_to_mem(const unsigned char *pixels, int stride_bytes, int x, int y, int n, int *out_len)
+// compresses already filtered scanlines and wraps them in the PNG chunks
+static unsigned char *stbiw__png_from_filtered(const unsigned char *filt, int x, int y, int n, int *out_len)
 {
-   int force_filter = stbi_write_force_png_filter;
    int ctype[5] = { -1, 0, 4, 2, 6 };
    unsigned char sig[8] = { 137,80,78,71,13,10,26,10 };
-   unsigned char *out,*o, *filt, *zlib;
+   unsigned char *out,*o, *zlib;
+   int zlen;
+
+   zlib = stbi_zlib_compress((unsigned char *) filt, y*( x*n+1), &zlen, stbi_write_png_compression_level);
+   if (!zlib) return 0;
+
+   // each tag requires 12 bytes of overhead
+   out = (unsigned char *) STBIW_MALLOC(8 + 12+13 + 12+zlen + 12);
+   if (!out) return 0;
+   *out_len = 8 + 12+13 + 12+zlen + 12;
+
+   o=out;
+   STBIW_MEMMOVE(o,sig,8); o+= 8;
+   stbiw__wp32(o, 13); // header length
+   stbiw__wptag(o, "IHDR");
+   stbiw__wp32(o, x);
+   stbiw__wp32(o, y);
+   *o++ = 8;
+   *o++ = STBIW_UCHAR(ctype[n]);
+   *o++ = 0;
+   *o++ = 0;
+   *o++ = 0;
+   stbiw__wpcrc(&o,13);
+
+   stbiw__wp32(o, zlen);
+   stbiw__wptag(o, "IDAT");
+   STBIW_MEMMOVE(o, zlib, zlen);
+   o += zlen;
+   STBIW_FREE(zlib);
+   stbiw__wpcrc(&o, zlen);
+
+   stbiw__wp32(o,0);
+   stbiw__wptag(o, "IEND");
+   stbiw__wpcrc(&o,0);
+
+   STBIW_ASSERT(o == out + *out_len);
+
+   return out;
+}
+
+STBIWDEF unsigned char *stbi_write_png_to_mem(const unsigned char *pixels, int stride_bytes, int x, int y, int n, int *out_len)
+{
+   int force_filter = stbi_write_force_png_filter;
+   unsigned char *out, *filt;
    signed char *line_buffer;
-   int j,zlen;
+   int j;
 
    if (stride_bytes == 0)
       stride_bytes = x * n;
@@ -1173,41 +1425,8 @@ STBIWDEF unsigned char *stbi_write_png_to_mem(const unsigned char *pixels, int s
       STBIW_MEMMOVE(filt+j*(x*n+1)+1, line_buffer, x*n);
    }
    STBIW_FREE(line_buffer);
-   zlib = stbi_zlib_compress(filt, y*( x*n+1), &zlen, stbi_write_png_compression_level);
+   out = stbiw__png_from_filtered(filt, x, y, n, out_len);
    STBIW_FREE(filt);
-   if (!zlib) return 0;
-
-   // each tag requires 12 bytes of overhead
-   out = (unsigned char *) STBIW_MALLOC(8 + 12+13 + 12+zlen + 12);
-   if (!out) return 0;
-   *out_len = 8 + 12+13 + 12+zlen + 12;
-
-   o=out;
-   STBIW_MEMMOVE(o,sig,8); o+= 8;
-   stbiw__wp32(o, 13); // header length
-   stbiw__wptag(o, "IHDR");
-   stbiw__wp32(o, x);
-   stbiw__wp32(o, y);
-   *o++ = 8;
-   *o++ = STBIW_UCHAR(ctype[n]);
-   *o++ = 0;
-   *o++ = 0;
-   *o++ = 0;
-   stbiw__wpcrc(&o,13);
-
-   stbiw__wp32(o, zlen);
-   stbiw__wptag(o, "IDAT");
-   STBIW_MEMMOVE(o, zlib, zlen);
-   o += zlen;
-   STBIW_FREE(zlib);
-   stbiw__wpcrc(&o, zlen);
-
-   stbiw__wp32(o,0);
-   stbiw__wptag(o, "IEND");
-   stbiw__wpcrc(&o,0);
-
-   STBIW_ASSERT(o == out + *out_len);
-
    return out;
 }
 
@@ -1238,6 +1457,16 @@ STBIWDEF int stbi_write_png_to_func(stbi_write_func *func, void *context, int x,
    return 1;
 }
 
+STBIWDEF int stbi_write_png_filtered_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void *filtered)
+{
+   int len;
+   unsigned char *png = stbiw__png_from_filtered((const unsigned char *) filtered, x, y, comp, &len);
+   if (png == NULL) return 0;
+   func(context, png, len);
+   STBIW_FREE(png);
+   return 1;
+}
+
 
 /* ***************************************************************************
  *
@@ -1325,11 +1554,9 @@ static void stbiw__jpg_calcBits(int val, unsigned short bits[2]) {
    bits[0] = val & ((1<<bits[1])-1);
 }
 
-static int stbiw__jpg_processDU(stbi__write_context *s, int *bitBuf, int *bitCnt, float *CDU, int du_stride, float *fdtbl, int DC, const unsigned short HTDC[256][2], const unsigned short HTAC[256][2]) {
-   const unsigned short EOB[2] = { HTAC[0x00][0], HTAC[0x00][1] };
-   const unsigned short M16zeroes[2] = { HTAC[0xF0][0], HTAC[0xF0][1] };
-   int dataOff, i, j, n, diff, end0pos, x, y;
-   int DU[64];
+// DCT, quantization and zigzag ordering of one data unit
+static void stbiw__jpg_quantizeDU(float *CDU, int du_stride, const float *fdtbl, int DU[64]) {
+   int dataOff, i, j, n, x, y;
 
    // DCT rows
    for(dataOff=0, n=du_stride*8; dataOff<n; dataOff+=du_stride) {
@@ -1351,6 +1578,13 @@ static int stbiw__jpg_processDU(stbi__write_context *s, int *bitBuf, int *bitCnt
          DU[stbiw__jpg_ZigZag[j]] = (int)(v < 0 ? v - 0.5f : v + 0.5f);
       }
    }
+}
+
+// Huffman coding of one quantized, zigzag ordered data unit; returns its DC
+static int stbiw__jpg_encodeDU(stbi__write_context *s, int *bitBuf, int *bitCnt, const int DU[64], int DC, const unsigned short HTDC[256][2], const unsigned short HTAC[256][2]) {
+   const unsigned short EOB[2] = { HTAC[0x00][0], HTAC[0x00][1] };
+   const unsigned short M16zeroes[2] = { HTAC[0xF0][0], HTAC[0xF0][1] };
+   int i, diff, end0pos;
 
    // Encode DC
    diff = DU[0] - DC;
@@ -1395,7 +1629,62 @@ static int stbiw__jpg_processDU(stbi__write_context *s, int *bitBuf, int *bitCnt
    return DU[0];
 }
 
-static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, int comp, const void* data, int quality) {
+static int stbiw__jpg_processDU(stbi__write_context *s, int *bitBuf, int *bitCnt, float *CDU, int du_stride, float *fdtbl, int DC, const unsigned short HTDC[256][2], const unsigned short HTAC[256][2]) {
+   int DU[64];
+   stbiw__jpg_quantizeDU(CDU, du_stride, fdtbl, DU);
+   return stbiw__jpg_encodeDU(s, bitBuf, bitCnt, DU, DC, HTDC, HTAC);
+}
+
+// data unit that was quantized elsewhere, as 64 shorts in zigzag order
+static int stbiw__jpg_processCoefs(stbi__write_context *s, int *bitBuf, int *bitCnt, const short *coefs, int DC, const unsigned short HTDC[256][2], const unsigned short HTAC[256][2]) {
+   int DU[64], i;
+   for(i = 0; i < 64; ++i) {
+      DU[i] = coefs[i];
+   }
+   return stbiw__jpg_encodeDU(s, bitBuf, bitCnt, DU, DC, HTDC, HTAC);
+}
+
+// Quantization tables for `quality` (0 = the default of 90), as written to the file (YTable,
+// UVTable, zigzag order) and as divisors folded with the AAN DCT scale factors (fdtbl_*, row
+// major). Returns 1 if the chroma is subsampled 2x2 at this quality.
+static int stbiw__jpg_tables(int quality, unsigned char YTable[64], unsigned char UVTable[64], float fdtbl_Y[64], float fdtbl_UV[64]) {
+   static const int YQT[] = {16,11,10,16,24,40,51,61,12,12,14,19,26,58,60,55,14,13,16,24,40,57,69,56,14,17,22,29,51,87,80,62,18,22,
+                             37,56,68,109,103,77,24,35,55,64,81,104,113,92,49,64,78,87,103,121,120,101,72,92,95,98,112,100,103,99};
+   static const int UVQT[] = {17,18,24,47,99,99,99,99,18,21,26,66,99,99,99,99,24,26,56,99,99,99,99,99,47,66,99,99,99,99,99,99,
+                              99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99};
+   static const float aasf[] = { 1.0f * 2.828427125f, 1.387039845f * 2.828427125f, 1.306562965f * 2.828427125f, 1.175875602f * 2.828427125f,
+                                 1.0f * 2.828427125f, 0.785694958f * 2.828427125f, 0.541196100f * 2.828427125f, 0.275899379f * 2.828427125f };
+   int row, col, i, k, subsample;
+
+   quality = quality ? quality : 90;
+   subsample = quality <= 90 ? 1 : 0;
+   quality = quality < 1 ? 1 : quality > 100 ? 100 : quality;
+   quality = quality < 50 ? 5000 / quality : 200 - quality * 2;
+
+   for(i = 0; i < 64; ++i) {
+      int uvti, yti = (YQT[i]*quality+50)/100;
+      YTable[stbiw__jpg_ZigZag[i]] = (unsigned char) (yti < 1 ? 1 : yti > 255 ? 255 : yti);
+      uvti = (UVQT[i]*quality+50)/100;
+      UVTable[stbiw__jpg_ZigZag[i]] = (unsigned char) (uvti < 1 ? 1 : uvti > 255 ? 255 : uvti);
+   }
+
+   for(row = 0, k = 0; row < 8; ++row) {
+      for(col = 0; col < 8; ++col, ++k) {
+         fdtbl_Y[k]  = 1 / (YTable [stbiw__jpg_ZigZag[k]] * aasf[row] * aasf[col]);
+         fdtbl_UV[k] = 1 / (UVTable[stbiw__jpg_ZigZag[k]] * aasf[row] * aasf[col]);
+      }
+   }
+   return subsample;
+}
+
+STBIWDEF int stbi_write_jpg_quant_tables(int quality, float fdtbl_y[64], float fdtbl_uv[64])
+{
+   unsigned char YTable[64], UVTable[64];
+   return stbiw__jpg_tables(quality, YTable, UVTable, fdtbl_y, fdtbl_uv);
+}
+
+// With `coefs`, `data` is ignored and the data units come already quantized from there.
+static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, int comp, const void* data, const short *coefs, int quality) {
    // Constants that don't pollute global namespace
    static const unsigned char std_dc_luminance_nrcodes[] = {0,0,1,5,1,1,1,1,1,1,0,0,0,0,0,0,0};
    static const unsigned char std_dc_luminance_values[] = {0,1,2,3,4,5,6,7,8,9,10,11};
@@ -1460,39 +1749,15 @@ static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, in
       {16352,14},{65517,16},{65518,16},{65519,16},{65520,16},{65521,16},{65522,16},{65523,16},{65524,16},{65525,16},{0,0},{0,0},{0,0},{0,0},{0,0},
       {1018,10},{32707,15},{65526,16},{65527,16},{65528,16},{65529,16},{65530,16},{65531,16},{65532,16},{65533,16},{65534,16},{0,0},{0,0},{0,0},{0,0},{0,0}
    };
-   static const int YQT[] = {16,11,10,16,24,40,51,61,12,12,14,19,26,58,60,55,14,13,16,24,40,57,69,56,14,17,22,29,51,87,80,62,18,22,
-                             37,56,68,109,103,77,24,35,55,64,81,104,113,92,49,64,78,87,103,121,120,101,72,92,95,98,112,100,103,99};
-   static const int UVQT[] = {17,18,24,47,99,99,99,99,18,21,26,66,99,99,99,99,24,26,56,99,99,99,99,99,47,66,99,99,99,99,99,99,
-                              99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99};
-   static const float aasf[] = { 1.0f * 2.828427125f, 1.387039845f * 2.828427125f, 1.306562965f * 2.828427125f, 1.175875602f * 2.828427125f,
-                                 1.0f * 2.828427125f, 0.785694958f * 2.828427125f, 0.541196100f * 2.828427125f, 0.275899379f * 2.828427125f };
-
-   int row, col, i, k, subsample;
+   int row, col, subsample;
    float fdtbl_Y[64], fdtbl_UV[64];
    unsigned char YTable[64], UVTable[64];
 
-   if(!data || !width || !height || comp > 4 || comp < 1) {
+   if((!data && !coefs) || !width || !height || comp > 4 || comp < 1) {
       return 0;
    }
 
-   quality = quality ? quality : 90;
-   subsample = quality <= 90 ? 1 : 0;
-   quality = quality < 1 ? 1 : quality > 100 ? 100 : quality;
-   quality = quality < 50 ? 5000 / quality : 200 - quality * 2;
-
-   for(i = 0; i < 64; ++i) {
-      int uvti, yti = (YQT[i]*quality+50)/100;
-      YTable[stbiw__jpg_ZigZag[i]] = (unsigned char) (yti < 1 ? 1 : yti > 255 ? 255 : yti);
-      uvti = (UVQT[i]*quality+50)/100;
-      UVTable[stbiw__jpg_ZigZag[i]] = (unsigned char) (uvti < 1 ? 1 : uvti > 255 ? 255 : uvti);
-   }
-
-   for(row = 0, k = 0; row < 8; ++row) {
-      for(col = 0; col < 8; ++col, ++k) {
-         fdtbl_Y[k]  = 1 / (YTable [stbiw__jpg_ZigZag[k]] * aasf[row] * aasf[col]);
-         fdtbl_UV[k] = 1 / (UVTable[stbiw__jpg_ZigZag[k]] * aasf[row] * aasf[col]);
-      }
-   }
+   subsample = stbiw__jpg_tables(quality, YTable, UVTable, fdtbl_Y, fdtbl_UV);
 
    // Write Headers
    {
@@ -1500,23 +1765,23 @@ static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, in
       static const unsigned char head2[] = { 0xFF,0xDA,0,0xC,3,1,0,2,0x11,3,0x11,0,0x3F,0 };
       const unsigned char head1[] = { 0xFF,0xC0,0,0x11,8,(unsigned char)(height>>8),STBIW_UCHAR(height),(unsigned char)(width>>8),STBIW_UCHAR(width),
                                       3,1,(unsigned char)(subsample?0x22:0x11),0,2,0x11,1,3,0x11,1,0xFF,0xC4,0x01,0xA2,0 };
-      s->func(s->context, (void*)head0, sizeof(head0));
-      s->func(s->context, (void*)YTable, sizeof(YTable));
+      stbiw__write(s, (void*)head0, sizeof(head0));
+      stbiw__write(s, (void*)YTable, sizeof(YTable));
       stbiw__putc(s, 1);
-      s->func(s->context, UVTable, sizeof(UVTable));
-      s->func(s->context, (void*)head1, sizeof(head1));
-      s->func(s->context, (void*)(std_dc_luminance_nrcodes+1), sizeof(std_dc_luminance_nrcodes)-1);
-      s->func(s->context, (void*)std_dc_luminance_values, sizeof(std_dc_luminance_values));
+      stbiw__write(s, UVTable, sizeof(UVTable));
+      stbiw__write(s, (void*)head1, sizeof(head1));
+      stbiw__write(s, (void*)(std_dc_luminance_nrcodes+1), sizeof(std_dc_luminance_nrcodes)-1);
+      stbiw__write(s, (void*)std_dc_luminance_values, sizeof(std_dc_luminance_values));
       stbiw__putc(s, 0x10); // HTYACinfo
-      s->func(s->context, (void*)(std_ac_luminance_nrcodes+1), sizeof(std_ac_luminance_nrcodes)-1);
-      s->func(s->context, (void*)std_ac_luminance_values, sizeof(std_ac_luminance_values));
+      stbiw__write(s, (void*)(std_ac_luminance_nrcodes+1), sizeof(std_ac_luminance_nrcodes)-1);
+      stbiw__write(s, (void*)std_ac_luminance_values, sizeof(std_ac_luminance_values));
       stbiw__putc(s, 1); // HTUDCinfo
-      s->func(s->context, (void*)(std_dc_chrominance_nrcodes+1), sizeof(std_dc_chrominance_nrcodes)-1);
-      s->func(s->context, (void*)std_dc_chrominance_values, sizeof(std_dc_chrominance_values));
+      stbiw__write(s, (void*)(std_dc_chrominance_nrcodes+1), sizeof(std_dc_chrominance_nrcodes)-1);
+      stbiw__write(s, (void*)std_dc_chrominance_values, sizeof(std_dc_chrominance_values));
       stbiw__putc(s, 0x11); // HTUACinfo
-      s->func(s->context, (void*)(std_ac_chrominance_nrcodes+1), sizeof(std_ac_chrominance_nrcodes)-1);
-      s->func(s->context, (void*)std_ac_chrominance_values, sizeof(std_ac_chrominance_values));
-      s->func(s->context, (void*)head2, sizeof(head2));
+      stbiw__write(s, (void*)(std_ac_chrominance_nrcodes+1), sizeof(std_ac_chrominance_nrcodes)-1);
+      stbiw__write(s, (void*)std_ac_chrominance_values, sizeof(std_ac_chrominance_values));
+      stbiw__write(s, (void*)head2, sizeof(head2));
    }
 
    // Encode 8x8 macroblocks
@@ -1530,7 +1795,21 @@ static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, in
       const unsigned char *dataG = dataR + ofsG;
       const unsigned char *dataB = dataR + ofsB;
       int x, y, pos;
-      if(subsample) {
+      if(coefs) {
+         // MCUs in raster order: 4 Y data units (or 1 without subsampling), then U and V
+         int mcu = subsample ? 16 : 8, k;
+         for(y = 0; y < height; y += mcu) {
+            for(x = 0; x < width; x += mcu) {
+               for(k = 0; k < (subsample ? 4 : 1); ++k, coefs += 64) {
+                  DCY = stbiw__jpg_processCoefs(s, &bitBuf, &bitCnt, coefs, DCY, YDC_HT, YAC_HT);
+               }
+               DCU = stbiw__jpg_processCoefs(s, &bitBuf, &bitCnt, coefs, DCU, UVDC_HT, UVAC_HT);
+               coefs += 64;
+               DCV = stbiw__jpg_processCoefs(s, &bitBuf, &bitCnt, coefs, DCV, UVDC_HT, UVAC_HT);
+               coefs += 64;
+            }
+         }
+      } else if(subsample) {
          for(y = 0; y < height; y += 16) {
             for(x = 0; x < width; x += 16) {
                float Y[256], U[256], V[256];
@@ -1607,8 +1886,21 @@ static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, in
 STBIWDEF int stbi_write_jpg_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void *data, int quality)
 {
    stbi__write_context s = {};
+   int r;
+   stbi__start_write_callbacks(&s, func, context);
+   r = stbi_write_jpg_core(&s, x, y, comp, (void *) data, NULL, quality);
+   stbi__end_write_callbacks(&s);
+   return r;
+}
+
+STBIWDEF int stbi_write_jpg_coefficients_to_func(stbi_write_func *func, void *context, int x, int y, const short *coefs, int quality)
+{
+   stbi__write_context s = {};
+   int r;
    stbi__start_write_callbacks(&s, func, context);
-   return stbi_write_jpg_core(&s, x, y, comp, (void *) data, quality);
+   r = stbi_write_jpg_core(&s, x, y, 3, NULL, coefs, quality);
+   stbi__end_write_callbacks(&s);
+   return r;
 }
 
 
@@ -1617,7 +1909,7 @@ STBIWDEF int stbi_write_jpg(char const *filename, int x, int y, int comp, const
 {
    stbi__write_context s = {};
    if (stbi__start_write_file(&s,filename)) {
-      int r = stbi_write_jpg_core(&s, x, y, comp, data, quality);
+      int r = stbi_write_jpg_core(&s, x, y, comp, data, NULL, quality);
       stbi__end_write_file(&s);
       return r;
    } else
@@ -0,0 +1,1121 @@
+#pragma once
+
+// The offscreen renderer: draws the triangle into a texture every frame and reads it back
+// through whichever GPU conversion the options select. Encoding uses stb_image_write, which the
+// including file has to include (with STB_IMAGE_WRITE_IMPLEMENTATION in exactly one translation
+// unit) before this header.
+
+#include <GLFW/glfw3.h>
+#include <webgpu/webgpu_cpp.h>
+#include <webgpu/webgpu_glfw.h>
+
+#include <atomic>
+#include <cstdio>
+#include <deque>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "alloc_stats.h"
+#include "blob_cache.h"
+#include "dawn/native/DawnNative.h"
+#include "deep_zoom.h"
+#include "dirty_tiles.h"
+#include "frame_hash.h"
+#include "frame_pack.h"
+#include "frame_ring.h"
+#include "frame_sink.h"
+#include "frame_stats.h"
+#include "frame_trace.h"
+#include "gpu_block_compress.h"
+#include "gpu_jpeg.h"
+#include "gpu_pack.h"
+#include "gpu_png_filter.h"
+#include "gpu_timer.h"
+#include "ktx2_writer.h"
+#include "mapped_frame_writer.h"
+#include "mip_pyramid.h"
+#include "pixel_convert.h"
+#include "shader_module.h"
+#include "startup_profile.h"
+
+const char shaderCode[] = R"(
+struct VertexOutput {
+    @builtin(position) Position : vec4f,
+    @location(0) Color: vec3f
+}
+
+@vertex
+fn vs_main(@builtin(vertex_index) in_vertex_index: u32) -> VertexOutput {
+    var output: VertexOutput;
+
+    if (in_vertex_index == 0u) {
+        output.Position = vec4<f32>(-0.5, -0.5, 0.0, 1.0);
+        output.Color = vec3<f32>(1.0, 0.0, 0.0);
+    } else if (in_vertex_index == 1u) {
+        output.Position = vec4<f32>(0.5, -0.5, 0.0, 1.0);
+        output.Color = vec3<f32>(0.0, 1.0, 0.0);
+    } else {
+        output.Position = vec4<f32>(0.0, 0.5, 0.0, 1.0);
+        output.Color = vec3<f32>(0.0, 0.0, 1.0);
+    }
+
+    return output;
+}
+
+@fragment
+fn fs_main(input: VertexOutput) -> @location(0) vec4f {
+     return vec4<f32>(input.Color, 1.0);
+}
+)";
+
+// Bytes per texel of the render target formats we can read back.
+inline uint32_t bytesPerPixel(wgpu::TextureFormat format) {
+    switch (format) {
+        case wgpu::TextureFormat::RGBA16Float:
+            return 8;
+        case wgpu::TextureFormat::RGBA32Float:
+            return 16;
+        default:
+            return 4;
+    }
+}
+
+// CopyTextureToBuffer requires bytesPerRow to be a multiple of 256
+inline uint32_t paddedBytesPerRow(uint32_t width, wgpu::TextureFormat format) {
+    return (width * bytesPerPixel(format) + 255) & ~255u;
+}
+
+inline bool isFloatFormat(wgpu::TextureFormat format) {
+    return format == wgpu::TextureFormat::RGBA16Float ||
+           format == wgpu::TextureFormat::RGBA32Float;
+}
+
+// Same texels without the sRGB decode on load, for views that read the stored bytes.
+inline wgpu::TextureFormat linearViewFormat(wgpu::TextureFormat format) {
+    switch (format) {
+        case wgpu::TextureFormat::RGBA8UnormSrgb:
+            return wgpu::TextureFormat::RGBA8Unorm;
+        case wgpu::TextureFormat::BGRA8UnormSrgb:
+            return wgpu::TextureFormat::BGRA8Unorm;
+        default:
+            return format;
+    }
+}
+
+struct WebGpuRenderer {
+    // Non-empty: Dawn's blob cache of compiled shaders and pipelines is kept in this directory,
+    // so later starts on the same adapter and driver skip compiling them.
+    std::string blobCachePath;
+    // declared before `instance`, which uses them until it is destroyed
+    std::unique_ptr<DiskBlobCache> blobCache;
+    std::unique_ptr<BlobCachePlatform> platform;
+    std::unique_ptr<dawn::native::Instance> instance;
+    wgpu::BackendType backendType = wgpu::BackendType::Vulkan;
+    wgpu::AdapterType adapterType = wgpu::AdapterType::Unknown;
+    std::vector<std::string> enableToggles;
+    std::vector<std::string> disableToggles;
+    // RGBA16Float/RGBA32Float keep linear radiance and are written out as .hdr
+    wgpu::TextureFormat targetFormat = wgpu::TextureFormat::RGBA8UnormSrgb;
+    // Anything but RGBA converts 8-bit targets on the GPU and reads back only the packed bytes;
+    // float targets are always read back as is.
+    ReadbackLayout readbackLayout = ReadbackLayout::RGBA;
+    // Read back only the 64x64 tiles that changed since the last frame and patch them into a
+    // CPU copy of the frame. RGBA readback only.
+    bool trackDirtyTiles = false;
+    // Hash each frame on the GPU first and, when it matches the last delivered frame, skip
+    // the readback, encode and write and only record a repeat in the sink. With dirty tiles, a
+    // frame without dirty tiles counts as a repeat.
+    bool skipRepeats = false;
+    // Run the PNG scanline filters on the GPU and read back filtered rows, leaving only
+    // deflate to the CPU. 8-bit RGBA frames that only go to `sink`.
+    bool gpuPngFilter = false;
+    // Non-zero: JPEG quality; color conversion, DCT and quantization run on the GPU and only
+    // the quantized coefficients are read back for Huffman coding. Same restrictions as
+    // gpuPngFilter, which it takes precedence over.
+    int gpuJpegQuality = 0;
+    // Block compress frames on the GPU and save them as KTX2 textures (sRGB formats for sRGB
+    // targets). Same restrictions as gpuPngFilter; takes precedence over it and gpuJpegQuality.
+    BlockCompression blockCompression = BlockCompression::None;
+    // Also save 1/2, 1/4 and 1/8 size PNGs of every frame, downsampled on the GPU and read
+    // back in the same map as the frame. Plain 8-bit RGBA readback to `sink` only, and not to
+    // a pack, which takes one output per frame.
+    bool thumbnails = false;
+    // Non-empty: export every frame as a tile pyramid under this base path instead of the
+    // other outputs. 8-bit targets only.
+    DeepZoomExporter::Options deepZoomOptions;
+    // Readback buffers in flight at once: up to this many frames are being copied, mapped or
+    // encoded while the next one renders. draw() skips rendering while none is free.
+    uint32_t readbackDepth = 1;
+    // Non-zero: frames are encoded on this many threads instead of in the map callback, and
+    // written to `sink` in order from draw(). Frames that only go to `sink`, without
+    // skipRepeats.
+    uint32_t encodeWorkers = 0;
+    // Stage latencies of every frame when set, plus GPU render and readback times when the
+    // adapter supports timestamp queries.
+    FrameStats* stats = nullptr;
+    // Timeline of every frame's stages when set: draw and Dawn callbacks on the calling
+    // thread, encoding on the workers, GPU work on a "GPU queue" track.
+    FrameTracer* tracer = nullptr;
+    // Shorter init(): when a CPU adapter is asked for, it is requested as the fallback adapter,
+    // and the pipeline compiles asynchronously while the target, buffers and helpers are
+    // allocated.
+    bool fastStart = false;
+    // Phases of the last init(), also on the tracer's timeline when it is set; measured from
+    // when the renderer was created, so callers can add their own (like opening the window).
+    StartupProfile startup;
+    // Frame outputs; any combination may be set. Frames are encoded only when `sink` is.
+    std::unique_ptr<FrameSink> sink;
+#ifdef FRAME_RING_SHM
+    // raw frames for local consumers
+    std::unique_ptr<FrameRingProducer> ring;
+#endif
+#ifdef MAPPED_FRAME_WRITER
+    // uncompressed frame written through a file mapping; .bmp for BMP, anything else is raw
+    std::string mappedOutputPath;
+    MappedFrameDurability mappedDurability = MappedFrameDurability::None;
+#endif
+    wgpu::SwapChain swapChain;
+
+    wgpu::Device device;
+    wgpu::RenderPipeline pipeline;
+    wgpu::TextureView targetTextureView;
+    wgpu::Texture targetTexture;
+    // tracer track for work on the GPU
+    static constexpr uint32_t kGpuTrack = 1;
+
+    // One buffer of the readback ring.
+    struct Readback {
+        // Free -> Mapping -> (Encoding, with encode workers) -> Done -> Free, the last step in
+        // collectReadbacks() so buffers are recycled in submission order
+        enum class State { Free, Mapping, Encoding, Done };
+        WebGpuRenderer* renderer = nullptr;
+        wgpu::Buffer buffer;
+        State state = State::Free;
+        // with encode workers: the frame's outputs, complete once `encoded` is set
+        MemorySink output;
+        std::atomic<bool> encoded{false};
+        uint64_t frame = 0;
+        FrameClock::time_point drawn;
+        FrameClock::time_point submitted;
+        FrameClock::time_point gpuDone;
+    };
+
+    wgpu::BufferDescriptor bufferDesc;
+    std::vector<std::unique_ptr<Readback>> readbacks;
+    // in submission order; encoded frames are written from the front
+    std::deque<Readback*> readbackQueue;
+    std::unique_ptr<WorkerPool> encodePool;
+    GpuFrameTimer gpuTimer;
+    // when draw() started the frame on the target, for FrameStage::Latency
+    FrameClock::time_point frameStart;
+    // number of the frame on the target, for the trace
+    uint64_t frameIndex = 0;
+    // fastStart: when the pipeline was requested, and whether it is still being created
+    FrameClock::time_point pipelineRequested;
+    bool pipelinePending = false;
+    GpuPacker packer;
+    GpuPngFilter pngFilter;
+    GpuJpegEncoder jpegEncoder;
+    GpuBlockCompressor blockCompressor;
+    MipPyramid pyramid;
+    DeepZoomExporter deepZoom;
+    DirtyTileTracker dirtyTiles;
+    bool dirtyTilesInFlight = false;
+    FrameHasher hasher;
+    FrameFingerprint lastFingerprint = {};
+    bool haveFingerprint = false;
+    // set from hashing a frame until it has been delivered; the target must not be redrawn
+    bool fingerprintInFlight = false;
+
+    uint32_t m_width;
+    uint32_t m_height;
+    uint32_t m_bytesPerRow;
+
+    void init(GLFWwindow* window, uint32_t width, uint32_t height) {
+        m_width = width;
+        m_height = height;
+        m_bytesPerRow = paddedBytesPerRow(width, targetFormat);
+        if (isFloatFormat(targetFormat)) {
+            readbackLayout = ReadbackLayout::RGBA;
+        }
+        if (readbackLayout != ReadbackLayout::RGBA) {
+            trackDirtyTiles = false;
+        }
+        if (readbackLayout != ReadbackLayout::RGBA || isFloatFormat(targetFormat) ||
+            trackDirtyTiles || hasRawFrameOutputs()) {
+            gpuPngFilter = false;
+            gpuJpegQuality = 0;
+            blockCompression = BlockCompression::None;
+        }
+        if (blockCompression != BlockCompression::None) {
+            gpuJpegQuality = 0;
+        }
+        if (gpuJpegQuality || blockCompression != BlockCompression::None) {
+            gpuPngFilter = false;
+        }
+        if (isFloatFormat(targetFormat)) {
+            deepZoomOptions.basePath.clear();
+        }
+        if (readbackLayout != ReadbackLayout::RGBA || isFloatFormat(targetFormat) ||
+            trackDirtyTiles || hasRawFrameOutputs() || gpuPngFilter || gpuJpegQuality ||
+            blockCompression != BlockCompression::None || (sink && sink->outputsAreFrames())) {
+            thumbnails = false;
+        }
+        if (!sink || hasRawFrameOutputs() || trackDirtyTiles || skipRepeats) {
+            encodeWorkers = 0;
+        }
+        readbackDepth = std::max(1u, readbackDepth);
+        if (tracer) {
+            tracer->nameTrack(kGpuTrack, "GPU queue");
+        }
+        startup.phases.clear();
+        FrameClock::time_point phaseStart = FrameClock::now();
+        auto endPhase = [this, &phaseStart](const char* name) {
+            FrameClock::time_point now = FrameClock::now();
+            addStartupPhase(name, phaseStart, now);
+            phaseStart = now;
+        };
+
+        WGPUInstanceDescriptor instanceDescriptor{};
+        instanceDescriptor.features.timedWaitAnyEnable = true;
+        dawn::native::DawnInstanceDescriptor dawnInstanceDesc;
+        if (!blobCachePath.empty()) {
+            blobCache = std::make_unique<DiskBlobCache>(blobCachePath);
+            platform = std::make_unique<BlobCachePlatform>(blobCache.get());
+            dawnInstanceDesc.platform = platform.get();
+            instanceDescriptor.nextInChain =
+                reinterpret_cast<const WGPUChainedStruct*>(&dawnInstanceDesc);
+        }
+        instance = std::make_unique<dawn::native::Instance>(&instanceDescriptor);
+        endPhase("instance");
+        // Only the requested backend is discovered; with fastStart a CPU adapter is asked for
+        // as the fallback adapter so the backend doesn't probe its hardware ones as well.
+        wgpu::RequestAdapterOptions options = {};
+        options.backendType = backendType;
+        if (fastStart && adapterType == wgpu::AdapterType::CPU) {
+            options.forceFallbackAdapter = true;
+        }
+        auto adapters = instance->EnumerateAdapters(&options);
+        endPhase("adapters");
+        wgpu::DawnAdapterPropertiesPowerPreference power_props{};
+        wgpu::AdapterProperties adapterProperties{};
+        adapterProperties.nextInChain = &power_props;
+        auto isAdapterType = [this, &adapterProperties](const auto& adapter) -> bool {
+            if (adapterType == wgpu::AdapterType::Unknown) {
+                return true;
+            }
+            adapter.GetProperties(&adapterProperties);
+            return adapterProperties.adapterType == adapterType;
+        };
+        auto preferredAdapter = std::find_if(adapters.begin(), adapters.end(), isAdapterType);
+        if (preferredAdapter == adapters.end()) {
+            fprintf(stderr, "Failed to find an adapter! Please try another adapter type.\n");
+            device = wgpu::Device();
+            return;
+        }
+        if (blobCache) {
+            preferredAdapter->GetProperties(&adapterProperties);
+            blobCache->setAdapter(adapterProperties);
+        }
+
+        // GPU timestamps only matter when someone reads the stats; unquantized, since they
+        // are compared against each other rather than exposed to content
+        wgpu::Adapter adapter(preferredAdapter->Get());
+        bool timestamps = stats && adapter.HasFeature(wgpu::FeatureName::TimestampQuery);
+        std::vector<const char*> enabledToggles;
+        std::vector<const char*> disabledToggles;
+        for (const std::string& toggle : enableToggles) {
+            enabledToggles.push_back(toggle.c_str());
+        }
+        for (const std::string& toggle : disableToggles) {
+            disabledToggles.push_back(toggle.c_str());
+        }
+        if (timestamps) {
+            disabledToggles.push_back("timestamp_quantization");
+        }
+        wgpu::DawnTogglesDescriptor togglesDesc;
+        togglesDesc.enabledToggleCount = enabledToggles.size();
+        togglesDesc.enabledToggles = enabledToggles.data();
+        togglesDesc.disabledToggleCount = disabledToggles.size();
+        togglesDesc.disabledToggles = disabledToggles.data();
+        WGPUFeatureName timestampFeature = WGPUFeatureName_TimestampQuery;
+
+        WGPUDeviceDescriptor deviceDesc = {};
+        deviceDesc.nextInChain = reinterpret_cast<WGPUChainedStruct*>(&togglesDesc);
+        if (timestamps) {
+            deviceDesc.requiredFeatureCount = 1;
+            deviceDesc.requiredFeatures = &timestampFeature;
+        }
+        WGPUDevice backendDevice = preferredAdapter->CreateDevice(&deviceDesc);
+
+        // DawnProcTable backendProcs = dawn::native::GetProcs();
+        // auto surfaceChainedDesc = wgpu::glfw::SetupWindowAndGetSurfaceDescriptor(window);
+        // WGPUSurfaceDescriptor surfaceDesc;
+        // surfaceDesc.label = "surface";
+        // surfaceDesc.nextInChain = reinterpret_cast<WGPUChainedStruct*>(surfaceChainedDesc.get());
+        // WGPUSurface surface = backendProcs.instanceCreateSurface(instance->Get(), &surfaceDesc);
+        // WGPUSwapChainDescriptor swapChainDesc = {};
+        // swapChainDesc.usage = WGPUTextureUsage_RenderAttachment;
+        // swapChainDesc.format = static_cast<WGPUTextureFormat>(wgpu::TextureFormat::BGRA8Unorm);
+        // swapChainDesc.width = width;
+        // swapChainDesc.height = height;
+        // swapChainDesc.presentMode = WGPUPresentMode_Mailbox;
+        // WGPUSwapChain backendSwapChain =
+        //     backendProcs.deviceCreateSwapChain(backendDevice, surface, &swapChainDesc);
+        // swapChain = wgpu::SwapChain::Acquire(backendSwapChain);
+
+        WGPUDevice cDevice = nullptr;
+
+        cDevice = backendDevice;
+
+        device = wgpu::Device::Acquire(cDevice);
+        endPhase("device");
+
+        /////////////
+        wgpu::ShaderModule shaderModule = createShaderModule(device, shaderCode);
+        endPhase("shader");
+
+        wgpu::ColorTargetState colorTargetState{.format = targetFormat};
+
+        wgpu::FragmentState fragmentState{
+            .module = shaderModule, .targetCount = 1, .targets = &colorTargetState};
+
+        wgpu::RenderPipelineDescriptor descriptor{.vertex = {.module = shaderModule},
+                                                  .fragment = &fragmentState};
+        pipeline = wgpu::RenderPipeline();
+        if (fastStart) {
+            pipelinePending = true;
+            device.CreateRenderPipelineAsync(&descriptor, onPipelineCreated, this);
+        } else {
+            pipeline = device.CreateRenderPipeline(&descriptor);
+            endPhase("pipeline");
+        }
+        pipelineRequested = phaseStart;
+
+        wgpu::TextureDescriptor targetTextureDesc;
+        targetTextureDesc.label = "Render target";
+        targetTextureDesc.dimension = wgpu::TextureDimension::e2D;
+        targetTextureDesc.size = {width, height, 1};
+        targetTextureDesc.format = targetFormat;
+        targetTextureDesc.mipLevelCount = 1;
+        targetTextureDesc.sampleCount = 1;
+        targetTextureDesc.usage =
+            wgpu::TextureUsage::RenderAttachment | wgpu::TextureUsage::CopySrc;
+        targetTextureDesc.viewFormats = nullptr;
+        targetTextureDesc.viewFormatCount = 0;
+        wgpu::TextureFormat packViewFormat = linearViewFormat(targetFormat);
+        if (trackDirtyTiles || skipRepeats || thumbnails) {
+            targetTextureDesc.usage |= wgpu::TextureUsage::TextureBinding;
+        }
+        if (readbackLayout != ReadbackLayout::RGBA || gpuPngFilter || gpuJpegQuality ||
+            blockCompression != BlockCompression::None || !deepZoomOptions.basePath.empty()) {
+            targetTextureDesc.usage |= wgpu::TextureUsage::TextureBinding;
+            if (packViewFormat != targetFormat) {
+                targetTextureDesc.viewFormats = &packViewFormat;
+                targetTextureDesc.viewFormatCount = 1;
+            }
+        }
+        targetTexture = createTrackedTexture(device, targetTextureDesc);
+
+        wgpu::TextureViewDescriptor targetTextureViewDesc;
+        targetTextureViewDesc.label = "Render texture view";
+        targetTextureViewDesc.baseArrayLayer = 0;
+        targetTextureViewDesc.arrayLayerCount = 1;
+        targetTextureViewDesc.baseMipLevel = 0;
+        targetTextureViewDesc.mipLevelCount = 1;
+        targetTextureViewDesc.aspect = wgpu::TextureAspect::All;
+        targetTextureView = targetTexture.CreateView(&targetTextureViewDesc);
+
+        bufferDesc.usage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::MapRead;
+        bufferDesc.mappedAtCreation = false;
+        bufferDesc.size = uint64_t(m_bytesPerRow) * height;
+        if (readbackLayout != ReadbackLayout::RGBA) {
+            wgpu::TextureViewDescriptor packViewDesc = targetTextureViewDesc;
+            packViewDesc.label = "Pack source view";
+            packViewDesc.format = packViewFormat;
+            packer.init(device, targetTexture.CreateView(&packViewDesc), width, height,
+                        readbackLayout);
+            // tight rows of the first plane
+            m_bytesPerRow = uint32_t(packer.planes.size[0] / height);
+            bufferDesc.size = packer.planes.totalSize;
+        } else if (gpuPngFilter) {
+            wgpu::TextureViewDescriptor filterViewDesc = targetTextureViewDesc;
+            filterViewDesc.label = "PNG filter source view";
+            filterViewDesc.format = packViewFormat;
+            pngFilter.init(device, targetTexture.CreateView(&filterViewDesc), width, height);
+            bufferDesc.size = pngFilter.bufferSize();
+        } else if (gpuJpegQuality) {
+            wgpu::TextureViewDescriptor jpegViewDesc = targetTextureViewDesc;
+            jpegViewDesc.label = "JPEG source view";
+            jpegViewDesc.format = packViewFormat;
+            float fdtbl[128];
+            bool subsample = stbi_write_jpg_quant_tables(gpuJpegQuality, fdtbl, fdtbl + 64);
+            jpegEncoder.init(device, targetTexture.CreateView(&jpegViewDesc), width, height,
+                             fdtbl, subsample);
+            bufferDesc.size = jpegEncoder.coefficientsSize();
+        } else if (blockCompression != BlockCompression::None) {
+            wgpu::TextureViewDescriptor blockViewDesc = targetTextureViewDesc;
+            blockViewDesc.label = "Block compression source view";
+            blockViewDesc.format = packViewFormat;
+            blockCompressor.init(device, targetTexture.CreateView(&blockViewDesc), width, height,
+                                 blockCompression);
+            bufferDesc.size = blockCompressor.compressedSize();
+        } else if (thumbnails) {
+            pyramid.init(device, targetTextureView, width, height,
+                         linearViewFormat(targetFormat) != targetFormat, bufferDesc.size);
+            bufferDesc.size = pyramid.end;
+        }
+        wgpu::BufferDescriptor readbackDesc = bufferDesc;
+        if (timestamps) {
+            gpuTimer.init(device, bufferDesc.size);
+            readbackDesc.size = gpuTimer.readbackSize();
+        }
+        readbacks.clear();
+        for (uint32_t i = 0; i < readbackDepth; ++i) {
+            auto readback = std::make_unique<Readback>();
+            readback->renderer = this;
+            readback->buffer = createTrackedBuffer(device, readbackDesc);
+            readbacks.push_back(std::move(readback));
+        }
+        if (encodeWorkers) {
+            encodePool = std::make_unique<WorkerPool>(encodeWorkers);
+        }
+        if (!deepZoomOptions.basePath.empty()) {
+            wgpu::TextureViewDescriptor deepZoomViewDesc = targetTextureViewDesc;
+            deepZoomViewDesc.label = "Deep zoom source view";
+            deepZoomViewDesc.format = packViewFormat;
+            bool jpeg = strcmp(deepZoomOptions.extension, "jpg") == 0;
+            deepZoom.init(device, targetTexture, targetTexture.CreateView(&deepZoomViewDesc),
+                          packViewFormat == wgpu::TextureFormat::BGRA8Unorm,
+                          packViewFormat != targetFormat, width, height, deepZoomOptions,
+                          [jpeg](const char* path, const uint8_t* rgba, uint32_t w, uint32_t h) {
+                              AllocScope alloc(jpeg ? AllocTag::DeepZoomJpeg
+                                                    : AllocTag::DeepZoomPng);
+                              StdioFileSink file;
+                              if (!file.begin(path)) {
+                                  return;
+                              }
+                              if (jpeg) {
+                                  stbi_write_jpg_to_func(FrameSink::stbiWrite, &file, int(w),
+                                                         int(h), 4, rgba, 90);
+                              } else {
+                                  stbi_write_png_to_func(FrameSink::stbiWrite, &file, int(w),
+                                                         int(h), 4, rgba, int(w * 4));
+                              }
+                              file.end();
+                          });
+        }
+        if (trackDirtyTiles) {
+            dirtyTiles.init(device, targetTextureView, targetFormat, width, height,
+                            bytesPerPixel(targetFormat), m_bytesPerRow);
+        } else if (skipRepeats) {
+            hasher.init(device, targetTextureView, width, height);
+        }
+        endPhase("resources");
+        while (pipelinePending) {
+            device.Tick();
+            dawn::native::InstanceProcessEvents(instance->Get());
+            std::this_thread::yield();
+        }
+        if (!pipeline) {
+            device = wgpu::Device();
+        }
+    }
+
+    static void onPipelineCreated(WGPUCreatePipelineAsyncStatus status,
+                                  WGPURenderPipeline created, const char* message,
+                                  void* userdata) {
+        WebGpuRenderer* renderer = static_cast<WebGpuRenderer*>(userdata);
+        if (status == WGPUCreatePipelineAsyncStatus_Success) {
+            renderer->pipeline = wgpu::RenderPipeline::Acquire(created);
+        } else {
+            fprintf(stderr, "Failed to create the render pipeline: %s\n", message);
+        }
+        renderer->addStartupPhase("pipeline", renderer->pipelineRequested, FrameClock::now());
+        renderer->pipelinePending = false;
+    }
+
+    void addStartupPhase(const char* name, FrameClock::time_point begin,
+                         FrameClock::time_point end) {
+        startup.add(name, begin, end);
+        if (tracer) {
+            tracer->record(name, begin, end);
+        }
+    }
+
+    // Ring and mapped outputs need the frame's texels.
+    bool hasRawFrameOutputs() const {
+#ifdef FRAME_RING_SHM
+        if (ring) {
+            return true;
+        }
+#endif
+#ifdef MAPPED_FRAME_WRITER
+        if (!mappedOutputPath.empty()) {
+            return true;
+        }
+#endif
+        return false;
+    }
+
+    // Hands a mapped readback (bufferDesc.size bytes) to the ring and/or the sink.
+    void deliverFrame(const uint8_t* pixelData) {
+#ifdef FRAME_RING_SHM
+        if (ring && ring->capacity() >= bufferDesc.size) {
+            // one copy straight from the mapping into shared memory
+            if (uint8_t* slot = ring->acquire()) {
+                memcpy(slot, pixelData, bufferDesc.size);
+                ring->publish(uint32_t(bufferDesc.size), uint32_t(targetFormat), m_width,
+                              m_height, m_bytesPerRow, uint32_t(readbackLayout));
+            }
+        }
+#endif
+#ifdef MAPPED_FRAME_WRITER
+        if (!mappedOutputPath.empty() && packer.enabled()) {
+            // packed planes go out byte for byte
+            writeMappedFrame(mappedOutputPath.c_str(), MappedFrameFormat::Raw, pixelData,
+                             uint32_t(bufferDesc.size), 1, uint32_t(bufferDesc.size), 1, false,
+                             mappedDurability);
+        } else if (!mappedOutputPath.empty()) {
+            bool bmp = mappedOutputPath.ends_with(".bmp") && bytesPerPixel(targetFormat) == 4;
+            writeMappedFrame(mappedOutputPath.c_str(),
+                             bmp ? MappedFrameFormat::Bmp : MappedFrameFormat::Raw, pixelData,
+                             m_width, m_height, m_bytesPerRow, bytesPerPixel(targetFormat),
+                             targetFormat == wgpu::TextureFormat::BGRA8Unorm, mappedDurability);
+        }
+#endif
+        if (sink && stats) {
+            TimedSink timed(*sink);
+            FrameClock::time_point start = FrameClock::now();
+            encodeFrame(pixelData, timed);
+            stats->record(FrameStage::Encode, FrameClock::now() - start - timed.elapsed);
+            stats->record(FrameStage::Write, timed.elapsed);
+        } else if (sink) {
+            encodeFrame(pixelData, *sink);
+        }
+        if (stats) {
+            stats->frameDone();
+        }
+    }
+
+    // Encodes a mapped readback into `out` in the format the options select.
+    void encodeFrame(const uint8_t* pixelData, FrameSink& out) {
+        if (packer.enabled()) {
+            encodePackedFrame(pixelData, out);
+        } else if (pngFilter.enabled()) {
+            AllocScope alloc(AllocTag::PngFiltered);
+            if (out.begin("test_output_buffer.png")) {
+                stbi_write_png_filtered_to_func(FrameSink::stbiWrite, &out, m_width, m_height, 4,
+                                                pixelData);
+                out.end();
+            }
+        } else if (blockCompressor.enabled()) {
+            bool srgb = linearViewFormat(targetFormat) != targetFormat;
+            Ktx2Format format = blockCompression == BlockCompression::BC7 ? ktx2Bc7Format(srgb)
+                                                                         : ktx2Bc1Format(srgb);
+            if (out.begin("test_output_buffer.ktx2")) {
+                writeKtx2(out, format, m_width, m_height,
+                          {{pixelData, blockCompressor.compressedSize()}});
+                out.end();
+            }
+        } else if (jpegEncoder.enabled()) {
+            AllocScope alloc(AllocTag::JpegCoefficients);
+            if (out.begin("test_output_buffer.jpg")) {
+                stbi_write_jpg_coefficients_to_func(FrameSink::stbiWrite, &out, m_width, m_height,
+                                                    reinterpret_cast<const short*>(pixelData),
+                                                    gpuJpegQuality);
+                out.end();
+            }
+        } else if (isFloatFormat(targetFormat)) {
+            std::vector<float> radiance(size_t(m_width) * m_height * 4);
+            readbackRowsToFloat(pixelData, m_bytesPerRow, m_width, m_height,
+                                targetFormat == wgpu::TextureFormat::RGBA16Float,
+                                radiance.data());
+            AllocScope alloc(AllocTag::HdrFloat);
+            if (out.begin("test_output_buffer.hdr")) {
+                stbi_write_hdr_to_func(FrameSink::stbiWrite, &out, m_width, m_height, 4,
+                                       radiance.data());
+                out.end();
+            }
+        } else if (pyramid.enabled()) {
+            encodePyramid(pixelData, out);
+        } else {
+            AllocScope alloc(AllocTag::PngRgba);
+            if (out.begin("test_output_buffer.png")) {
+                stbi_write_png_to_func(FrameSink::stbiWrite, &out, m_width, m_height, 4,
+                                       pixelData, m_bytesPerRow);
+                out.end();
+            }
+        }
+    }
+
+    // Encodes the frame and each pyramid level on its own thread, then writes them in order:
+    // test_output_buffer.png, then test_output_buffer_2.png (half size), _4 and _8.
+    void encodePyramid(const uint8_t* pixelData, FrameSink& out) {
+        auto encodePng = [](AllocTag tag, const uint8_t* pixels, uint32_t w, uint32_t h,
+                            uint32_t stride) {
+            AllocScope alloc(tag);
+            std::vector<uint8_t> png;
+            stbi_write_png_to_func(
+                [](void* context, void* data, int size) {
+                    auto* bytes = static_cast<std::vector<uint8_t>*>(context);
+                    bytes->insert(bytes->end(), static_cast<uint8_t*>(data),
+                                  static_cast<uint8_t*>(data) + size);
+                },
+                &png, int(w), int(h), 4, pixels, int(stride));
+            return png;
+        };
+        std::future<std::vector<uint8_t>> levels[kMipPyramidLevels];
+        for (uint32_t i = 0; i < kMipPyramidLevels; ++i) {
+            levels[i] = std::async(std::launch::async, encodePng, AllocTag::PngThumbnail,
+                                   pixelData + pyramid.offset[i], pyramid.levelWidth(i + 1),
+                                   pyramid.levelHeight(i + 1), pyramid.bytesPerRow[i]);
+        }
+        std::vector<uint8_t> full =
+            encodePng(AllocTag::PngRgba, pixelData, m_width, m_height, m_bytesPerRow);
+        if (out.begin("test_output_buffer.png")) {
+            out.write(full.data(), full.size());
+            out.end();
+        }
+        for (uint32_t i = 0; i < kMipPyramidLevels; ++i) {
+            std::vector<uint8_t> png = levels[i].get();
+            char name[64];
+            snprintf(name, sizeof(name), "test_output_buffer_%u.png", 2u << i);
+            if (out.begin(name)) {
+                out.write(png.data(), png.size());
+                out.end();
+            }
+        }
+    }
+
+    // The frame is identical to the last delivered one: nothing is encoded or written, the ring
+    // and mapped file already hold it.
+    void deliverRepeat() {
+        if (sink) {
+            sink->repeatLast();
+        }
+        if (stats) {
+            stats->frameDone();
+        }
+    }
+
+    // RGB24 is encoded as JPEG, R8 as grayscale PNG and YUV written raw.
+    void encodePackedFrame(const uint8_t* packed, FrameSink& out) {
+        switch (readbackLayout) {
+            case ReadbackLayout::RGB24: {
+                AllocScope alloc(AllocTag::JpegRgb);
+                if (out.begin("test_output_buffer.jpg")) {
+                    stbi_write_jpg_to_func(FrameSink::stbiWrite, &out, m_width, m_height, 3,
+                                           packed, 90);
+                    out.end();
+                }
+                break;
+            }
+            case ReadbackLayout::R8: {
+                AllocScope alloc(AllocTag::PngGray);
+                if (out.begin("test_output_buffer.png")) {
+                    stbi_write_png_to_func(FrameSink::stbiWrite, &out, m_width, m_height, 1,
+                                           packed, m_bytesPerRow);
+                    out.end();
+                }
+                break;
+            }
+            case ReadbackLayout::I420:
+            case ReadbackLayout::NV12:
+                if (out.begin("test_output_buffer.yuv")) {
+                    // planes without the alignment padding between them
+                    for (uint32_t i = 0; i < packer.planes.count; ++i) {
+                        out.write(packed + packer.planes.offset[i], packer.planes.size[i]);
+                    }
+                    out.end();
+                }
+                break;
+            case ReadbackLayout::RGBA:
+                break;
+        }
+    }
+
+    // A readback buffer for the next frame, or null when all are in flight.
+    Readback* freeReadback() const {
+        for (const auto& readback : readbacks) {
+            if (readback->state == Readback::State::Free) {
+                return readback.get();
+            }
+        }
+        return nullptr;
+    }
+
+    // Copies the whole frame (or its packed planes) into a free readback buffer and delivers it
+    // once mapped. The caller has made sure there is one.
+    void readbackFrame() {
+        Readback* readback = freeReadback();
+        if (!readback) {
+            // draw() only renders with a buffer free; this frame is dropped
+            fingerprintInFlight = false;
+            return;
+        }
+        TraceScope trace(tracer, "readback", frameIndex);
+        wgpu::Buffer& buffer = readback->buffer;
+        FrameClock::time_point recordStart = FrameClock::now();
+        wgpu::CommandEncoder encoder = device.CreateCommandEncoder();
+        if (gpuTimer.enabled()) {
+            gpuTimer.encodeBegin(encoder);
+        }
+        if (packer.enabled()) {
+            packer.encode(encoder, buffer);
+        } else if (pngFilter.enabled()) {
+            pngFilter.encode(encoder, buffer);
+        } else if (jpegEncoder.enabled()) {
+            jpegEncoder.encode(encoder, buffer);
+        } else if (blockCompressor.enabled()) {
+            blockCompressor.encode(encoder, buffer);
+        } else {
+            wgpu::ImageCopyTexture source;
+            source.texture = targetTexture;
+
+            wgpu::ImageCopyBuffer destination;
+            destination.buffer = buffer;
+            destination.layout.bytesPerRow = m_bytesPerRow;
+            destination.layout.offset = 0;
+            destination.layout.rowsPerImage = m_height;
+            wgpu::Extent3D copyExtent = {m_width, m_height, 1};
+            encoder.CopyTextureToBuffer(&source, &destination, &copyExtent);
+            if (pyramid.enabled()) {
+                pyramid.encode(encoder, buffer);
+            }
+        }
+        if (gpuTimer.enabled()) {
+            gpuTimer.encodeEnd(encoder, buffer);
+        }
+
+        wgpu::CommandBuffer commands = encoder.Finish();
+        FrameClock::time_point submitStart = FrameClock::now();
+        device.GetQueue().Submit(1, &commands);
+        readback->frame = frameIndex;
+        readback->drawn = frameStart;
+        readback->submitted = FrameClock::now();
+        readback->gpuDone = {};
+        readback->state = Readback::State::Mapping;
+        readbackQueue.push_back(readback);
+        if (stats) {
+            stats->record(FrameStage::CopyRecord, submitStart - recordStart);
+            stats->record(FrameStage::CopySubmit, readback->submitted - submitStart);
+        }
+        if (stats || tracer) {
+            device.GetQueue().OnSubmittedWorkDone(
+                [](WGPUQueueWorkDoneStatus, void* userdata) {
+                    static_cast<Readback*>(userdata)->gpuDone = FrameClock::now();
+                },
+                readback);
+        }
+
+        FrameClock::time_point mapStart = FrameClock::now();
+        buffer.MapAsync(
+            wgpu::MapMode::Read, 0, gpuTimer.enabled() ? gpuTimer.readbackSize() : bufferDesc.size,
+            [](WGPUBufferMapAsyncStatus status, void* userdata) {
+                Readback* readback = static_cast<Readback*>(userdata);
+                readback->renderer->onReadbackMapped(*readback, status);
+            },
+            readback);
+        if (stats) {
+            stats->record(FrameStage::MapIssue, FrameClock::now() - mapStart);
+        }
+    }
+
+    void onReadbackMapped(Readback& readback, WGPUBufferMapAsyncStatus status) {
+        TraceScope trace(tracer, "map callback", readback.frame);
+        fingerprintInFlight = false;
+        FrameClock::time_point mapped = FrameClock::now();
+        if (readback.gpuDone < readback.submitted) {
+            // the work-done callback hasn't run (or wasn't requested); count it all as GPU time
+            readback.gpuDone = mapped;
+        }
+        if (stats) {
+            stats->record(FrameStage::GpuDone, readback.gpuDone - readback.submitted);
+            stats->record(FrameStage::Map, mapped - readback.gpuDone);
+        }
+        if (tracer) {
+            tracer->record("readback on GPU", readback.submitted, readback.gpuDone,
+                           readback.frame, kGpuTrack);
+        }
+        if (status != WGPUBufferMapAsyncStatus_Success) {
+            std::cerr << "Error: Failed to map buffer to CPU memory. Error code: " << status
+                      << std::endl;
+            // the fingerprint was never delivered
+            haveFingerprint = false;
+            readback.state = Readback::State::Done;
+            return;
+        }
+        const uint8_t* pixelData =
+            (const uint8_t*)readback.buffer.GetConstMappedRange(0, bufferDesc.size);
+        const uint64_t* timestamps = nullptr;
+        if (gpuTimer.enabled()) {
+            timestamps = (const uint64_t*)readback.buffer.GetConstMappedRange(
+                gpuTimer.readbackOffset, kGpuTimestampCount * sizeof(uint64_t));
+        }
+        if (stats && timestamps) {
+            std::chrono::nanoseconds render, copy;
+            GpuFrameTimer::durations(timestamps, render, copy);
+            stats->record(FrameStage::GpuRender, render);
+            stats->record(FrameStage::GpuReadback, copy);
+        }
+        if (pixelData == NULL || !encodePool) {
+            if (pixelData != NULL) {
+                TraceScope deliver(tracer, "encode and write", readback.frame);
+                deliverFrame(pixelData);
+                if (stats) {
+                    stats->record(FrameStage::Latency, FrameClock::now() - readback.drawn);
+                }
+            }
+            readback.buffer.Unmap();
+            readback.state = Readback::State::Done;
+            return;
+        }
+        readback.state = Readback::State::Encoding;
+        readback.encoded = false;
+        encodePool->submit([this, &readback, pixelData] {
+            if (tracer) {
+                tracer->nameThread("encode worker");
+            }
+            TraceScope trace(tracer, "encode", readback.frame);
+            FrameClock::time_point start = FrameClock::now();
+            encodeFrame(pixelData, readback.output);
+            if (stats) {
+                stats->record(FrameStage::Encode, FrameClock::now() - start);
+            }
+            readback.encoded = true;
+        });
+    }
+
+    // Writes the frames the encode workers have finished and recycles delivered buffers, oldest
+    // first: a finished frame waits for the ones submitted before it.
+    void collectReadbacks() {
+        while (!readbackQueue.empty()) {
+            Readback& readback = *readbackQueue.front();
+            if (readback.state == Readback::State::Mapping) {
+                break;
+            }
+            if (readback.state == Readback::State::Encoding) {
+                if (!readback.encoded) {
+                    break;
+                }
+                TraceScope trace(tracer, "write", readback.frame);
+                FrameClock::time_point start = FrameClock::now();
+                readback.output.replay(*sink);
+                if (stats) {
+                    FrameClock::time_point written = FrameClock::now();
+                    stats->record(FrameStage::Write, written - start);
+                    stats->record(FrameStage::Latency, written - readback.drawn);
+                    stats->frameDone();
+                }
+                readback.buffer.Unmap();
+            }
+            readback.state = Readback::State::Free;
+            readbackQueue.pop_front();
+        }
+    }
+
+    // Reads back the dirty tile mask, then only the dirty tiles, both from map callbacks. The
+    // tiles are copied from the compared frame rather than the live target, so the mirror stays
+    // consistent even when later frames have been drawn by then.
+    void readbackDirtyTiles() {
+        if (dirtyTilesInFlight) {
+            // compare against the next frame instead
+            return;
+        }
+        dirtyTilesInFlight = true;
+        wgpu::CommandEncoder encoder = device.CreateCommandEncoder();
+        dirtyTiles.encodeDetect(encoder, targetTexture);
+        wgpu::CommandBuffer commands = encoder.Finish();
+        device.GetQueue().Submit(1, &commands);
+
+        dirtyTiles.maskReadback.MapAsync(
+            wgpu::MapMode::Read, 0, dirtyTiles.maskBytes(),
+            [](WGPUBufferMapAsyncStatus status, void* userdata_) {
+                ((WebGpuRenderer*)userdata_)->onDirtyTileMask(status);
+            },
+            (void*)this);
+    }
+
+    void onDirtyTileMask(WGPUBufferMapAsyncStatus status) {
+        if (status != WGPUBufferMapAsyncStatus_Success) {
+            std::cerr << "Error: Failed to map dirty tile mask. Error code: " << status
+                      << std::endl;
+            dirtyTilesInFlight = false;
+            return;
+        }
+        const uint32_t* mask = (const uint32_t*)dirtyTiles.maskReadback.GetConstMappedRange(
+            0, dirtyTiles.maskBytes());
+        uint64_t size = mask ? dirtyTiles.collect(mask) : 0;
+        dirtyTiles.maskReadback.Unmap();
+        if (size == 0) {
+            if (skipRepeats) {
+                deliverRepeat();
+            } else {
+                deliverFrame(dirtyTiles.mirror.data());
+            }
+            dirtyTilesInFlight = false;
+            return;
+        }
+
+        wgpu::CommandEncoder encoder = device.CreateCommandEncoder();
+        dirtyTiles.encodeTileCopies(encoder, dirtyTiles.previous);
+        wgpu::CommandBuffer commands = encoder.Finish();
+        device.GetQueue().Submit(1, &commands);
+
+        dirtyTiles.tileReadback.MapAsync(
+            wgpu::MapMode::Read, 0, size,
+            [](WGPUBufferMapAsyncStatus status, void* userdata_) {
+                ((WebGpuRenderer*)userdata_)->onDirtyTiles(status);
+            },
+            (void*)this);
+    }
+
+    void onDirtyTiles(WGPUBufferMapAsyncStatus status) {
+        dirtyTilesInFlight = false;
+        if (status != WGPUBufferMapAsyncStatus_Success) {
+            std::cerr << "Error: Failed to map dirty tiles. Error code: " << status << std::endl;
+            return;
+        }
+        const uint8_t* tiles = (const uint8_t*)dirtyTiles.tileReadback.GetConstMappedRange(
+            0, dirtyTiles.readbackSize);
+        if (tiles != NULL) {
+            dirtyTiles.patchMirror(tiles);
+        }
+        dirtyTiles.tileReadback.Unmap();
+        if (tiles != NULL) {
+            deliverFrame(dirtyTiles.mirror.data());
+        }
+    }
+
+    // Reads back the frame's fingerprint and only continues with readbackFrame() when it
+    // differs from the last delivered frame.
+    void readbackFingerprint() {
+        fingerprintInFlight = true;
+        wgpu::CommandEncoder encoder = device.CreateCommandEncoder();
+        hasher.encode(encoder);
+        wgpu::CommandBuffer commands = encoder.Finish();
+        device.GetQueue().Submit(1, &commands);
+
+        hasher.readback.MapAsync(
+            wgpu::MapMode::Read, 0, sizeof(FrameFingerprint),
+            [](WGPUBufferMapAsyncStatus status, void* userdata_) {
+                ((WebGpuRenderer*)userdata_)->onFingerprint(status);
+            },
+            (void*)this);
+    }
+
+    void onFingerprint(WGPUBufferMapAsyncStatus status) {
+        const void* lanes = status == WGPUBufferMapAsyncStatus_Success
+                                ? hasher.readback.GetConstMappedRange(0, sizeof(FrameFingerprint))
+                                : nullptr;
+        if (lanes == NULL) {
+            if (status == WGPUBufferMapAsyncStatus_Success) {
+                hasher.readback.Unmap();
+            }
+            // can't tell, so treat the frame as new
+            haveFingerprint = false;
+            readbackFrame();
+            return;
+        }
+        FrameFingerprint fingerprint;
+        memcpy(fingerprint.data(), lanes, sizeof(fingerprint));
+        hasher.readback.Unmap();
+        if (haveFingerprint && fingerprint == lastFingerprint) {
+            deliverRepeat();
+            fingerprintInFlight = false;
+            return;
+        }
+        lastFingerprint = fingerprint;
+        haveFingerprint = true;
+        readbackFrame();
+    }
+
+    // Frames read back through readbackFrame() and therefore need a free readback buffer.
+    bool usesReadbackRing() const {
+        return !deepZoom.enabled() && !trackDirtyTiles;
+    }
+
+    void draw() {
+        if (tracer) {
+            tracer->nameThread("render");
+        }
+        collectReadbacks();
+        if (fingerprintInFlight || deepZoom.busy() || (usesReadbackRing() && !freeReadback())) {
+            // the target still holds the frame being hashed or read back, or every readback
+            // buffer is in flight
+            TraceScope trace(tracer, "wait");
+            device.Tick();
+            dawn::native::InstanceProcessEvents(instance->Get());
+            deepZoom.pump();
+            return;
+        }
+
+        wgpu::RenderPassColorAttachment attachment{//.view = swapChain.GetCurrentTextureView(),
+                                                   .view = targetTextureView,
+                                                   .loadOp = wgpu::LoadOp::Clear,
+                                                   .storeOp = wgpu::StoreOp::Store,
+                                                   .clearValue = wgpu::Color{0.5, 0.5, 0.5, 1.0}};
+
+        wgpu::RenderPassTimestampWrites timestampWrites = gpuTimer.renderPassWrites();
+        wgpu::RenderPassDescriptor renderpass{
+            .colorAttachmentCount = 1,
+            .colorAttachments = &attachment,
+            .timestampWrites = gpuTimer.enabled() ? &timestampWrites : nullptr};
+
+        ++frameIndex;
+        TraceScope trace(tracer, "draw", frameIndex);
+        frameStart = FrameClock::now();
+        wgpu::CommandEncoder encoder = device.CreateCommandEncoder();
+        FrameClock::time_point passStart = FrameClock::now();
+        wgpu::RenderPassEncoder pass = encoder.BeginRenderPass(&renderpass);
+        pass.SetPipeline(pipeline);
+        pass.Draw(3);
+        pass.End();
+        wgpu::CommandBuffer commands = encoder.Finish();
+        FrameClock::time_point submitStart = FrameClock::now();
+        device.GetQueue().Submit(1, &commands);
+        if (stats) {
+            stats->record(FrameStage::EncoderCreate, passStart - frameStart);
+            stats->record(FrameStage::RenderPass, submitStart - passStart);
+            stats->record(FrameStage::Submit, FrameClock::now() - submitStart);
+        }
+
+        //////////////////////
+        // swapChain.Present();
+        ///////////////////////
+
+        if (deepZoom.enabled()) {
+            deepZoom.start();
+        } else if (trackDirtyTiles) {
+            readbackDirtyTiles();
+        } else if (hasher.enabled()) {
+            readbackFingerprint();
+        } else {
+            readbackFrame();
+        }
+
+        TraceScope events(tracer, "process events");
+        device.Tick();
+
+        dawn::native::InstanceProcessEvents(instance->Get());
+    }
+
+    // Waits until every frame drawn so far has reached the outputs.
+    void flush() {
+        for (;;) {
+            collectReadbacks();
+            if (!fingerprintInFlight && !dirtyTilesInFlight && !deepZoom.busy() &&
+                readbackQueue.empty()) {
+                return;
+            }
+            device.Tick();
+            dawn::native::InstanceProcessEvents(instance->Get());
+            deepZoom.pump();
+            std::this_thread::yield();
+        }
+    }
+};